@@ -0,0 +1,168 @@
+#include "AdblockHostIndex.h"
+
+#include <algorithm>
+
+static bool IsHostChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '_';
+}
+
+// Lowercase copy of a host name, empty if it is not one that DomainTrie::Match() can find (no dot, or an empty label)
+static std::string IndexableHost(std::string_view host)
+{
+	if (host.empty() || host.front() == '.' || host.back() == '.' || host.find('.') == std::string_view::npos || host.find("..") != std::string_view::npos)
+		return std::string();
+
+	std::string lowered(host);
+	for (char &c : lowered)
+		c = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	return lowered;
+}
+
+AdblockHostIndex::AdblockHostIndex():
+	hostFilters(0),
+	contextExceptions(0),
+	unrestrictedExceptions(0)
+{
+}
+
+void AdblockHostIndex::Build(const std::string &rules, bool native)
+{
+	indexRules.clear();
+	hostFilters = 0;
+	contextExceptions = 0;
+	unrestrictedExceptions = 0;
+
+	std::string_view input(rules);
+	while (!input.empty())
+	{
+		size_t lineEnd = input.find('\n');
+		std::string_view rule = input.substr(0, lineEnd);
+		input.remove_prefix(lineEnd == std::string_view::npos ? input.size() : lineEnd + 1);
+
+		if (!rule.empty() && rule.back() == '\r')
+			rule.remove_suffix(1);
+
+		// Comments, the list header and cosmetic filters never block a request
+		if (rule.empty() || rule[0] == '!' || rule[0] == '[' || rule.find('#') != std::string_view::npos)
+			continue;
+
+		const bool exception = rule.compare(0, 2, "@@") == 0;
+		std::string_view filter = exception ? rule.substr(2) : rule;
+		const size_t optionsPos = filter.rfind('$');
+		const std::string_view pattern = filter.substr(0, optionsPos);
+		const std::string_view options = (optionsPos == std::string_view::npos) ? std::string_view() : filter.substr(optionsPos + 1);
+
+		if (exception)
+		{
+			AddException(pattern, options);
+		}
+		else if (options.find("badfilter") != std::string_view::npos)
+		{
+			// Disables another filter, which may be one of the host filters
+		}
+		else
+		{
+			// Only ||host^ on its own, anything after the ^ (||host^|, ||host^/path) looks at the rest of the url
+			if (pattern.size() < 4 || pattern.compare(0, 2, "||") != 0 || pattern.back() != '^')
+				continue;
+
+			// A * or another special character in the host would let the filter depend on the path after all
+			const std::string host = IndexableHost(pattern.substr(2, pattern.size() - 3));
+			if (host.empty() || !std::all_of(host.begin(), host.end(), IsHostChar))
+				continue;
+
+			blockedHosts.Insert(host, DomainTrie::tfDomain);
+			hostFilters++;
+		}
+
+		indexRules.append(rule.data(), rule.size());
+		indexRules += '\n';
+	}
+
+	blockedHosts.Build();
+	exceptionHosts.Build();
+	exceptionContexts.Build();
+
+	client.clear();
+	matcher.reset();
+	if (native)
+	{
+		matcher.reset(new AdblockMatcher());
+		matcher->Build(indexRules);
+	}
+	else
+		client.parse(indexRules.c_str());
+}
+
+void AdblockHostIndex::AddException(std::string_view pattern, std::string_view options)
+{
+	// ||host followed by anything that ends a host name (^, /, :, ?) can only match requests to host or its sub domains.
+	// Without such a character (||ads.example*, ||ads.example) it may also match ads.example.net.
+	if (pattern.compare(0, 2, "||") == 0)
+	{
+		size_t hostEnd = 2;
+		while (hostEnd < pattern.size() && IsHostChar(pattern[hostEnd]))
+			hostEnd++;
+
+		const std::string host = IndexableHost(pattern.substr(2, hostEnd - 2));
+		if (!host.empty() && hostEnd < pattern.size() && pattern[hostEnd] != '*')
+		{
+			exceptionHosts.Insert(host, DomainTrie::tfDomain);
+			return;
+		}
+	}
+
+	// Anywhere else, unless $domain= names the referring hosts it applies to. Those are kept by their last two labels, so
+	// the check does not depend on how precisely AdBlockClient compares them.
+	size_t domainsPos = options.find("domain=");
+	if (domainsPos != std::string_view::npos && (domainsPos == 0 || options[domainsPos - 1] == ','))
+	{
+		std::string_view domains = options.substr(domainsPos + 7);
+		domains = domains.substr(0, domains.find(','));
+
+		bool restricted = false;
+		while (!domains.empty())
+		{
+			size_t domainEnd = domains.find('|');
+			std::string_view domain = domains.substr(0, domainEnd);
+			domains.remove_prefix(domainEnd == std::string_view::npos ? domains.size() : domainEnd + 1);
+
+			// ~domain excludes a referring host, it does not restrict the filter to any
+			if (domain.empty() || domain[0] == '~')
+				continue;
+
+			size_t lastDot = domain.rfind('.');
+			size_t baseStart = (lastDot == std::string_view::npos || lastDot == 0) ? std::string_view::npos : domain.rfind('.', lastDot - 1);
+			const std::string base = IndexableHost(baseStart == std::string_view::npos ? domain : domain.substr(baseStart + 1));
+			if (base.empty())
+			{
+				restricted = false;
+				break;
+			}
+
+			exceptionContexts.Insert(base, DomainTrie::tfDomain);
+			restricted = true;
+		}
+
+		if (restricted)
+		{
+			contextExceptions++;
+			return;
+		}
+	}
+
+	unrestrictedExceptions++;
+}
+
+bool AdblockHostIndex::Covers(const NormalizedHost &host, std::string_view referringHost) const
+{
+	if (!Enabled() || blockedHosts.Match(host) == 0 || exceptionHosts.Match(host) != 0)
+		return false;
+
+	// Without a referring host it is up to AdBlockClient how $domain= applies, leave those requests to the full match
+	if (contextExceptions > 0 && (referringHost.empty() || exceptionContexts.Match(referringHost) != 0))
+		return false;
+
+	return true;
+}
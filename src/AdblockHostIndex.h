@@ -0,0 +1,64 @@
+#ifndef ECAP_NBLOCK_ADBLOCKHOSTINDEX_H
+#define ECAP_NBLOCK_ADBLOCKHOSTINDEX_H
+
+#include "AdblockMatcher.h"
+#include "DomainTrie.h"
+#include "HostName.h"
+#include "ad_block_client.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Host level verdicts for NetFilterAdblock.
+// Filters like ||ads.example.com^ (with or without options) only look at the host of a request, its type and the
+// referring host, never at the path. They are parsed into a second, much smaller AdBlockClient. When that client blocks a
+// request and no exception filter can apply to the host, every request to that host of the same type and from the same
+// referring host is blocked as well, so a single cached verdict answers all of them without matching the full uri.
+//
+// Exception filters anchored to a host (@@||example.com/path) only rule out their own host and its sub domains. All
+// other exception filters can apply anywhere: restricted with $domain= they rule out the referring hosts in those
+// domains, without a restriction they turn host level verdicts off completely.
+class AdblockHostIndex {
+public:
+	AdblockHostIndex();
+
+	// Classifies rules (one filter per line, as passed to AdBlockClient::parse()), native matches the host filters with
+	// an AdblockMatcher instead of AdBlockClient
+	void Build(const std::string &rules, bool native = false);
+
+	// The filters Build() made use of, building from these alone gives the same index (stored in a BlocklistImage)
+	const std::string &Rules() const { return indexRules; }
+
+	bool Enabled() const { return hostFilters > 0 && unrestrictedExceptions == 0; }
+	size_t HostFilters() const { return hostFilters; }
+	size_t UnrestrictedExceptions() const { return unrestrictedExceptions; }
+
+	// True if the verdict for requests to host from referringHost only depends on the host filters
+	bool Covers(const NormalizedHost &host, std::string_view referringHost) const;
+
+	// Matches the request against the host filters only, arguments as for AdBlockClient::matches()
+	bool Blocked(const char *uri, FilterOption options, const char *referringHost)
+	{
+		return matcher ? matcher->Matches(uri, options, referringHost) : client.matches(uri, options, referringHost);
+	}
+
+private:
+	AdBlockClient client;
+	std::unique_ptr<AdblockMatcher> matcher;
+	DomainTrie blockedHosts; // hosts of the filters in client
+	DomainTrie exceptionHosts; // hosts exception filters are anchored to
+	DomainTrie exceptionContexts; // $domain= of the exception filters that are not anchored to a host
+	std::string indexRules;
+	size_t hostFilters;
+	size_t contextExceptions;
+	size_t unrestrictedExceptions;
+
+	void AddException(std::string_view pattern, std::string_view options);
+
+	/* prohibited and not implemented */
+	AdblockHostIndex(const AdblockHostIndex&);
+	AdblockHostIndex &operator=(const AdblockHostIndex&);
+};
+
+#endif
@@ -0,0 +1,676 @@
+#include "AdblockMatcher.h"
+#include "HostName.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Request types nBlock never classifies a request as ($media, $font, ...), filters limited to them never match
+const uint32_t unclassifiedType = 1u << 30;
+
+const size_t maxKeyLength = 32;
+
+const std::pair<const char *, uint32_t> typeOptions[] = {
+	{"script", FOScript},
+	{"image", FOImage},
+	{"stylesheet", FOStylesheet},
+	{"css", FOStylesheet},
+	{"object", FOObject},
+	{"xmlhttprequest", FOXmlHttpRequest},
+	{"xhr", FOXmlHttpRequest},
+	{"object-subrequest", FOObjectSubrequest},
+	{"subdocument", FOSubdocument},
+	{"frame", FOSubdocument},
+	{"document", FODocument},
+	{"doc", FODocument},
+	{"other", FOOther},
+	{"xbl", FOXBL},
+	{"media", unclassifiedType},
+	{"font", unclassifiedType},
+	{"websocket", unclassifiedType},
+	{"popup", unclassifiedType},
+	{"elemhide", unclassifiedType}, // only make sense for element hiding
+	{"generichide", unclassifiedType},
+};
+
+const uint32_t requestTypes = FOScript | FOImage | FOStylesheet | FOObject | FOXmlHttpRequest | FOObjectSubrequest | FOSubdocument | FODocument | FOOther | FOXBL;
+
+inline char Lower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+std::string Lowered(std::string_view value)
+{
+	std::string lowered(value);
+	for (char &c : lowered)
+		c = Lower(c);
+	return lowered;
+}
+
+// ^ in a pattern: anything but a letter, a digit or one of _ - . %
+inline bool IsSeparator(unsigned char c)
+{
+	return !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' || c == '%');
+}
+
+// Matches pattern (literals, * and ^) against the start of text, or all of it when anchorEnd is set. A ^ also matches
+// the end of text. Backtracks to the last * only, which is enough as a * matches any number of characters.
+bool Glob(std::string_view pattern, std::string_view text, bool anchorEnd)
+{
+	size_t p = 0, t = 0;
+	size_t starPattern = std::string_view::npos, starText = 0;
+
+	while (true)
+	{
+		if (p < pattern.size() && pattern[p] == '*')
+		{
+			starPattern = ++p;
+			starText = t;
+			continue;
+		}
+
+		if (p < pattern.size() && t < text.size() && (pattern[p] == text[t] || (pattern[p] == '^' && IsSeparator(text[t]))))
+		{
+			p++;
+			t++;
+			continue;
+		}
+
+		if (p < pattern.size() && t == text.size() && pattern[p] == '^')
+		{
+			p++;
+			continue;
+		}
+
+		if (p == pattern.size() && (!anchorEnd || t == text.size()))
+			return true;
+
+		if (starPattern == std::string_view::npos || starText >= text.size())
+			return false;
+
+		p = starPattern;
+		t = ++starText;
+	}
+}
+
+// domain is host or one of its parent domains
+bool InDomain(std::string_view host, std::string_view domain)
+{
+	if (host.size() < domain.size() || host.compare(host.size() - domain.size(), domain.size(), domain) != 0)
+		return false;
+	return host.size() == domain.size() || host[host.size() - domain.size() - 1] == '.';
+}
+
+// Literal fragments of a pattern, the runs between * and ^, each of them in every uri the pattern matches
+void Fragments(std::string_view pattern, std::vector<std::string_view> &fragments)
+{
+	fragments.clear();
+	size_t start = 0;
+	while (start < pattern.size())
+	{
+		size_t end = pattern.find_first_of("*^", start);
+		if (end == std::string_view::npos)
+			end = pattern.size();
+		if (end > start)
+			fragments.push_back(pattern.substr(start, std::min(end - start, maxKeyLength)));
+		start = end + 1;
+	}
+}
+
+} // namespace
+
+AdblockMatcher::AdblockMatcher():
+	exceptionFilters(0),
+	ignoredFilters(0)
+{
+	std::fill(rootNext, rootNext + 256, 0);
+	nodes.push_back(Node());
+}
+
+AdblockMatcher::~AdblockMatcher()
+{
+}
+
+size_t AdblockMatcher::OptionsStart(std::string_view body, bool &regex)
+{
+	// The options of a /regular expression/ follow its closing slash
+	regex = false;
+	if (body.size() > 2 && body[0] == '/')
+	{
+		const size_t close = body.rfind('/');
+		if (close > 0 && (close + 1 == body.size() || body[close + 1] == '$'))
+		{
+			regex = true;
+			return (close + 1 == body.size()) ? std::string_view::npos : close + 1;
+		}
+	}
+	return body.rfind('$');
+}
+
+bool AdblockMatcher::Parse(std::string_view rule, Filter &filter)
+{
+	filter.exception = rule.compare(0, 2, "@@") == 0;
+	std::string_view body = filter.exception ? rule.substr(2) : rule;
+
+	bool regex = false;
+	const size_t optionsPos = OptionsStart(body, regex);
+
+	std::string_view pattern = body.substr(0, optionsPos);
+	std::string_view options = (optionsPos == std::string_view::npos) ? std::string_view() : body.substr(optionsPos + 1);
+
+	filter.types = 0;
+	filter.excludedTypes = 0;
+	filter.thirdParty = tpAny;
+	filter.important = false;
+	filter.matchCase = false;
+
+	while (!options.empty())
+	{
+		size_t optionEnd = options.find(',');
+		std::string option = Lowered(options.substr(0, optionEnd));
+		options.remove_prefix(optionEnd == std::string_view::npos ? options.size() : optionEnd + 1);
+
+		const bool negated = !option.empty() && option[0] == '~';
+		if (negated)
+			option.erase(0, 1);
+
+		if (option.compare(0, 7, "domain=") == 0)
+		{
+			std::string_view domains(option);
+			domains.remove_prefix(7);
+			while (!domains.empty())
+			{
+				size_t domainEnd = domains.find('|');
+				std::string_view domain = domains.substr(0, domainEnd);
+				domains.remove_prefix(domainEnd == std::string_view::npos ? domains.size() : domainEnd + 1);
+
+				if (!domain.empty() && domain[0] == '~')
+					filter.excludedDomains.emplace_back(domain.substr(1));
+				else if (!domain.empty())
+					filter.domains.emplace_back(domain);
+			}
+			continue;
+		}
+
+		if (option == "third-party" || option == "3p")
+		{
+			filter.thirdParty = negated ? tpNever : tpOnly;
+			continue;
+		}
+		if (option == "first-party" || option == "1p")
+		{
+			filter.thirdParty = negated ? tpOnly : tpNever;
+			continue;
+		}
+		if (option == "match-case")
+		{
+			filter.matchCase = true;
+			continue;
+		}
+		if (option == "important")
+		{
+			filter.important = true;
+			continue;
+		}
+		if (option == "collapse")
+			continue;
+
+		bool known = false;
+		for (const auto &type : typeOptions)
+		{
+			if (option == type.first)
+			{
+				(negated ? filter.excludedTypes : filter.types) |= type.second;
+				known = true;
+				break;
+			}
+		}
+
+		// $ping, $csp=, $redirect= and the like: AdBlockClient does not use these filters either
+		if (!known)
+			return false;
+	}
+
+	if (regex)
+	{
+		try
+		{
+			const auto flags = std::regex::ECMAScript | std::regex::optimize | (filter.matchCase ? std::regex::flag_type() : std::regex::icase);
+			filter.expression.reset(new std::regex(pattern.begin() + 1, pattern.end() - 1, flags));
+		}
+		catch (const std::regex_error &)
+		{
+			return false;
+		}
+		filter.anchor = anNone;
+		filter.anchorEnd = false;
+		return true;
+	}
+
+	filter.anchor = anNone;
+	if (pattern.compare(0, 2, "||") == 0)
+	{
+		filter.anchor = anHost;
+		pattern.remove_prefix(2);
+	}
+	else if (pattern.compare(0, 1, "|") == 0)
+	{
+		filter.anchor = anStart;
+		pattern.remove_prefix(1);
+	}
+
+	filter.anchorEnd = !pattern.empty() && pattern.back() == '|';
+	if (filter.anchorEnd)
+		pattern.remove_suffix(1);
+
+	// Unanchored patterns may start anywhere, a * in front lets Glob() find them. Runs of * are one *.
+	filter.pattern.clear();
+	if (filter.anchor == anNone)
+		filter.pattern += '*';
+	for (char c : pattern)
+	{
+		if (c == '*' && !filter.pattern.empty() && filter.pattern.back() == '*')
+			continue;
+		filter.pattern += filter.matchCase ? c : Lower(c);
+	}
+
+	// Without an end anchor a trailing * changes nothing
+	if (!filter.anchorEnd)
+	{
+		while (filter.pattern.size() > 1 && filter.pattern.back() == '*')
+			filter.pattern.pop_back();
+	}
+
+	return true;
+}
+
+void AdblockMatcher::Build(const std::string &rules)
+{
+	text.clear();
+	filters.clear();
+	unkeyedFilters.clear();
+	regexFilters.clear();
+	exceptionFilters = 0;
+	ignoredFilters = 0;
+
+	std::vector<std::string_view> lines;
+	std::string_view input(rules);
+	while (!input.empty())
+	{
+		size_t lineEnd = input.find('\n');
+		std::string_view rule = input.substr(0, lineEnd);
+		input.remove_prefix(lineEnd == std::string_view::npos ? input.size() : lineEnd + 1);
+
+		if (!rule.empty() && rule.back() == '\r')
+			rule.remove_suffix(1);
+
+		// Comments, the list header and cosmetic filters never block a request
+		if (rule.empty() || rule[0] == '!' || rule[0] == '[' || rule.find('#') != std::string_view::npos)
+			continue;
+
+		lines.push_back(rule);
+	}
+
+	// $badfilter disables the filter that is the same except for that option
+	std::unordered_set<std::string> disabled;
+	for (std::string_view rule : lines)
+	{
+		const size_t optionsPos = rule.rfind('$');
+		if (optionsPos == std::string_view::npos || rule.find("badfilter", optionsPos) == std::string_view::npos)
+			continue;
+
+		std::string options;
+		std::string_view input = rule.substr(optionsPos + 1);
+		while (!input.empty())
+		{
+			size_t optionEnd = input.find(',');
+			std::string_view option = input.substr(0, optionEnd);
+			input.remove_prefix(optionEnd == std::string_view::npos ? input.size() : optionEnd + 1);
+			if (option == "badfilter")
+				continue;
+			options += options.empty() ? "" : ",";
+			options.append(option.data(), option.size());
+		}
+
+		disabled.insert(std::string(rule.substr(0, optionsPos)) + (options.empty() ? "" : "$") + options);
+	}
+
+	for (std::string_view rule : lines)
+	{
+		filters.emplace_back();
+		Filter &filter = filters.back();
+
+		const size_t optionsPos = rule.rfind('$');
+		const bool badfilter = optionsPos != std::string_view::npos && rule.find("badfilter", optionsPos) != std::string_view::npos;
+		if (badfilter || (!disabled.empty() && disabled.count(std::string(rule)) > 0) || !Parse(rule, filter))
+		{
+			filters.pop_back();
+			ignoredFilters++;
+			continue;
+		}
+
+		filter.textStart = text.size();
+		filter.textLength = rule.size();
+		text.append(rule.data(), rule.size());
+		text += '\n';
+
+		if (filter.exception)
+			exceptionFilters++;
+	}
+
+	// Index every filter by the literal fragment the fewest others have, counting every fragment once per filter
+	std::unordered_map<std::string, uint32_t> shares;
+	std::vector<std::string_view> fragments;
+	for (const Filter &filter : filters)
+	{
+		if (filter.expression)
+			continue;
+
+		const std::string lowered = Lowered(filter.pattern);
+		Fragments(lowered, fragments);
+		std::sort(fragments.begin(), fragments.end());
+		fragments.erase(std::unique(fragments.begin(), fragments.end()), fragments.end());
+		for (std::string_view fragment : fragments)
+			shares[std::string(fragment)]++;
+	}
+
+	std::vector<std::string> keys(filters.size());
+	for (uint32_t i = 0; i < filters.size(); i++)
+	{
+		const Filter &filter = filters[i];
+		if (filter.expression)
+		{
+			regexFilters.push_back(i);
+			continue;
+		}
+
+		const std::string lowered = Lowered(filter.pattern);
+		Fragments(lowered, fragments);
+
+		// Short fragments (a single /) are in nearly every uri, they only count when there is nothing longer
+		std::string_view best;
+		uint32_t bestShares = 0;
+		for (std::string_view fragment : fragments)
+		{
+			const uint32_t fragmentShares = shares.find(std::string(fragment))->second;
+			const bool longer = (fragment.size() >= 3) != (best.size() >= 3);
+			if (best.empty() || (longer && fragment.size() >= 3) || (!longer && (fragmentShares < bestShares || (fragmentShares == bestShares && fragment.size() > best.size()))))
+			{
+				best = fragment;
+				bestShares = fragmentShares;
+			}
+		}
+
+		if (best.empty())
+			unkeyedFilters.push_back(i);
+		else
+			keys[i] = std::string(best);
+	}
+
+	std::unordered_map<std::string, uint32_t>().swap(shares);
+	BuildAutomaton(keys);
+}
+
+void AdblockMatcher::BuildAutomaton(const std::vector<std::string> &keys)
+{
+	// A trie of the keys first, with the children of every node in a list of their own
+	std::vector<std::vector<Edge>> children(1);
+	std::vector<uint32_t> keyNodes(keys.size(), 0);
+	std::fill(rootNext, rootNext + 256, 0);
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		uint32_t node = 0;
+		for (unsigned char byte : keys[i])
+		{
+			std::vector<Edge> &edges = children[node];
+			auto found = std::find_if(edges.begin(), edges.end(), [byte](const Edge &edge) { return edge.byte == byte; });
+			if (found != edges.end())
+			{
+				node = found->target;
+				continue;
+			}
+
+			const uint32_t child = children.size();
+			edges.push_back(Edge{byte, child});
+			children.emplace_back();
+			node = child;
+		}
+		keyNodes[i] = node;
+	}
+
+	// Numbered breadth first, so the nodes close to the root, where a scan spends most of its time, share cache lines
+	std::vector<uint32_t> order(1, 0), number(children.size(), 0);
+	order.reserve(children.size());
+	for (size_t head = 0; head < order.size(); head++)
+	{
+		std::vector<Edge> &edges = children[order[head]];
+		std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) { return a.byte < b.byte; });
+		for (const Edge &edge : edges)
+		{
+			number[edge.target] = order.size();
+			order.push_back(edge.target);
+		}
+	}
+
+	nodes.assign(children.size(), Node());
+	edgeBytes.clear();
+	edgeTargets.clear();
+	edgeBytes.reserve(children.size() - 1);
+	edgeTargets.reserve(children.size() - 1);
+	for (uint32_t node = 0; node < order.size(); node++)
+	{
+		std::vector<Edge> &edges = children[order[node]];
+		nodes[node].firstEdge = edgeBytes.size();
+		nodes[node].edgeCount = edges.size();
+		for (const Edge &edge : edges)
+		{
+			edgeBytes.push_back(edge.byte);
+			edgeTargets.push_back(number[edge.target]);
+		}
+		std::vector<Edge>().swap(edges);
+	}
+	for (uint32_t &node : keyNodes)
+		node = number[node];
+	for (uint32_t e = 0; e < nodes[0].edgeCount; e++)
+		rootNext[edgeBytes[e]] = edgeTargets[e];
+
+	// The filters of every key node, next to each other in outputs
+	outputStart.assign(nodes.size() + 1, 0);
+	for (uint32_t node : keyNodes)
+	{
+		if (node != 0)
+			outputStart[node + 1]++;
+	}
+	for (size_t node = 0; node < nodes.size(); node++)
+	{
+		nodes[node].hasOutputs = outputStart[node + 1] > 0;
+		outputStart[node + 1] += outputStart[node];
+	}
+	outputs.assign(outputStart.back(), 0);
+	std::vector<uint32_t> filled(outputStart.begin(), outputStart.end() - 1);
+	for (size_t i = 0; i < keyNodes.size(); i++)
+	{
+		if (keyNodes[i] != 0)
+			outputs[filled[keyNodes[i]]++] = i;
+	}
+
+	// Failure and output links in node order, which is breadth first: a failure link always leads closer to the root
+	for (uint32_t node = 1; node < nodes.size(); node++)
+	{
+		const Node &parent = nodes[node];
+		for (uint32_t e = parent.firstEdge; e < parent.firstEdge + parent.edgeCount; e++)
+		{
+			const uint32_t child = edgeTargets[e];
+			const uint32_t failure = Next(parent.failure, edgeBytes[e]);
+			nodes[child].failure = failure;
+			nodes[child].outputLink = nodes[failure].hasOutputs ? failure : nodes[failure].outputLink;
+		}
+	}
+}
+
+uint32_t AdblockMatcher::Next(uint32_t state, unsigned char byte) const
+{
+	while (state != 0)
+	{
+		const Node &node = nodes[state];
+		const unsigned char *first = edgeBytes.data() + node.firstEdge;
+		const unsigned char *last = first + node.edgeCount;
+		const unsigned char *found = std::lower_bound(first, last, byte);
+		if (found != last && *found == byte)
+			return edgeTargets[found - edgeBytes.data()];
+
+		state = node.failure;
+	}
+
+	return rootNext[byte];
+}
+
+bool AdblockMatcher::FilterMatches(const Filter &filter, std::string_view uri, std::string_view lowered, size_t hostStart, size_t hostEnd,
+	FilterOption options, bool thirdParty, std::string_view contextDomain) const
+{
+	// Type restrictions only apply when the request has a type, as in AdBlockClient
+	const uint32_t requestType = options & requestTypes;
+	if (requestType != 0)
+	{
+		if (filter.types != 0 && (filter.types & requestType) == 0)
+			return false;
+		if ((filter.excludedTypes & requestType) != 0)
+			return false;
+	}
+	else if (filter.types != 0 && (filter.types & ~unclassifiedType) == 0)
+		return false;
+
+	if ((filter.thirdParty == tpOnly && !thirdParty) || (filter.thirdParty == tpNever && thirdParty))
+		return false;
+
+	// The most specific of the $domain= entries the referring host is in decides
+	if (!filter.domains.empty() || !filter.excludedDomains.empty())
+	{
+		size_t included = 0, excluded = 0;
+		for (const std::string &domain : filter.domains)
+		{
+			if (domain.size() > included && InDomain(contextDomain, domain))
+				included = domain.size();
+		}
+		for (const std::string &domain : filter.excludedDomains)
+		{
+			if (domain.size() > excluded && InDomain(contextDomain, domain))
+				excluded = domain.size();
+		}
+
+		if (excluded > included || (!filter.domains.empty() && included == 0))
+			return false;
+	}
+
+	if (filter.expression)
+		return std::regex_search(uri.begin(), uri.end(), *filter.expression);
+
+	const std::string_view subject = filter.matchCase ? uri : lowered;
+	switch (filter.anchor)
+	{
+		case anStart:
+			return Glob(filter.pattern, subject, filter.anchorEnd);
+		case anHost:
+			// At the start of the host or of any of its labels
+			for (size_t start = hostStart; start < hostEnd; start++)
+			{
+				if ((start == hostStart || subject[start - 1] == '.') && Glob(filter.pattern, subject.substr(start), filter.anchorEnd))
+					return true;
+			}
+			return false;
+		default:
+			return Glob(filter.pattern, subject, filter.anchorEnd);
+	}
+}
+
+bool AdblockMatcher::Matches(std::string_view uri, FilterOption options, std::string_view contextDomain, std::string *rule) const
+{
+	// Per thread buffers, they only allocate while they grow to the longest uri and the most candidates seen
+	thread_local std::string lowered, context;
+	thread_local std::vector<uint32_t> candidates;
+
+	lowered.resize(uri.size());
+	std::transform(uri.begin(), uri.end(), lowered.begin(), Lower);
+
+	candidates.clear();
+	uint32_t state = 0;
+	for (unsigned char byte : lowered)
+	{
+		state = Next(state, byte);
+		for (uint32_t output = nodes[state].hasOutputs ? state : nodes[state].outputLink; output != 0; output = nodes[output].outputLink)
+			candidates.insert(candidates.end(), outputs.begin() + outputStart[output], outputs.begin() + outputStart[output + 1]);
+	}
+	candidates.insert(candidates.end(), unkeyedFilters.begin(), unkeyedFilters.end());
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	size_t hostStart = lowered.find("://");
+	hostStart = (hostStart == std::string::npos) ? 0 : hostStart + 3;
+	size_t hostEnd = lowered.find_first_of("/?#", hostStart);
+	if (hostEnd == std::string::npos)
+		hostEnd = lowered.size();
+
+	// Third party unless the request goes to the referring host or one of its sub domains, the test of ad-block's
+	// isThirdPartyHost(). Without a Referer the adapter passes AdBlockClient an empty host, not none: every host ends
+	// in it without a dot in front, so the request is third party there and here alike.
+	context.assign(contextDomain.substr(0, contextDomain.find(':')));
+	std::transform(context.begin(), context.end(), context.begin(), Lower);
+	const std::string_view host = UriHost(lowered);
+	const bool thirdParty = !InDomain(host, context);
+
+	auto matches = [&](uint32_t index) {
+		return FilterMatches(filters[index], uri, lowered, hostStart, hostEnd, options, thirdParty, context);
+	};
+	auto findBlocking = [&](bool importantOnly) -> const Filter * {
+		for (uint32_t index : candidates)
+		{
+			const Filter &filter = filters[index];
+			if (!filter.exception && (!importantOnly || filter.important) && matches(index))
+				return &filter;
+		}
+		for (uint32_t index : regexFilters)
+		{
+			const Filter &filter = filters[index];
+			if (!filter.exception && (!importantOnly || filter.important) && matches(index))
+				return &filter;
+		}
+		return nullptr;
+	};
+	auto findException = [&]() {
+		return std::any_of(candidates.begin(), candidates.end(), [&](uint32_t index) { return filters[index].exception && matches(index); })
+			|| std::any_of(regexFilters.begin(), regexFilters.end(), [&](uint32_t index) { return filters[index].exception && matches(index); });
+	};
+
+	// Exception filters only matter for requests a filter blocks, unless that one is $important
+	const Filter *blocking = findBlocking(false);
+	if (blocking && !blocking->important && findException())
+		blocking = findBlocking(true);
+
+	if (!blocking)
+		return false;
+
+	if (rule)
+		rule->assign(text, blocking->textStart, blocking->textLength);
+	return true;
+}
+
+size_t AdblockMatcher::MemoryUsage() const
+{
+	size_t usage = sizeof(*this) + text.capacity() + filters.capacity() * sizeof(Filter) + nodes.capacity() * sizeof(Node) + edgeBytes.capacity()
+		+ (edgeTargets.capacity() + outputStart.capacity() + outputs.capacity() + unkeyedFilters.capacity() + regexFilters.capacity()) * sizeof(uint32_t);
+
+	for (const Filter &filter : filters)
+	{
+		usage += filter.pattern.capacity();
+		for (const std::string &domain : filter.domains)
+			usage += sizeof(domain) + domain.capacity();
+		for (const std::string &domain : filter.excludedDomains)
+			usage += sizeof(domain) + domain.capacity();
+	}
+
+	return usage;
+}
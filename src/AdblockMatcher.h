@@ -0,0 +1,119 @@
+#ifndef ECAP_NBLOCK_ADBLOCKMATCHER_H
+#define ECAP_NBLOCK_ADBLOCKMATCHER_H
+
+#include "filter.h"
+
+#include <stdint.h>
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// nBlock's own matcher for the Adblock network filters, selected with matcher=native in place of AdBlockClient::matches().
+//
+// Every filter is indexed by one literal fragment of its pattern (a run without * or ^), the one the fewest other
+// filters share. All fragments go into one Aho-Corasick automaton, so a single pass over the lowercased uri finds every
+// filter that can match at all, whatever the number of filters. Only those are checked against the whole pattern and
+// their options. Filters without any literal (only options) are checked for every request, regular expression filters
+// (/.../) only when the outcome still depends on them.
+//
+// Options are applied the way ad-block applies them: a request is third party unless its host is the referring host or
+// one of its sub domains, so $third-party filters apply to every request without a Referer (the adapter passes ad-block
+// an empty referring host then), and filters with options neither knows are never used. Patterns are matched case-insensitively unless the filter has $match-case.
+// Kept free of libecap so the offline tools can use it as well.
+class AdblockMatcher {
+public:
+	AdblockMatcher();
+	~AdblockMatcher();
+
+	// rules: one filter per line, as passed to AdBlockClient::parse()
+	void Build(const std::string &rules);
+
+	// Same arguments as AdBlockClient::matches(), contextDomain is the referring host. Thread safe. rule receives the
+	// filter that blocks the request when given.
+	bool Matches(std::string_view uri, FilterOption options, std::string_view contextDomain, std::string *rule = nullptr) const;
+
+	size_t Filters() const { return filters.size(); }
+	size_t ExceptionFilters() const { return exceptionFilters; }
+	size_t RegexFilters() const { return regexFilters.size(); }
+	size_t UnkeyedFilters() const { return unkeyedFilters.size(); }
+	size_t IgnoredFilters() const { return ignoredFilters; } // unsupported options, invalid expressions, $badfilter
+	size_t States() const { return nodes.size(); }
+	size_t MemoryUsage() const;
+
+	// Where the $options of a filter (without its @@) start, npos without any. regex tells whether the pattern is a
+	// /regular expression/, a $ inside of it belongs to the expression.
+	static size_t OptionsStart(std::string_view body, bool &regex);
+
+private:
+	enum Anchor {
+		anNone,
+		anStart, // |http://
+		anHost // ||example.com
+	};
+
+	enum ThirdParty {
+		tpAny,
+		tpOnly, // $third-party
+		tpNever // $~third-party
+	};
+
+	struct Filter {
+		uint32_t textStart; // in text, as listed
+		uint32_t textLength;
+		std::string pattern; // literals, * and ^, without the anchors. Lowercase unless matchCase, unanchored ones start with *.
+		uint32_t types; // FilterOption bits the filter is limited to, 0 for any request
+		uint32_t excludedTypes;
+		uint8_t anchor;
+		uint8_t thirdParty;
+		bool anchorEnd; // |
+		bool exception;
+		bool important;
+		bool matchCase;
+		std::vector<std::string> domains; // $domain=
+		std::vector<std::string> excludedDomains;
+		std::unique_ptr<std::regex> expression; // /.../ filters only
+	};
+
+	// Aho-Corasick automaton over the key fragments, numbered breadth first. The edges of a node are stored next to each
+	// other sorted by byte, the root has a full table instead.
+	struct Node {
+		uint32_t firstEdge; // in edgeBytes and edgeTargets
+		uint16_t edgeCount;
+		uint16_t hasOutputs; // some filter is keyed on the fragment ending here
+		uint32_t failure;
+		uint32_t outputLink; // nearest node on the failure chain with outputs, 0 if none
+	};
+
+	// Only while building
+	struct Edge {
+		unsigned char byte;
+		uint32_t target;
+	};
+
+	std::string text; // all filters, one per line
+	std::vector<Filter> filters;
+	std::vector<Node> nodes;
+	std::vector<unsigned char> edgeBytes;
+	std::vector<uint32_t> edgeTargets;
+	std::vector<uint32_t> outputStart; // filters keyed on node n are outputs[outputStart[n]] up to outputs[outputStart[n + 1]]
+	std::vector<uint32_t> outputs;
+	uint32_t rootNext[256];
+	std::vector<uint32_t> unkeyedFilters;
+	std::vector<uint32_t> regexFilters;
+	size_t exceptionFilters;
+	size_t ignoredFilters;
+
+	bool Parse(std::string_view rule, Filter &filter);
+	void BuildAutomaton(const std::vector<std::string> &keys);
+	uint32_t Next(uint32_t state, unsigned char byte) const;
+	bool FilterMatches(const Filter &filter, std::string_view uri, std::string_view lowered, size_t hostStart, size_t hostEnd,
+		FilterOption options, bool thirdParty, std::string_view contextDomain) const;
+
+	/* prohibited and not implemented */
+	AdblockMatcher(const AdblockMatcher&);
+	AdblockMatcher &operator=(const AdblockMatcher&);
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef ECAP_NBLOCK_AREAVIEW_H
+#define ECAP_NBLOCK_AREAVIEW_H
+
+#include <string_view>
+#include <libecap/common/area.h>
+
+// Views the bytes of a host provided Area without copying them, the Area has to outlive the view
+inline std::string_view AreaView(const libecap::Area &area)
+{
+	return area.size ? std::string_view(area.start, area.size) : std::string_view();
+}
+
+#endif
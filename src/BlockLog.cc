@@ -0,0 +1,347 @@
+#include "BlockLog.h"
+#include "Debugger.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const int flushMilliseconds = 200;
+static const size_t maxDatagram = 8192;
+
+static uint64_t NowMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+template <size_t size>
+static unsigned int CopyField(char (&field)[size], std::string_view value)
+{
+	const size_t length = std::min(value.size(), size);
+	memcpy(field, value.data(), length);
+	return length;
+}
+
+BlockLog::BlockLog():
+	enabled(false),
+	sampleEvery(1),
+	maxPerSecond(0),
+	sampleCounter(0),
+	rateSecond(0),
+	rateCount(0),
+	fd(-1),
+	datagram(false),
+	fileInode(0),
+	stopping(false),
+	flushRequested(false)
+{
+}
+
+bool BlockLog::Start(const std::string &aTarget, unsigned int aSampleEvery, unsigned int aMaxPerSecond, std::string &error)
+{
+	Stop();
+
+	if (aTarget.empty())
+		return true;
+
+	target = aTarget;
+	sampleEvery = aSampleEvery ? aSampleEvery : 1;
+	maxPerSecond = aMaxPerSecond;
+
+	if (!Open(error))
+		return false;
+
+	stopping = false;
+	enabled.store(true, std::memory_order_relaxed);
+	writerThread = std::thread(&BlockLog::Run, this);
+	return true;
+}
+
+void BlockLog::Stop()
+{
+	enabled.store(false, std::memory_order_relaxed);
+
+	if (writerThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutexStop);
+			stopping = true;
+		}
+		wakeWriter.notify_all();
+		writerThread.join();
+	}
+
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+}
+
+bool BlockLog::Open(std::string &error)
+{
+	if (fd >= 0)
+		close(fd);
+
+	datagram = target.compare(0, 4, "udp:") == 0;
+	if (datagram)
+	{
+		const size_t portPos = target.rfind(':');
+		const std::string host = target.substr(4, portPos - 4);
+		const std::string port = target.substr(portPos + 1);
+
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_DGRAM;
+
+		struct addrinfo *addresses = nullptr;
+		if (portPos <= 4 || getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+		{
+			error = "cannot resolve block_log target " + target;
+			return false;
+		}
+
+		fd = socket(addresses->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (fd < 0 || connect(fd, addresses->ai_addr, addresses->ai_addrlen) != 0)
+		{
+			error = "cannot connect block_log to " + target + ": " + strerror(errno);
+			freeaddrinfo(addresses);
+			return false;
+		}
+
+		freeaddrinfo(addresses);
+		return true;
+	}
+
+	fd = open(target.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+	if (fd < 0)
+	{
+		error = "cannot open block_log " + target + ": " + strerror(errno);
+		return false;
+	}
+
+	struct stat fileStat;
+	fileInode = (fstat(fd, &fileStat) == 0) ? fileStat.st_ino : 0;
+	return true;
+}
+
+bool BlockLog::Admit()
+{
+	if (!Enabled())
+		return false;
+
+	if (sampleEvery > 1 && sampleCounter.fetch_add(1, std::memory_order_relaxed) % sampleEvery != 0)
+	{
+		Stats::getInstance().Count(Stats::scLogSuppressed);
+		return false;
+	}
+
+	if (maxPerSecond)
+	{
+		// Approximate across threads, a new second may let a few extra events through
+		const uint64_t second = NowMicroseconds() / 1000000;
+		if (rateSecond.load(std::memory_order_relaxed) != second)
+		{
+			rateSecond.store(second, std::memory_order_relaxed);
+			rateCount.store(0, std::memory_order_relaxed);
+		}
+
+		if (rateCount.fetch_add(1, std::memory_order_relaxed) >= maxPerSecond)
+		{
+			Stats::getInstance().Count(Stats::scLogSuppressed);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void BlockLog::Log(Filter filter, std::string_view client, std::string_view host, std::string_view uri, std::string_view rule)
+{
+	Ring &ring = Local();
+	const uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+	const uint64_t queued = head - ring.tail.load(std::memory_order_acquire);
+	if (queued >= ringSize)
+	{
+		Stats::getInstance().Count(Stats::scLogDropped);
+		return;
+	}
+
+	// Half full, don't wait for the next flush. A missed wake up only means waiting for the interval.
+	if (queued == ringSize / 2 && !flushRequested.exchange(true, std::memory_order_relaxed))
+		wakeWriter.notify_one();
+
+	Event &event = ring.events[head & (ringSize - 1)];
+	event.timestamp = NowMicroseconds();
+	event.filter = filter;
+	event.clientLength = CopyField(event.client, client);
+	event.hostLength = CopyField(event.host, host);
+	event.uriLength = CopyField(event.uri, uri);
+	event.ruleLength = CopyField(event.rule, rule);
+
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+BlockLog::Ring &BlockLog::Local()
+{
+	struct ThreadSlot {
+		Ring *ring = nullptr;
+		~ThreadSlot() { if (ring) BlockLog::getInstance().Release(ring); }
+	};
+	thread_local ThreadSlot slot;
+
+	if (!slot.ring)
+		slot.ring = Acquire();
+	return *slot.ring;
+}
+
+BlockLog::Ring *BlockLog::Acquire()
+{
+	std::lock_guard<std::mutex> lock(mutexRings);
+
+	for (Ring *ring : Rings)
+	{
+		if (!ring->inUse)
+		{
+			ring->inUse = true;
+			return ring;
+		}
+	}
+
+	Ring *ring = new Ring();
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->tail.store(0, std::memory_order_relaxed);
+	ring->inUse = true;
+
+	Rings.push_back(ring);
+	return ring;
+}
+
+void BlockLog::Release(Ring *ring)
+{
+	// Whatever is still queued in the ring is written by the writer thread as usual
+	std::lock_guard<std::mutex> lock(mutexRings);
+	ring->inUse = false;
+}
+
+void BlockLog::Run()
+{
+	std::string batch;
+	std::unique_lock<std::mutex> lock(mutexStop);
+
+	while (!stopping)
+	{
+		wakeWriter.wait_for(lock, std::chrono::milliseconds(flushMilliseconds), [this] { return stopping || flushRequested.load(std::memory_order_relaxed); });
+		flushRequested.store(false, std::memory_order_relaxed);
+
+		lock.unlock();
+		Flush(batch);
+		lock.lock();
+	}
+}
+
+void BlockLog::Flush(std::string &batch)
+{
+	size_t events = 0;
+	batch.clear();
+
+	{
+		std::lock_guard<std::mutex> lock(mutexRings);
+		for (Ring *ring : Rings)
+		{
+			const uint64_t head = ring->head.load(std::memory_order_acquire);
+			uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+			for (; tail != head; tail++)
+			{
+				const size_t batchSize = batch.size();
+				AppendEvent(batch, ring->events[tail & (ringSize - 1)]);
+				events++;
+
+				// Datagrams have to stay small, send the events before this one when it does not fit anymore
+				if (datagram && batch.size() > maxDatagram && batchSize > 0)
+				{
+					Send(batch.data(), batchSize);
+					batch.erase(0, batchSize);
+				}
+			}
+
+			ring->tail.store(tail, std::memory_order_release);
+		}
+	}
+
+	if (!batch.empty())
+		Send(batch.data(), batch.size());
+
+	if (events)
+		Stats::getInstance().Count(Stats::scLogWritten, events);
+}
+
+void BlockLog::Send(const char *data, size_t size)
+{
+	if (!datagram)
+	{
+		// Follow log rotation: once the file was moved away, continue in a new one
+		struct stat fileStat;
+		std::string error;
+		if ((stat(target.c_str(), &fileStat) != 0 || fileStat.st_ino != fileInode) && !Open(error))
+		{
+			Debugger(ilCritical | flApplication) << "[nBlock] " << error;
+			return;
+		}
+	}
+
+	if (fd < 0 || write(fd, data, size) < 0)
+		Debugger(ilCritical | flApplication) << "[nBlock] Unable to write the block log to " << target << ": " << strerror(errno);
+}
+
+static void AppendJsonString(std::string &batch, const char *value, size_t length)
+{
+	batch += '"';
+	for (size_t i = 0; i < length; i++)
+	{
+		const unsigned char c = value[i];
+		if (c == '"' || c == '\\')
+		{
+			batch += '\\';
+			batch += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			batch += escaped;
+		}
+		else batch += c;
+	}
+	batch += '"';
+}
+
+void BlockLog::AppendEvent(std::string &batch, const Event &event)
+{
+	char timestamp[32];
+	snprintf(timestamp, sizeof(timestamp), "%llu.%06llu", (unsigned long long)(event.timestamp / 1000000), (unsigned long long)(event.timestamp % 1000000));
+
+	batch += "{\"time\":";
+	batch += timestamp;
+	batch += ",\"filter\":";
+	batch += (event.filter == bfDns) ? "\"dns\"" : "\"adblock\"";
+	batch += ",\"client\":";
+	AppendJsonString(batch, event.client, event.clientLength);
+	batch += ",\"host\":";
+	AppendJsonString(batch, event.host, event.hostLength);
+	batch += ",\"uri\":";
+	AppendJsonString(batch, event.uri, event.uriLength);
+	batch += ",\"rule\":";
+	AppendJsonString(batch, event.rule, event.ruleLength);
+	batch += "}\n";
+}
@@ -0,0 +1,99 @@
+#ifndef ECAP_NBLOCK_BLOCKLOG_H
+#define ECAP_NBLOCK_BLOCKLOG_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Structured log of blocked requests (block_log=), written as one JSON object per line.
+// Request threads copy their events into a ring of fixed size slots they own (single producer, single consumer, no
+// locks), a background thread drains all rings in batches and writes them with one write() per batch. A full ring
+// drops the event instead of waiting. block_log_sample and block_log_rate thin out the events before they are built.
+class BlockLog {
+public:
+	enum Filter {
+		bfDns,
+		bfAdblock
+	};
+
+	struct Event {
+		uint64_t timestamp; // microseconds since the epoch
+		uint8_t filter;
+		uint8_t clientLength;
+		uint16_t hostLength;
+		uint16_t uriLength;
+		uint16_t ruleLength;
+		char client[46];
+		char host[256];
+		char uri[1024];
+		char rule[256];
+	};
+
+	static BlockLog& getInstance()
+	{
+		static BlockLog instance;
+		return instance;
+	}
+
+	// target is a file name, or udp:<host>:<port>. Restarts the writer thread, an empty target stops it.
+	bool Start(const std::string &target, unsigned int sampleEvery, unsigned int maxPerSecond, std::string &error);
+	void Stop(); // flushes what is queued
+	bool Enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+	// Sampling and rate limit, call before collecting the details of an event
+	bool Admit();
+	void Log(Filter filter, std::string_view client, std::string_view host, std::string_view uri, std::string_view rule);
+
+private:
+	static const unsigned int ringSize = 512; // events per thread, power of two
+
+	struct alignas(64) Ring {
+		std::atomic<uint64_t> head; // written by the producer
+		alignas(64) std::atomic<uint64_t> tail; // written by the writer thread
+		bool inUse;
+		Event events[ringSize];
+	};
+
+	BlockLog();
+
+	std::atomic<bool> enabled;
+	unsigned int sampleEvery;
+	unsigned int maxPerSecond;
+	std::atomic<uint64_t> sampleCounter;
+	std::atomic<uint64_t> rateSecond;
+	std::atomic<uint64_t> rateCount;
+
+	std::mutex mutexRings; // guards Rings, taken when a thread logs for the first time and by the writer
+	std::vector<Ring *> Rings; // never freed, rings of exited threads are reused
+
+	std::string target;
+	int fd;
+	bool datagram; // udp: target, one batch per datagram
+	uint64_t fileInode; // to notice log rotation
+	std::thread writerThread;
+	std::mutex mutexStop;
+	std::condition_variable wakeWriter;
+	bool stopping;
+	std::atomic<bool> flushRequested; // a ring is filling up, flush before the interval is over
+
+	Ring &Local();
+	Ring *Acquire();
+	void Release(Ring *ring);
+
+	bool Open(std::string &error);
+	void Run();
+	void Flush(std::string &batch);
+	void Send(const char *data, size_t size);
+	static void AppendEvent(std::string &batch, const Event &event);
+
+	/* prohibited and not implemented */
+	BlockLog(const BlockLog&);
+	BlockLog &operator=(const BlockLog&);
+};
+
+#endif
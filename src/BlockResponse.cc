@@ -0,0 +1,97 @@
+#include "BlockResponse.h"
+
+#include <string>
+#include <libecap/common/area.h>
+#include <libecap/common/header.h>
+#include <libecap/common/name.h>
+#include <libecap/common/names.h>
+#include <libecap/common/registry.h>
+#include <libecap/host/host.h>
+
+namespace {
+
+// GIF89a, 1x1, one transparent pixel
+const char transparentGif[] = {
+	'G', 'I', 'F', '8', '9', 'a', 0x01, 0x00, 0x01, 0x00, (char)0x80, 0x00, 0x00, 0x00, 0x00, 0x00,
+	(char)0xff, (char)0xff, (char)0xff, 0x21, (char)0xf9, 0x04, 0x01, 0x00, 0x00, 0x00, 0x00, 0x2c, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0x00, 0x01, 0x00, 0x00, 0x02, 0x02, 0x44, 0x01, 0x00, 0x3b
+};
+
+struct Prototype {
+	int statusCode;
+	const char *reasonPhrase;
+	const char *contentType; // nullptr for none
+	std::string_view body;
+};
+
+const Prototype prototypeSpecs[BlockResponse::kindCount] = {
+	{0, nullptr, nullptr, std::string_view()}, // brErrorPage, never built
+	{200, "OK", "image/gif", std::string_view(transparentGif, sizeof(transparentGif))},
+	{200, "OK", "application/javascript", std::string_view()},
+	{200, "OK", "text/css", std::string_view()},
+	{204, "No Content", nullptr, std::string_view()},
+};
+
+} // namespace
+
+void BlockResponse::SetEnabled(bool enable)
+{
+	if (enable && !prototypes[brImage])
+		BuildPrototypes();
+	enabled = enable;
+}
+
+void BlockResponse::BuildPrototypes()
+{
+	static const libecap::Name headerCacheControl("Cache-Control");
+
+	for (int kind = brImage; kind < kindCount; kind++)
+	{
+		const Prototype &spec = prototypeSpecs[kind];
+		libecap::shared_ptr<libecap::Message> message = libecap::MyHost().newResponse();
+
+		libecap::StatusLine &statusLine = dynamic_cast<libecap::StatusLine&>(message->firstLine());
+		statusLine.version(libecap::Version(1, 1));
+		statusLine.protocol(libecap::protocolHttp);
+		statusLine.statusCode(spec.statusCode);
+		statusLine.reasonPhrase(libecap::Area::FromTempString(spec.reasonPhrase));
+
+		libecap::Header &header = message->header();
+		if (spec.contentType)
+			header.add(libecap::headerContentType, libecap::Area::FromTempString(spec.contentType));
+		if (spec.statusCode != 204)
+			header.add(libecap::headerContentLength, libecap::Area::FromTempString(std::to_string(spec.body.size())));
+
+		// The request may no longer be blocked after the next list update
+		header.add(headerCacheControl, libecap::Area::FromTempString("no-store"));
+
+		if (!spec.body.empty())
+			message->addBody();
+
+		prototypes[kind] = message;
+	}
+}
+
+BlockResponse::Kind BlockResponse::Choose(FilterOption options) const
+{
+	if (!enabled)
+		return brErrorPage;
+
+	// A script fetching JSON is classified as both, it wants no body rather than an empty script
+	if (options & FOXmlHttpRequest)
+		return brNoContent;
+	if (options & FOImage)
+		return brImage;
+	if (options & FOScript)
+		return brScript;
+	if (options & FOStylesheet)
+		return brStylesheet;
+
+	return brErrorPage;
+}
+
+libecap::shared_ptr<libecap::Message> BlockResponse::Create(Kind kind, std::string_view &body) const
+{
+	body = prototypeSpecs[kind].body;
+	return prototypes[kind]->clone();
+}
@@ -0,0 +1,57 @@
+#ifndef ECAP_NBLOCK_BLOCKRESPONSE_H
+#define ECAP_NBLOCK_BLOCKRESPONSE_H
+
+#include "filter.h"
+
+#include <string_view>
+#include <libecap/common/memory.h>
+#include <libecap/common/message.h>
+
+// Minimal responses the request service answers blocked requests with itself (block_response=on), instead of letting
+// Squid render its error page into a spot of the page that expected an image or a script: a transparent 1x1 GIF for
+// images, an empty 200 for scripts and stylesheets, and a 204 for XMLHttpRequests. Documents, frames and requests of an
+// unknown type still get the error page, a person may be looking at those.
+//
+// The header of every response is built once when the option is enabled and cloned per blocked request. The only body
+// (the GIF) is a static buffer, the transaction hands out Areas pointing into it without copying or allocating.
+class BlockResponse {
+public:
+	enum Kind {
+		brErrorPage, // blockVirgin()
+		brImage,
+		brScript,
+		brStylesheet,
+		brNoContent,
+		kindCount
+	};
+
+	static BlockResponse& getInstance()
+	{
+		static BlockResponse instance;
+		return instance;
+	}
+
+	// Main thread only, like every other use of the host's messages
+	void SetEnabled(bool enabled);
+	bool Enabled() const { return enabled; }
+
+	// What a blocked request of the given type is answered with
+	Kind Choose(FilterOption options) const;
+
+	// A new response of kind (anything but brErrorPage), body receives the static body it is to be sent with
+	libecap::shared_ptr<libecap::Message> Create(Kind kind, std::string_view &body) const;
+
+private:
+	bool enabled;
+	libecap::shared_ptr<libecap::Message> prototypes[kindCount]; // built by the first SetEnabled(true)
+
+	BlockResponse(): enabled(false) {}
+
+	void BuildPrototypes();
+
+	/* prohibited and not implemented */
+	BlockResponse(const BlockResponse&);
+	BlockResponse &operator=(const BlockResponse&);
+};
+
+#endif
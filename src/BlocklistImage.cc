@@ -0,0 +1,177 @@
+#include "BlocklistImage.h"
+#include "Hash.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char BlocklistImage::imageMagic[8] = {'N', 'B', 'L', 'K', 'I', 'M', 'G', 0};
+
+static const uint64_t sectionAlignment = 64;
+
+static uint64_t AlignSection(uint64_t offset)
+{
+	return (offset + sectionAlignment - 1) & ~(sectionAlignment - 1);
+}
+
+BlocklistImage::BlocklistImage():
+	mapped(nullptr),
+	mappedSize(0)
+{
+}
+
+BlocklistImage::~BlocklistImage()
+{
+	if (mapped)
+		munmap(mapped, mappedSize);
+}
+
+bool BlocklistImage::Open(const std::string &aFileName, std::string &error)
+{
+	fileName = aFileName;
+
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		error = "cannot open " + fileName + ": " + strerror(errno);
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(ImageHeader))
+	{
+		close(fd);
+		error = fileName + " is not a blocklist image";
+		return false;
+	}
+
+	// MAP_PRIVATE with write access: the adblock deserializer wants a mutable buffer, pages are only copied if it writes
+	mappedSize = fileStat.st_size;
+	void *memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (memory == MAP_FAILED)
+	{
+		mappedSize = 0;
+		error = "cannot map " + fileName + ": " + strerror(errno);
+		return false;
+	}
+	mapped = (char *)memory;
+
+	const ImageHeader *header = (const ImageHeader *)mapped;
+	if (memcmp(header->magic, imageMagic, sizeof(imageMagic)) != 0)
+	{
+		error = fileName + " is not a blocklist image";
+		return false;
+	}
+
+	if (header->version != formatVersion)
+	{
+		error = fileName + " has image version " + std::to_string(header->version) + ", expected " + std::to_string(formatVersion) + " (recompile the lists)";
+		return false;
+	}
+
+	if (header->fileSize != mappedSize || header->sectionCount > (mappedSize - sizeof(ImageHeader)) / sizeof(Section))
+	{
+		error = fileName + " is truncated";
+		return false;
+	}
+
+	if (HashFnv1a(mapped + sizeof(ImageHeader), mappedSize - sizeof(ImageHeader)) != header->checksum)
+	{
+		error = fileName + " has an invalid checksum";
+		return false;
+	}
+
+	const Section *sections = (const Section *)(mapped + sizeof(ImageHeader));
+	for (uint32_t i = 0; i < header->sectionCount; i++)
+	{
+		if (sections[i].offset > mappedSize || sections[i].size > mappedSize - sections[i].offset)
+		{
+			error = fileName + " has a corrupt section table";
+			return false;
+		}
+	}
+
+	// Hint the kernel to read ahead, all of the image will be touched while attaching
+	madvise(mapped, mappedSize, MADV_WILLNEED);
+
+	return true;
+}
+
+char *BlocklistImage::Find(SectionType type, size_t &size, uint64_t &entries) const
+{
+	if (!mapped)
+		return nullptr;
+
+	const ImageHeader *header = (const ImageHeader *)mapped;
+	const Section *sections = (const Section *)(mapped + sizeof(ImageHeader));
+
+	for (uint32_t i = 0; i < header->sectionCount; i++)
+	{
+		if (sections[i].type == (uint32_t)type)
+		{
+			size = sections[i].size;
+			entries = sections[i].entries;
+			return mapped + sections[i].offset;
+		}
+	}
+
+	return nullptr;
+}
+
+void BlocklistImage::Writer::Add(SectionType type, const void *data, size_t size, uint64_t entries)
+{
+	Section section = {(uint32_t)type, 0, entries, 0, size};
+	sections.push_back(std::make_pair(section, std::string((const char *)data, size)));
+}
+
+bool BlocklistImage::Writer::Write(const std::string &fileName, std::string &error) const
+{
+	std::string image(sizeof(ImageHeader) + sections.size() * sizeof(Section), '\0');
+
+	ImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, imageMagic, sizeof(imageMagic));
+	header.version = formatVersion;
+	header.sectionCount = sections.size();
+
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		Section section = sections[i].first;
+		image.resize(AlignSection(image.size()), '\0');
+		section.offset = image.size();
+		image += sections[i].second;
+
+		memcpy(&image[sizeof(ImageHeader) + i * sizeof(Section)], &section, sizeof(section));
+	}
+
+	header.fileSize = image.size();
+	header.checksum = HashFnv1a(image.data() + sizeof(ImageHeader), image.size() - sizeof(ImageHeader));
+	memcpy(&image[0], &header, sizeof(header));
+
+	// Write next to the target and rename over it, so a running adapter never maps a half written image
+	const std::string tempName = fileName + ".tmp";
+	FILE *file = fopen(tempName.c_str(), "wb");
+	if (!file)
+	{
+		error = "cannot create " + tempName + ": " + strerror(errno);
+		return false;
+	}
+
+	bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+	written = (fclose(file) == 0) && written;
+
+	if (!written || rename(tempName.c_str(), fileName.c_str()) != 0)
+	{
+		error = "cannot write " + fileName + ": " + strerror(errno);
+		unlink(tempName.c_str());
+		return false;
+	}
+
+	return true;
+}
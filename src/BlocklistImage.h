@@ -0,0 +1,85 @@
+#ifndef ECAP_NBLOCK_BLOCKLISTIMAGE_H
+#define ECAP_NBLOCK_BLOCKLISTIMAGE_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Versioned, checksummed binary image of the compiled blocklists, written offline by nblock_compile. The CDN store
+// (CdnStore, written by nblock_cdn_compile) uses the same format with sections of its own.
+// The adapter maps the image read-only (copy on write), so all Squid workers share one copy through the page cache.
+//
+// Layout: ImageHeader, followed by ImageSection entries, followed by the 64 byte aligned section payloads.
+// The checksum is a FNV-1a hash over everything following the header.
+class BlocklistImage {
+public:
+	enum SectionType {
+		stTrieNodes = 1, // DomainTrie node array (hostnames and domains)
+		stTrieLabels = 2, // DomainTrie label pool
+		stAdblock = 3, // AdBlockClient::serialize() output
+		stTrieFilter = 4, // DomainTrie prefilter (XorFilter), optional
+		stUriTokens = 5, // UriCanonicalizer of the Adblock filters, optional
+		stAdblockHosts = 6, // AdblockHostIndex::Rules(), text, optional
+		stElementHiding = 7, // element hiding filters for ElementHiding::Load(), text, optional
+		stAdblockRules = 8, // the filters of stAdblock for AdblockMatcher::Build(), text, optional
+		stCdnIndex = 9, // CdnStore images only: URL index
+		stCdnResources = 10, // CdnStore images only: one entry per distinct body
+		stCdnStrings = 11, // CdnStore images only: URLs and content types
+		stCdnBodies = 12 // CdnStore images only: the bodies
+	};
+
+	// Raised whenever what a section holds changes, older images are refused. 2: trie entries are stored lowercase.
+	static const uint32_t formatVersion = 2;
+
+	struct Section {
+		uint32_t type;
+		uint32_t reserved;
+		uint64_t entries; // number of list entries stored in the section, informational
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	BlocklistImage();
+	~BlocklistImage();
+
+	// Maps fileName and validates its header and checksum
+	bool Open(const std::string &fileName, std::string &error);
+
+	// Returns the section payload of the given type, or nullptr if the image has no such section
+	char *Find(SectionType type, size_t &size, uint64_t &entries) const;
+
+	const std::string &FileName() const { return fileName; }
+	size_t Size() const { return mappedSize; }
+
+	// Collects sections in memory and writes them out as one image. The file is replaced atomically.
+	class Writer {
+	public:
+		void Add(SectionType type, const void *data, size_t size, uint64_t entries);
+		bool Write(const std::string &fileName, std::string &error) const;
+
+	private:
+		std::vector<std::pair<Section, std::string>> sections;
+	};
+
+private:
+	struct ImageHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t sectionCount;
+		uint64_t fileSize;
+		uint64_t checksum;
+	};
+
+	static const char imageMagic[8];
+
+	std::string fileName;
+	char *mapped;
+	size_t mappedSize;
+
+	/* prohibited and not implemented */
+	BlocklistImage(const BlocklistImage&);
+	BlocklistImage &operator=(const BlocklistImage&);
+};
+
+#endif
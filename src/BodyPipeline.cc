@@ -0,0 +1,407 @@
+#include "BodyPipeline.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+const size_t BodyPipeline::windowSize; // std::min() takes it by reference
+
+// Every allocation carries its size in front, so Release() can count it back
+static const size_t allocationHeader = 16;
+
+void *BodyPipeline::Allocate(void *opaque, size_t size)
+{
+	char *block = (char *)malloc(size + allocationHeader);
+	if (!block)
+		return nullptr;
+
+	memcpy(block, &size, sizeof(size));
+	((BodyPipeline *)opaque)->codecMemory += size;
+	return block + allocationHeader;
+}
+
+void BodyPipeline::Release(void *opaque, void *address)
+{
+	if (!address)
+		return;
+
+	char *block = (char *)address - allocationHeader;
+	size_t size;
+	memcpy(&size, block, sizeof(size));
+	((BodyPipeline *)opaque)->codecMemory -= size;
+	free(block);
+}
+
+BodyPipeline::Encoding BodyPipeline::ParseEncoding(std::string_view contentEncoding)
+{
+	while (!contentEncoding.empty() && (contentEncoding.back() == ' ' || contentEncoding.back() == '\t'))
+		contentEncoding.remove_suffix(1);
+	while (!contentEncoding.empty() && (contentEncoding.front() == ' ' || contentEncoding.front() == '\t'))
+		contentEncoding.remove_prefix(1);
+
+	struct { const char *name; Encoding encoding; } static const encodings[] = {
+		{"identity", enIdentity},
+		{"gzip", enGzip},
+		{"x-gzip", enGzip},
+		{"deflate", enDeflate},
+#ifdef HAVE_BROTLI
+		{"br", enBrotli},
+#endif
+	};
+
+	if (contentEncoding.empty())
+		return enIdentity;
+
+	for (const auto &known : encodings)
+	{
+		if (strlen(known.name) == contentEncoding.size() && strncasecmp(known.name, contentEncoding.data(), contentEncoding.size()) == 0)
+			return known.encoding;
+	}
+
+	return enUnsupported;
+}
+
+BodyPipeline::BodyPipeline(Encoding aEncoding, std::vector<std::unique_ptr<ContentScanner>> aScanners):
+	encoding(aEncoding),
+	scanners(std::move(aScanners)),
+	zlibStarted(false),
+	rawDeflate(false),
+	deflateHeaderSize(0),
+	decoderDone(false),
+#ifdef HAVE_BROTLI
+	brotliDecoder(nullptr),
+	brotliEncoder(nullptr),
+#endif
+	window(new char[windowSize]),
+	codecMemory(0),
+	decodedBytes(0),
+	failed(false)
+{
+	switch (encoding)
+	{
+		case enGzip:
+		case enDeflate:
+			failed = !StartZlib();
+			break;
+#ifdef HAVE_BROTLI
+		case enBrotli:
+			brotliDecoder = BrotliDecoderCreateInstance(Allocate, Release, this);
+			brotliEncoder = BrotliEncoderCreateInstance(Allocate, Release, this);
+			failed = !brotliDecoder || !brotliEncoder ||
+				!BrotliEncoderSetParameter(brotliEncoder, BROTLI_PARAM_QUALITY, brotliQuality) ||
+				!BrotliEncoderSetParameter(brotliEncoder, BROTLI_PARAM_LGWIN, brotliWindow) ||
+				!BrotliEncoderSetParameter(brotliEncoder, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+			break;
+#endif
+		case enIdentity:
+			break;
+		default:
+			failed = true;
+			break;
+	}
+}
+
+BodyPipeline::~BodyPipeline()
+{
+	StopZlib();
+#ifdef HAVE_BROTLI
+	if (brotliDecoder)
+		BrotliDecoderDestroyInstance(brotliDecoder);
+	if (brotliEncoder)
+		BrotliEncoderDestroyInstance(brotliEncoder);
+#endif
+}
+
+bool BodyPipeline::StartZlib()
+{
+	memset(&inflater, 0, sizeof(inflater));
+	memset(&deflater, 0, sizeof(deflater));
+	inflater.zalloc = deflater.zalloc = ZlibAllocate;
+	inflater.zfree = deflater.zfree = Release;
+	inflater.opaque = deflater.opaque = this;
+
+	// gzip wraps the deflate stream in a 16 + windowBits header, zlib format has a short one, raw deflate none at all
+	const int windowBits = (encoding == enGzip) ? 16 + MAX_WBITS : (rawDeflate ? -MAX_WBITS : MAX_WBITS);
+	if (inflateInit2(&inflater, windowBits) != Z_OK)
+		return false;
+
+	if (deflateInit2(&deflater, zlibLevel, Z_DEFLATED, windowBits, zlibMemLevel, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		inflateEnd(&inflater);
+		return false;
+	}
+
+	zlibStarted = true;
+	return true;
+}
+
+void BodyPipeline::StopZlib()
+{
+	if (!zlibStarted)
+		return;
+
+	inflateEnd(&inflater);
+	deflateEnd(&deflater);
+	zlibStarted = false;
+}
+
+bool BodyPipeline::Write(const char *data, size_t size, std::string &out)
+{
+	if (failed)
+		return false;
+
+	if (!Decode(data, size, out))
+	{
+		failed = true;
+		return false;
+	}
+
+	// Nothing to flush while the start of a deflate body is held back, the encoder may still be restarted for raw deflate
+	if (encoding != enDeflate || deflateHeaderSize == sizeof(deflateHeader))
+		Encode(nullptr, 0, emFlush, out);
+	return true;
+}
+
+bool BodyPipeline::Finish(std::string &out)
+{
+	if (failed)
+		return false;
+
+	// Whatever a scanner still held back passes through the scanners after it
+	for (size_t i = 0; i < scanners.size(); i++)
+	{
+		std::string *input = &scanned[0];
+		input->clear();
+		scanners[i]->Finish(*input);
+
+		for (size_t next = i + 1; next < scanners.size() && !input->empty(); next++)
+		{
+			std::string *output = (input == &scanned[0]) ? &scanned[1] : &scanned[0];
+			output->clear();
+			scanners[next]->Scan(input->data(), input->size(), *output);
+			input = output;
+		}
+
+		if (!input->empty())
+			Encode(input->data(), input->size(), emData, out);
+	}
+
+	// A body cut off inside its compressed stream is not made to look complete, the encoder is only flushed
+	if (encoding != enIdentity && !decoderDone)
+	{
+		Encode(nullptr, 0, emFlush, out);
+		return false;
+	}
+
+	Encode(nullptr, 0, emFinish, out);
+	return true;
+}
+
+bool BodyPipeline::Decode(const char *data, size_t size, std::string &out)
+{
+	// Bytes after the end of the compressed stream are dropped, like browsers do
+	if (decoderDone)
+		return true;
+
+	switch (encoding)
+	{
+		case enIdentity:
+		{
+			for (size_t offset = 0; offset < size; offset += windowSize)
+				Scan(data + offset, std::min(windowSize, size - offset), out);
+			return true;
+		}
+
+		case enGzip:
+			return Inflate(data, size, out);
+
+		case enDeflate:
+		{
+			if (deflateHeaderSize == sizeof(deflateHeader))
+				return Inflate(data, size, out);
+
+			// "deflate" is meant to be the zlib format, but some servers send raw deflate. The first two bytes tell, they
+			// are held back until both are there, however the body is split.
+			const size_t taken = std::min(size, sizeof(deflateHeader) - deflateHeaderSize);
+			memcpy(deflateHeader + deflateHeaderSize, data, taken);
+			deflateHeaderSize += taken;
+			if (deflateHeaderSize < sizeof(deflateHeader))
+				return true;
+
+			// The checks of inflate(): method 8, a window of at most 32 KiB, and a header that is a multiple of 31
+			const unsigned int method = (unsigned char)deflateHeader[0], flags = (unsigned char)deflateHeader[1];
+			if ((method & 0x0f) != Z_DEFLATED || (method >> 4) + 8 > MAX_WBITS || ((method << 8) | flags) % 31 != 0)
+			{
+				StopZlib();
+				rawDeflate = true;
+				if (!StartZlib())
+					return false;
+			}
+
+			return Inflate(deflateHeader, sizeof(deflateHeader), out) && Inflate(data + taken, size - taken, out);
+		}
+
+#ifdef HAVE_BROTLI
+		case enBrotli:
+		{
+			const uint8_t *nextIn = (const uint8_t *)data;
+			size_t availIn = size;
+
+			for (;;)
+			{
+				uint8_t *nextOut = (uint8_t *)window.get();
+				size_t availOut = windowSize;
+
+				const BrotliDecoderResult result = BrotliDecoderDecompressStream(brotliDecoder, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+				const size_t produced = windowSize - availOut;
+
+				if (produced > 0)
+					Scan(window.get(), produced, out);
+
+				if (result == BROTLI_DECODER_RESULT_SUCCESS)
+				{
+					decoderDone = true;
+					return true;
+				}
+
+				// The decoder asks for input before it has written out all it could decode from the input so far
+				if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT && !BrotliDecoderHasMoreOutput(brotliDecoder))
+					return true;
+
+				if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT)
+					continue;
+
+				if (result != BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)
+					return false;
+			}
+		}
+#endif
+
+		default:
+			return false;
+	}
+}
+
+bool BodyPipeline::Inflate(const char *data, size_t size, std::string &out)
+{
+	if (decoderDone)
+		return true;
+
+	inflater.next_in = (Bytef *)data;
+	inflater.avail_in = size;
+
+	// Keep going while there is input left, or while a full window suggests there is more output pending
+	do
+	{
+		inflater.next_out = (Bytef *)window.get();
+		inflater.avail_out = windowSize;
+
+		const int result = inflate(&inflater, Z_NO_FLUSH);
+		const size_t produced = windowSize - inflater.avail_out;
+
+		if (produced > 0)
+			Scan(window.get(), produced, out);
+
+		if (result == Z_STREAM_END)
+		{
+			// gzip bodies may consist of several members
+			if (encoding == enGzip && inflater.avail_in > 0 && inflateReset(&inflater) == Z_OK)
+				continue;
+
+			decoderDone = true;
+			return true;
+		}
+
+		if (result == Z_BUF_ERROR)
+			return true; // needs more input
+
+		if (result != Z_OK)
+			return false;
+	}
+	while (inflater.avail_in > 0 || inflater.avail_out == 0);
+
+	return true;
+}
+
+void BodyPipeline::Scan(const char *data, size_t size, std::string &out)
+{
+	decodedBytes += size;
+
+	// Each scanner reads what the one before it wrote
+	const char *input = data;
+	size_t inputSize = size;
+
+	for (size_t i = 0; i < scanners.size(); i++)
+	{
+		std::string &output = scanned[i % 2];
+		output.clear();
+		scanners[i]->Scan(input, inputSize, output);
+
+		input = output.data();
+		inputSize = output.size();
+	}
+
+	if (inputSize > 0)
+		Encode(input, inputSize, emData, out);
+}
+
+void BodyPipeline::Encode(const char *data, size_t size, EncodeMode mode, std::string &out)
+{
+	switch (encoding)
+	{
+		case enIdentity:
+			out.append(data, size);
+			break;
+
+		case enGzip:
+		case enDeflate:
+		{
+			static const int flushModes[] = {Z_NO_FLUSH, Z_SYNC_FLUSH, Z_FINISH};
+
+			deflater.next_in = (Bytef *)data;
+			deflater.avail_in = size;
+
+			// Deflate straight into out, in steps of one window
+			do
+			{
+				const size_t used = out.size();
+				out.resize(used + windowSize);
+
+				deflater.next_out = (Bytef *)&out[used];
+				deflater.avail_out = windowSize;
+				deflate(&deflater, flushModes[mode]);
+
+				out.resize(used + windowSize - deflater.avail_out);
+			}
+			while (deflater.avail_out == 0);
+			break;
+		}
+
+#ifdef HAVE_BROTLI
+		case enBrotli:
+		{
+			static const BrotliEncoderOperation operations[] = {BROTLI_OPERATION_PROCESS, BROTLI_OPERATION_FLUSH, BROTLI_OPERATION_FINISH};
+
+			const uint8_t *nextIn = (const uint8_t *)data;
+			size_t availIn = size;
+
+			do
+			{
+				const size_t used = out.size();
+				out.resize(used + windowSize);
+
+				uint8_t *nextOut = (uint8_t *)&out[used];
+				size_t availOut = windowSize;
+				BrotliEncoderCompressStream(brotliEncoder, operations[mode], &availIn, &nextIn, &availOut, &nextOut, nullptr);
+
+				out.resize(used + windowSize - availOut);
+			}
+			while (availIn > 0 || BrotliEncoderHasMoreOutput(brotliEncoder));
+			break;
+		}
+#endif
+
+		default:
+			break;
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef ECAP_NBLOCK_BODYPIPELINE_H
+#define ECAP_NBLOCK_BODYPIPELINE_H
+
+#include "ContentScanner.h"
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#endif
+
+// Streams one response body through the ContentScanners: the body is decoded (Content-Encoding gzip, deflate and, when
+// built with brotli, br) piece by piece as it arrives, the scanners see the decoded bytes, and their output is encoded
+// the same way again.
+// Nothing is buffered beyond one window of decoded bytes and what the scanners hold back. The encoder is flushed at the
+// end of every Write(), so the client receives the page as the server sends it.
+class BodyPipeline {
+public:
+	enum Encoding {
+		enIdentity,
+		enGzip,
+		enDeflate,
+		enBrotli,
+		enUnsupported // another or more than one encoding, the body is not touched
+	};
+
+	// Value of the Content-Encoding header, empty if there is none
+	static Encoding ParseEncoding(std::string_view contentEncoding);
+
+	BodyPipeline(Encoding aEncoding, std::vector<std::unique_ptr<ContentScanner>> aScanners);
+	~BodyPipeline();
+
+	// Appends the adapted body for the next size bytes of the virgin body to out. False once the body can not be decoded.
+	bool Write(const char *data, size_t size, std::string &out);
+
+	// End of the virgin body, appends the rest of the adapted body to out. False when the body ended before its encoding
+	// did, the adapted body then ends early as well.
+	bool Finish(std::string &out);
+
+	uint64_t DecodedBytes() const { return decodedBytes; }
+	size_t MemoryUsage() const { return codecMemory + windowSize + scanned[0].capacity() + scanned[1].capacity(); } // not counting out
+
+private:
+	enum EncodeMode {
+		emData,
+		emFlush,
+		emFinish
+	};
+
+	static const size_t windowSize = 16 * 1024; // decoded bytes handed to the scanners at once
+	static const int zlibLevel = 5;
+	static const int zlibMemLevel = 6; // 16 KiB of hash tables instead of the default 128 KiB
+	static const int brotliQuality = 4;
+	static const int brotliWindow = 18; // 256 KiB ring buffer, the default is 4 MiB
+
+	Encoding encoding;
+	std::vector<std::unique_ptr<ContentScanner>> scanners;
+
+	z_stream inflater;
+	z_stream deflater;
+	bool zlibStarted;
+	bool rawDeflate; // deflate without the zlib header, as some servers send it
+	char deflateHeader[2]; // the first bytes of a deflate body, held back until they show whether it has the zlib header
+	size_t deflateHeaderSize;
+	bool decoderDone;
+#ifdef HAVE_BROTLI
+	BrotliDecoderState *brotliDecoder;
+	BrotliEncoderState *brotliEncoder;
+#endif
+
+	std::string scanned[2]; // scanner output, reused for every window
+	std::unique_ptr<char[]> window;
+	size_t codecMemory;
+	uint64_t decodedBytes;
+	bool failed;
+
+	bool StartZlib();
+	void StopZlib();
+	bool Decode(const char *data, size_t size, std::string &out);
+	bool Inflate(const char *data, size_t size, std::string &out);
+	void Scan(const char *data, size_t size, std::string &out);
+	void Encode(const char *data, size_t size, EncodeMode mode, std::string &out);
+
+	// Counting allocators for zlib and brotli
+	static void *Allocate(void *opaque, size_t size);
+	static void Release(void *opaque, void *address);
+	static void *ZlibAllocate(void *opaque, unsigned int items, unsigned int size) { return Allocate(opaque, (size_t)items * size); }
+
+	/* prohibited and not implemented */
+	BodyPipeline(const BodyPipeline&);
+	BodyPipeline &operator=(const BodyPipeline&);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "BypassList.h"
+#include "ListReader.h"
+
+namespace {
+
+inline bool IsSchemeChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.';
+}
+
+// Host of an absolute url or of an authority (host:443) without the port, empty for anything else. Stops reading at the
+// end of the host, a long url is not scanned for its length first.
+std::string_view UrlHost(const char *url)
+{
+	const char *host = url;
+	const char *scheme = url;
+	while (IsSchemeChar(*scheme))
+		scheme++;
+	if (scheme[0] == ':' && scheme[1] == '/' && scheme[2] == '/')
+		host = scheme + 3;
+	else if (*url == '/')
+		return std::string_view(); // origin form, the path alone
+
+	size_t length = 0;
+	for (; length <= NormalizedHost::maxLength; length++)
+	{
+		const char c = host[length];
+		if (c == '\0' || c == '/' || c == '?' || c == '#' || c == ':')
+			return std::string_view(host, length);
+		if (c == '@')
+			return std::string_view(); // user info, not worth parsing
+	}
+
+	return std::string_view(); // longer than any DNS name
+}
+
+} // namespace
+
+bool BypassList::Load(const std::vector<std::string> &fileNames, std::string &error)
+{
+	if (fileNames.empty())
+	{
+		trie.reset();
+		return true;
+	}
+
+	std::unique_ptr<DomainTrie> loaded(new DomainTrie());
+	for (const std::string &fileName : fileNames)
+	{
+		std::vector<std::string> hostnames, domains;
+		if (!ListReader::ReadBypass(fileName, hostnames, domains))
+		{
+			error = "cannot read " + fileName;
+			return false;
+		}
+
+		for (const std::string &hostname : hostnames)
+			loaded->Insert(hostname, DomainTrie::tfHostname);
+		for (const std::string &domain : domains)
+			loaded->Insert(domain, DomainTrie::tfDomain);
+	}
+
+	loaded->Build();
+	trie = std::move(loaded);
+	return true;
+}
+
+bool BypassList::Bypassed(const char *url) const
+{
+	if (!trie)
+		return false;
+
+	const std::string_view host = UrlHost(url);
+	return !host.empty() && Bypassed(host);
+}
+
+bool BypassList::Bypassed(std::string_view host) const
+{
+	if (!trie)
+		return false;
+
+	NormalizedHost normalized;
+	return normalized.Normalize(host) && trie->Match(normalized) != 0;
+}
@@ -0,0 +1,45 @@
+#ifndef ECAP_NBLOCK_BYPASSLIST_H
+#define ECAP_NBLOCK_BYPASSLIST_H
+
+#include "DomainTrie.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hosts and domains the request service never filters (list_bypass=): internal hosts, update servers, ...
+// Service::wantsUrl() turns their urls away before a transaction is made, for a host that passes it the whole url.
+// Squid passes only the path, for Squid the bypass happens first thing in Xaction::start(), on the Host header.
+// Both lookups are a walk over one DomainTrie and do not allocate.
+class BypassList {
+public:
+	static BypassList& getInstance()
+	{
+		static BypassList instance;
+		return instance;
+	}
+
+	// Main thread only, replaces the list with the entries of the given files (ListReader::ReadBypass()), none drops it
+	bool Load(const std::vector<std::string> &fileNames, std::string &error);
+	bool Enabled() const { return trie != nullptr; }
+	size_t Entries() const { return trie ? trie->Entries() : 0; }
+
+	// url as a host hands it to wantsUrl(): absolute (http://host:port/path) or the authority of a CONNECT (host:443).
+	// Anything else, the path alone, is never bypassed.
+	bool Bypassed(const char *url) const;
+
+	// host as in the Host header, the port is ignored
+	bool Bypassed(std::string_view host) const;
+
+private:
+	std::unique_ptr<DomainTrie> trie;
+
+	BypassList() {}
+
+	/* prohibited and not implemented */
+	BypassList(const BypassList&);
+	BypassList &operator=(const BypassList&);
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "CdnStore.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+inline char LowerCase(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Host and path of a URL with or without the scheme (http://cdn.example/lib.js, cdn.example/lib.js), or of an origin form
+// uri (/lib.js) with the host taken from fallbackHost. The port, the query string and the fragment are left out.
+bool SplitUrl(std::string_view url, std::string_view fallbackHost, std::string_view &host, std::string_view &path)
+{
+	std::string_view authority;
+	if (!url.empty() && url[0] == '/')
+	{
+		authority = fallbackHost;
+		path = url;
+	}
+	else
+	{
+		const size_t schemeEnd = url.find("://");
+		if (schemeEnd != std::string_view::npos)
+			url.remove_prefix(schemeEnd + 3);
+
+		const size_t pathStart = url.find_first_of("/?#");
+		authority = url.substr(0, pathStart);
+		path = (pathStart == std::string_view::npos) ? std::string_view() : url.substr(pathStart);
+	}
+
+	if (authority.find('@') != std::string_view::npos)
+		return false;
+
+	host = authority.substr(0, authority.find(':'));
+	path = path.substr(0, path.find_first_of("?#"));
+	return !host.empty() && !path.empty();
+}
+
+uint64_t KeyHash(std::string_view host, std::string_view path)
+{
+	uint64_t hash = HashFnvOffset;
+	for (char c : host)
+		hash = (hash ^ (unsigned char)LowerCase(c)) * HashFnvPrime;
+	return HashFnv1a(path.data(), path.size(), hash);
+}
+
+} // namespace
+
+bool CdnStore::Load(const std::string &fileName, std::string &error)
+{
+	if (fileName.empty())
+	{
+		store.reset();
+		return true;
+	}
+
+	std::shared_ptr<BlocklistImage> image(new BlocklistImage());
+	if (!image->Open(fileName, error))
+		return false;
+
+	size_t indexSize = 0, resourceSize = 0, stringSize = 0, bodySize = 0;
+	uint64_t entries = 0;
+	const char *index = image->Find(BlocklistImage::stCdnIndex, indexSize, entries);
+	const char *resources = image->Find(BlocklistImage::stCdnResources, resourceSize, entries);
+	const char *strings = image->Find(BlocklistImage::stCdnStrings, stringSize, entries);
+	const char *bodies = image->Find(BlocklistImage::stCdnBodies, bodySize, entries);
+
+	if (!index || !resources || !strings || !bodies || indexSize % sizeof(IndexEntry) != 0 || resourceSize % sizeof(ResourceEntry) != 0)
+	{
+		error = fileName + " is not a CDN store";
+		return false;
+	}
+
+	// Lookup() trusts the offsets, they are checked once here
+	std::unique_ptr<Snapshot> snapshot(new Snapshot());
+	snapshot->entries = (const IndexEntry *)index;
+	snapshot->entryCount = indexSize / sizeof(IndexEntry);
+	snapshot->resources = (const ResourceEntry *)resources;
+	snapshot->strings = strings;
+	snapshot->bodies = bodies;
+
+	const size_t resourceCount = resourceSize / sizeof(ResourceEntry);
+	for (size_t i = 0; i < resourceCount; i++)
+	{
+		const ResourceEntry &resource = snapshot->resources[i];
+		if (resource.bodyOffset > bodySize || resource.bodySize > bodySize - resource.bodyOffset ||
+			resource.typeOffset > stringSize || resource.typeLength > stringSize - resource.typeOffset)
+		{
+			error = fileName + " has a corrupt resource table";
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < snapshot->entryCount; i++)
+	{
+		const IndexEntry &entry = snapshot->entries[i];
+		if (entry.resource >= resourceCount || entry.keyOffset > stringSize || entry.keyLength > stringSize - entry.keyOffset ||
+			(i > 0 && entry.hash < snapshot->entries[i - 1].hash))
+		{
+			error = fileName + " has a corrupt index";
+			return false;
+		}
+	}
+
+	snapshot->image = image;
+	store = std::move(snapshot);
+	return true;
+}
+
+bool CdnStore::Lookup(std::string_view uri, std::string_view host, Resource &resource) const
+{
+	std::string_view path;
+	if (!store || !SplitUrl(uri, host, host, path))
+		return false;
+
+	const uint64_t hash = KeyHash(host, path);
+	const IndexEntry *end = store->entries + store->entryCount;
+	const IndexEntry *entry = std::lower_bound(store->entries, end, hash,
+		[](const IndexEntry &candidate, uint64_t value) { return candidate.hash < value; });
+
+	for (; entry != end && entry->hash == hash; entry++)
+	{
+		// Keys are stored with the host lowercased
+		const char *key = store->strings + entry->keyOffset;
+		if (entry->keyLength != host.size() + path.size() || memcmp(key + host.size(), path.data(), path.size()) != 0)
+			continue;
+		if (!std::equal(host.begin(), host.end(), key, [](char a, char b) { return LowerCase(a) == b; }))
+			continue;
+
+		const ResourceEntry &stored = store->resources[entry->resource];
+		resource.body = std::string_view(store->bodies + stored.bodyOffset, stored.bodySize);
+		resource.contentType = std::string_view(store->strings + stored.typeOffset, stored.typeLength);
+		resource.image = store->image;
+		return true;
+	}
+
+	return false;
+}
+
+bool CdnStore::Builder::Add(std::string_view url, const std::string &body, const std::string &contentType, std::string &error)
+{
+	std::string_view host, path;
+	if (!SplitUrl(url, std::string_view(), host, path))
+	{
+		error = std::string(url) + " is not a URL";
+		return false;
+	}
+
+	std::string key;
+	for (char c : host)
+		key += LowerCase(c);
+	key += path;
+	if (!keys.insert(key).second)
+	{
+		error = std::string(url) + " is listed twice";
+		return false;
+	}
+
+	// Content addressed: a body stored before is shared, also by a resource that is served with another type
+	const uint64_t contentHash = HashFnv1a(body.data(), body.size());
+	std::vector<uint32_t> &sameHash = byContent[contentHash];
+	const ResourceEntry *sameBody = nullptr;
+	uint32_t resource = resources.size();
+
+	for (uint32_t candidate : sameHash)
+	{
+		const ResourceEntry &stored = resources[candidate];
+		if (stored.bodySize != body.size() || bodies.compare(stored.bodyOffset, stored.bodySize, body) != 0)
+			continue;
+
+		sameBody = &stored;
+		if (strings.compare(stored.typeOffset, stored.typeLength, contentType) == 0)
+		{
+			resource = candidate;
+			break;
+		}
+	}
+
+	if (sameBody)
+		sharedBytes += body.size();
+
+	if (resource == resources.size())
+	{
+		ResourceEntry stored = ResourceEntry();
+		stored.bodyOffset = sameBody ? sameBody->bodyOffset : bodies.size();
+		stored.bodySize = body.size();
+		stored.contentHash = contentHash;
+
+		auto type = types.find(contentType);
+		if (type == types.end())
+		{
+			type = types.insert(std::make_pair(contentType, (uint32_t)strings.size())).first;
+			strings += contentType;
+		}
+		stored.typeOffset = type->second;
+		stored.typeLength = contentType.size();
+
+		if (!sameBody)
+			bodies += body;
+		sameHash.push_back(resource);
+		resources.push_back(stored);
+	}
+
+	IndexEntry entry = IndexEntry();
+	entry.hash = KeyHash(host, path);
+	entry.keyOffset = strings.size();
+	entry.keyLength = key.size();
+	entry.resource = resource;
+	strings += key;
+	entries.push_back(entry);
+
+	return true;
+}
+
+void CdnStore::Builder::Write(BlocklistImage::Writer &writer) const
+{
+	std::vector<IndexEntry> index(entries);
+	std::sort(index.begin(), index.end(), [](const IndexEntry &a, const IndexEntry &b) { return a.hash < b.hash; });
+
+	writer.Add(BlocklistImage::stCdnIndex, index.data(), index.size() * sizeof(IndexEntry), index.size());
+	writer.Add(BlocklistImage::stCdnResources, resources.data(), resources.size() * sizeof(ResourceEntry), resources.size());
+	writer.Add(BlocklistImage::stCdnStrings, strings.data(), strings.size(), 0);
+	writer.Add(BlocklistImage::stCdnBodies, bodies.data(), bodies.size(), resources.size());
+}
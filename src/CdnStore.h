@@ -0,0 +1,107 @@
+#ifndef ECAP_NBLOCK_CDNSTORE_H
+#define ECAP_NBLOCK_CDNSTORE_H
+
+#include "BlocklistImage.h"
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Local copies of the libraries and fonts pages load from public CDNs (Decentraleyes), written offline by
+// nblock_cdn_compile and mapped with cdn_store=<file>. A request for one of them is answered by the request service from
+// the mapped store, the CDN never sees the request nor the Referer and cookies that come with it.
+//
+// The store is a BlocklistImage with its own sections. Resources are content addressed: a file listed under several URLs
+// (the same jQuery on four CDNs) is stored once. URLs are matched on the host and the path, the scheme, the port and the
+// query string are ignored. Hosts are compared case-insensitively, paths are not.
+// Kept free of libecap so the offline tools can use it as well.
+class CdnStore {
+private:
+	// Section stCdnIndex, sorted by hash: one per URL
+	struct IndexEntry {
+		uint64_t hash; // HashFnv1a() of the key: lowercase host followed by the path
+		uint32_t keyOffset; // in stCdnStrings
+		uint32_t keyLength;
+		uint32_t resource; // in stCdnResources
+		uint32_t reserved;
+	};
+
+	// Section stCdnResources: one per distinct body
+	struct ResourceEntry {
+		uint64_t bodyOffset; // in stCdnBodies
+		uint64_t bodySize;
+		uint64_t contentHash; // HashFnv1a() of the body
+		uint32_t typeOffset; // in stCdnStrings
+		uint32_t typeLength;
+	};
+
+public:
+	// A stored resource, body points into image
+	struct Resource {
+		std::string_view body;
+		std::string_view contentType;
+		std::shared_ptr<const BlocklistImage> image; // keeps body mapped while it is being sent
+	};
+
+	static CdnStore& getInstance()
+	{
+		static CdnStore instance;
+		return instance;
+	}
+
+	// Main thread only. Replaces the store with the one in fileName, an empty fileName drops it.
+	bool Load(const std::string &fileName, std::string &error);
+	bool Enabled() const { return store != nullptr; }
+
+	// uri is absolute (proxy requests) or just the path, host is the Host header for the latter. Safe to call from any
+	// thread, but not while Load() runs.
+	bool Lookup(std::string_view uri, std::string_view host, Resource &resource) const;
+
+	// Collects the resources of a store and adds its sections to an image, see nblock_cdn_compile
+	class Builder {
+	public:
+		// url: the resource's URL on one CDN, with or without the scheme. Returns false if it is not a URL or already listed.
+		bool Add(std::string_view url, const std::string &body, const std::string &contentType, std::string &error);
+		void Write(BlocklistImage::Writer &writer) const;
+
+		size_t Urls() const { return entries.size(); }
+		size_t Resources() const { return resources.size(); }
+		size_t BodyBytes() const { return bodies.size(); }
+		size_t SharedBytes() const { return sharedBytes; } // bodies listed again under other URLs, not stored again
+
+	private:
+		std::vector<IndexEntry> entries;
+		std::vector<ResourceEntry> resources;
+		std::string strings;
+		std::string bodies;
+		std::unordered_map<uint64_t, std::vector<uint32_t>> byContent; // content hash to the resources with that hash
+		std::map<std::string, uint32_t> types; // content type to its offset in strings
+		std::unordered_set<std::string> keys; // to detect URLs listed twice
+		size_t sharedBytes = 0;
+	};
+
+private:
+	struct Snapshot {
+		std::shared_ptr<const BlocklistImage> image;
+		const IndexEntry *entries;
+		size_t entryCount;
+		const ResourceEntry *resources;
+		const char *strings;
+		const char *bodies;
+	};
+
+	std::unique_ptr<Snapshot> store;
+
+	CdnStore() {}
+
+	/* prohibited and not implemented */
+	CdnStore(const CdnStore&);
+	CdnStore &operator=(const CdnStore&);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "ContentScanner.h"
+#include "ElementHiding.h"
+
+#include <strings.h>
+
+// Passes the body on unchanged, still decoded and encoded again: shows what the body pipeline itself costs
+class CopyScanner: public ContentScanner {
+public:
+	virtual void Scan(const char *data, size_t size, std::string &out) { out.append(data, size); }
+	virtual void Finish(std::string &) {}
+};
+
+ContentScanners::ContentScanners():
+	maxPendingBytes(256 * 1024)
+{
+	Register("copy", [](const ContentScanner::Context &) { return std::unique_ptr<ContentScanner>(new CopyScanner()); });
+	Register("cosmetic", [](const ContentScanner::Context &context) { return ElementHiding::getInstance().CreateScanner(context); });
+}
+
+void ContentScanners::Configure(const std::vector<std::string> &names, const std::vector<std::string> &types, size_t maxPending)
+{
+	enabled.clear();
+	for (const std::string &name : names)
+	{
+		auto factory = factories.find(name);
+		if (factory != factories.end())
+			enabled.push_back(factory->second);
+	}
+
+	mediaTypes = types;
+	maxPendingBytes = maxPending;
+}
+
+bool ContentScanners::Eligible(std::string_view contentType) const
+{
+	// Content-Type: text/html; charset=utf-8
+	std::string_view mediaType = contentType.substr(0, contentType.find(';'));
+	while (!mediaType.empty() && (mediaType.back() == ' ' || mediaType.back() == '\t'))
+		mediaType.remove_suffix(1);
+	while (!mediaType.empty() && (mediaType.front() == ' ' || mediaType.front() == '\t'))
+		mediaType.remove_prefix(1);
+
+	for (const std::string &type : mediaTypes)
+	{
+		if (type.size() == mediaType.size() && strncasecmp(type.data(), mediaType.data(), type.size()) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+std::vector<std::unique_ptr<ContentScanner>> ContentScanners::Create(const ContentScanner::Context &context) const
+{
+	std::vector<std::unique_ptr<ContentScanner>> scanners;
+	for (const ContentScanner::Factory &factory : enabled)
+	{
+		std::unique_ptr<ContentScanner> scanner = factory(context);
+		if (scanner)
+			scanners.push_back(std::move(scanner));
+	}
+	return scanners;
+}
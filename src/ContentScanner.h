@@ -0,0 +1,70 @@
+#ifndef ECAP_NBLOCK_CONTENTSCANNER_H
+#define ECAP_NBLOCK_CONTENTSCANNER_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Looks at (and may rewrite) the decoded body of a response, see BodyPipeline.
+// The body is passed in order, in pieces of any size that do not respect any markup. A scanner that needs to look across
+// piece boundaries holds back what it needs in its own state, bounded by the scanner.
+class ContentScanner {
+public:
+	struct Context {
+		std::string_view uri; // of the request the response belongs to
+		std::string_view contentType;
+	};
+
+	// Creates the scanner for one response, or returns nullptr when it has nothing to do for that response
+	typedef std::function<std::unique_ptr<ContentScanner>(const Context &context)> Factory;
+
+	virtual ~ContentScanner() {}
+
+	// Appends what should be sent on in place of data to out
+	virtual void Scan(const char *data, size_t size, std::string &out) = 0;
+
+	// End of the body, appends whatever is still held back to out
+	virtual void Finish(std::string &out) = 0;
+};
+
+// The scanners body_scan= can name, and which responses they get to see
+class ContentScanners {
+public:
+	static ContentScanners& getInstance()
+	{
+		static ContentScanners instance;
+		return instance;
+	}
+
+	bool Known(const std::string &name) const { return factories.count(name) != 0; }
+
+	// Called by the response service when it is configured. Only bodies with one of types (media types like text/html,
+	// without parameters) are scanned. maxPending limits the adapted bytes a transaction holds before the host takes them.
+	void Configure(const std::vector<std::string> &names, const std::vector<std::string> &types, size_t maxPending);
+
+	bool Enabled() const { return !enabled.empty(); }
+	bool Eligible(std::string_view contentType) const;
+	size_t MaxPending() const { return maxPendingBytes; }
+
+	// The scanners of body_scan= that want to see the response, in configuration order
+	std::vector<std::unique_ptr<ContentScanner>> Create(const ContentScanner::Context &context) const;
+
+private:
+	ContentScanners();
+
+	std::map<std::string, ContentScanner::Factory> factories;
+	std::vector<ContentScanner::Factory> enabled;
+	std::vector<std::string> mediaTypes;
+	size_t maxPendingBytes;
+
+	void Register(const std::string &name, ContentScanner::Factory factory) { factories[name] = factory; }
+
+	/* prohibited and not implemented */
+	ContentScanners(const ContentScanners&);
+	ContentScanners &operator=(const ContentScanners&);
+};
+
+#endif
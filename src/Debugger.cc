@@ -2,12 +2,66 @@
 #include <libecap/common/registry.h>
 #include <libecap/host/host.h>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// The adapter is loaded by Squid's main thread
+const std::thread::id mainThread = std::this_thread::get_id();
+
+// Messages waiting for Debugger::Flush(), a thread logging in a loop must not grow this without bounds
+const size_t maxQueued = 1000;
+
+std::mutex mutexQueue;
+std::vector<std::pair<libecap::LogVerbosity, std::string>> queue;
+size_t dropped = 0;
+
+} // namespace
 
 Debugger::Debugger(const libecap::LogVerbosity lv):
-	debug(libecap::MyHost().openDebug(lv)) {
+	verbosity(lv),
+	debug(nullptr) {
+	if (std::this_thread::get_id() == mainThread)
+		debug = libecap::MyHost().openDebug(lv);
+	else
+	{
+		queued.reset(new std::ostringstream());
+		debug = queued.get();
+	}
 }
 
 Debugger::~Debugger() {
-	if (debug)
+	if (queued)
+	{
+		std::lock_guard<std::mutex> lock(mutexQueue);
+		if (queue.size() < maxQueued)
+			queue.push_back(std::make_pair(verbosity, queued->str()));
+		else
+			dropped++;
+	}
+	else if (debug)
 		libecap::MyHost().closeDebug(debug);
 }
+
+void Debugger::Flush() {
+	std::vector<std::pair<libecap::LogVerbosity, std::string>> messages;
+	size_t droppedMessages;
+	{
+		std::lock_guard<std::mutex> lock(mutexQueue);
+		messages.swap(queue);
+		droppedMessages = dropped;
+		dropped = 0;
+	}
+
+	for (const auto &message : messages)
+	{
+		Debugger(message.first) << message.second;
+	}
+
+	if (droppedMessages > 0)
+		Debugger(ilCritical | flApplication) << "[nBlock] " << droppedMessages << " log messages of background threads dropped";
+}
@@ -3,6 +3,8 @@
 
 #include <libecap/common/log.h>
 #include <iosfwd>
+#include <memory>
+#include <sstream>
 
 using libecap::ilNormal;
 using libecap::ilCritical;
@@ -10,6 +12,8 @@ using libecap::flXaction;
 using libecap::flApplication;
 using libecap::mslLarge;
 
+// The host's debug stream may only be opened on Squid's main thread. Messages of other threads (list watcher, stats
+// writer, block log) are queued and handed to the host by Flush(), which the Service calls from the main thread.
 class Debugger {
 	public:
 		explicit Debugger(const libecap::LogVerbosity lv); // opens
@@ -23,12 +27,17 @@ class Debugger {
 			return *this;
 		}
 
+		// Main thread only: logs the messages queued by the other threads
+		static void Flush();
+
 	private:
 		/* prohibited and not implemented */
 		Debugger(const Debugger&);
 		Debugger &operator=(const Debugger&);
 
-		std::ostream *debug; // host-provided debug ostream or nil
+		libecap::LogVerbosity verbosity;
+		std::unique_ptr<std::ostringstream> queued; // the message of a thread other than the main one
+		std::ostream *debug; // host-provided debug ostream, queued or nil
 };
 
 #endif
@@ -0,0 +1,249 @@
+#include "DecisionCache.h"
+#include "Hash.h"
+
+DecisionCache::DecisionCache():
+	capacity(0),
+	shared(nullptr)
+{
+	for (Shard &shard : shards)
+	{
+		shard.capacity = 0;
+		shard.hits = 0;
+		shard.misses = 0;
+		shard.evictions = 0;
+		shard.sharedHits = 0;
+		shard.sharedMisses = 0;
+	}
+}
+
+uint64_t DecisionCache::HashKey(Domain domain, uint64_t keyHash)
+{
+	// The domain is hashed in last, so host and request keys hash apart
+	const char domainByte = domain;
+	return HashFnv1a(&domainByte, 1, keyHash);
+}
+
+void DecisionCache::SetCapacity(unsigned int entries)
+{
+	capacity = entries;
+
+	// Round up, so a small cache still gets at least one slot per shard
+	unsigned int perShard = (entries + shardCount - 1) / shardCount;
+
+	for (Shard &shard : shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutexShard);
+		shard.capacity = perShard;
+
+		while (shard.lru.size() > shard.capacity)
+		{
+			shard.index.erase(shard.lru.back().hash);
+			shard.lru.pop_back();
+			shard.evictions++;
+		}
+	}
+}
+
+bool DecisionCache::SetShared(const std::string &name, std::string &error)
+{
+	std::lock_guard<std::mutex> lock(mutexShared);
+
+	SharedCache *current = shared.load();
+	if (name.empty())
+	{
+		shared.store(nullptr);
+		return true;
+	}
+
+	// Reconfigured without changes
+	if (current && current->Name() == name && current->Capacity() == capacity)
+		return true;
+
+	std::unique_ptr<SharedCache> table(new SharedCache());
+	if (!table->Open(name, capacity, error))
+		return false;
+
+	// Verdicts cached locally until now may be older than the ones other workers share, and the other way around
+	if (!current)
+		Clear();
+
+	shared.store(table.get());
+	SharedTables.push_back(std::move(table));
+	return true;
+}
+
+DecisionCache::Verdict DecisionCache::Lookup(Domain domain, std::string_view key)
+{
+	return Lookup(domain, key, HashFnv1aReverse(key.data(), key.size()));
+}
+
+DecisionCache::Verdict DecisionCache::Lookup(Domain domain, std::string_view key, uint64_t keyHash)
+{
+	const uint64_t hash = HashKey(domain, keyHash);
+	Shard &shard = ShardFor(hash);
+
+	if (SharedCache *table = shared.load(std::memory_order_acquire))
+	{
+		const SharedCache::Result result = table->Lookup(GenerationSlot(domain), hash);
+		(result == SharedCache::srMiss ? shard.sharedMisses : shard.sharedHits).fetch_add(1, std::memory_order_relaxed);
+		return result == SharedCache::srMiss ? vdMiss : (result == SharedCache::srBlock ? vdBlock : vdAllow);
+	}
+
+	std::lock_guard<std::mutex> lock(shard.mutexShard);
+
+	auto found = shard.index.find(hash);
+	if (found == shard.index.end() || found->second->domain != domain || found->second->key != key)
+	{
+		shard.misses++;
+		return vdMiss;
+	}
+
+	// Move to the front, this entry is now the most recently used one
+	shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+	shard.hits++;
+
+	return found->second->blocked ? vdBlock : vdAllow;
+}
+
+void DecisionCache::Insert(Domain domain, std::string_view key, bool blocked)
+{
+	Insert(domain, key, HashFnv1aReverse(key.data(), key.size()), blocked);
+}
+
+void DecisionCache::Insert(Domain domain, std::string_view key, uint64_t keyHash, bool blocked)
+{
+	const uint64_t hash = HashKey(domain, keyHash);
+
+	if (SharedCache *table = shared.load(std::memory_order_acquire))
+	{
+		table->Insert(GenerationSlot(domain), hash, blocked);
+		return;
+	}
+
+	Shard &shard = ShardFor(hash);
+	std::lock_guard<std::mutex> lock(shard.mutexShard);
+
+	if (shard.capacity == 0)
+		return;
+
+	auto found = shard.index.find(hash);
+	if (found != shard.index.end())
+	{
+		// Same key (or a 64 bit hash collision, in which case the newest entry wins)
+		Entry &entry = *found->second;
+		entry.domain = domain;
+		entry.blocked = blocked;
+		entry.key.assign(key.data(), key.size());
+		shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+		return;
+	}
+
+	if (shard.lru.size() >= shard.capacity)
+	{
+		// Full: the least recently used entry, its list node, index node and key buffer are reused for the new one
+		auto node = shard.index.extract(shard.lru.back().hash);
+		shard.lru.splice(shard.lru.begin(), shard.lru, std::prev(shard.lru.end()));
+		shard.evictions++;
+
+		Entry &entry = shard.lru.front();
+		entry.hash = hash;
+		entry.domain = (char)domain;
+		entry.blocked = blocked;
+		entry.key.assign(key.data(), key.size());
+
+		node.key() = hash;
+		node.mapped() = shard.lru.begin();
+		shard.index.insert(std::move(node));
+		return;
+	}
+
+	shard.lru.push_front(Entry{hash, (char)domain, blocked, std::string(key)});
+	shard.index[hash] = shard.lru.begin();
+}
+
+void DecisionCache::Clear()
+{
+	if (SharedCache *table = shared.load(std::memory_order_acquire))
+	{
+		for (unsigned int slot = 0; slot < SharedCache::generationSlots; slot++)
+			table->Clear(slot);
+	}
+
+	for (Shard &shard : shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutexShard);
+		shard.lru.clear();
+		shard.index.clear();
+	}
+}
+
+void DecisionCache::Clear(Domain domain)
+{
+	if (SharedCache *table = shared.load(std::memory_order_acquire))
+		table->Clear(GenerationSlot(domain));
+
+	for (Shard &shard : shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutexShard);
+
+		for (auto entry = shard.lru.begin(); entry != shard.lru.end();)
+		{
+			if (entry->domain == domain)
+			{
+				shard.index.erase(entry->hash);
+				entry = shard.lru.erase(entry);
+			}
+			else ++entry;
+		}
+	}
+}
+
+size_t DecisionCache::Invalidate(Domain domain, const std::function<bool(const std::string &key)> &affected)
+{
+	size_t invalidated = 0;
+
+	if (SharedCache *table = shared.load(std::memory_order_acquire))
+		table->Clear(GenerationSlot(domain));
+
+	for (Shard &shard : shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutexShard);
+
+		for (auto entry = shard.lru.begin(); entry != shard.lru.end();)
+		{
+			if (entry->domain == domain && affected(entry->key))
+			{
+				shard.index.erase(entry->hash);
+				entry = shard.lru.erase(entry);
+				invalidated++;
+			}
+			else ++entry;
+		}
+	}
+
+	return invalidated;
+}
+
+DecisionCache::Counters DecisionCache::GetCounters()
+{
+	Counters counters = {0, 0, 0, 0};
+
+	for (Shard &shard : shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutexShard);
+		counters.hits += shard.hits;
+		counters.misses += shard.misses;
+		counters.evictions += shard.evictions;
+		counters.entries += shard.lru.size();
+		counters.hits += shard.sharedHits.load(std::memory_order_relaxed);
+		counters.misses += shard.sharedMisses.load(std::memory_order_relaxed);
+	}
+
+	if (SharedCache *table = shared.load(std::memory_order_acquire))
+	{
+		counters.entries += table->Entries();
+		counters.evictions += table->Evictions();
+	}
+
+	return counters;
+}
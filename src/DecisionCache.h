@@ -0,0 +1,107 @@
+#ifndef ECAP_NBLOCK_DECISIONCACHE_H
+#define ECAP_NBLOCK_DECISIONCACHE_H
+
+#include "SharedCache.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Allow / block verdict cache shared by NetFilterDns and NetFilterAdblock.
+// Entries are spread over a fixed number of shards by key hash, each shard has its own lock and evicts in LRU order.
+// With SetShared() the verdicts go to a SharedCache table that all Squid workers use instead.
+class DecisionCache {
+public:
+	static DecisionCache& getInstance()
+	{
+		static DecisionCache instance;
+		return instance;
+	}
+
+	// Keys of different filters live in their own namespace, so equal strings never collide
+	enum Domain {
+		cdHost = 'h',
+		cdRequest = 'r'
+	};
+
+	enum Verdict {
+		vdMiss = 0,
+		vdAllow,
+		vdBlock
+	};
+
+	struct Counters {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		uint64_t entries;
+	};
+
+	void SetCapacity(unsigned int entries);
+	unsigned int Capacity() const { return capacity; }
+
+	// Moves the verdicts to the shared memory segment name, sized for Capacity() entries. An empty name goes back to
+	// the cache of this process.
+	bool SetShared(const std::string &name, std::string &error);
+
+	// Lookups never allocate, Insert() copies the key
+	Verdict Lookup(Domain domain, std::string_view key);
+	void Insert(Domain domain, std::string_view key, bool blocked);
+
+	// Same, for callers that already have HashFnv1aReverse(key), eg NormalizedHost::Hash()
+	Verdict Lookup(Domain domain, std::string_view key, uint64_t keyHash);
+	void Insert(Domain domain, std::string_view key, uint64_t keyHash, bool blocked);
+
+	void Clear();
+	void Clear(Domain domain);
+
+	// Drops the entries of domain for which affected(key) returns true, returns the number of dropped entries.
+	// The shared table does not keep keys, there it drops all entries of domain and returns 0.
+	size_t Invalidate(Domain domain, const std::function<bool(const std::string &key)> &affected);
+
+	Counters GetCounters();
+
+private:
+	DecisionCache();
+
+	static const unsigned int shardCount = 64; // power of two
+
+	struct Entry {
+		uint64_t hash;
+		char domain;
+		bool blocked;
+		std::string key;
+	};
+
+	struct alignas(64) Shard {
+		std::mutex mutexShard;
+		std::list<Entry> lru; // most recently used entry at the front
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+		unsigned int capacity;
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		std::atomic<uint64_t> sharedHits; // lookups in the shared table, counted per process
+		std::atomic<uint64_t> sharedMisses;
+	};
+
+	Shard shards[shardCount];
+	unsigned int capacity;
+
+	std::atomic<SharedCache *> shared;
+	std::mutex mutexShared; // guards SharedTables
+	std::vector<std::unique_ptr<SharedCache>> SharedTables; // kept mapped, a lookup may still be using a replaced one
+
+	static unsigned int GenerationSlot(Domain domain) { return domain == cdHost ? 0 : 1; }
+	static uint64_t HashKey(Domain domain, uint64_t keyHash);
+	Shard &ShardFor(uint64_t hash) { return shards[(hash >> 32) & (shardCount - 1)]; }
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "DomainTrie.h"
+
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+static const size_t maxNodes = 0xffffffff;
+
+DomainTrie::DomainTrie():
+	nodes(nullptr),
+	nodeCount(0),
+	labels(nullptr),
+	labelCount(0),
+	entryCount(0),
+	buildEntries(0)
+{
+	Clear();
+}
+
+void DomainTrie::Clear()
+{
+	OwnedNodes.assign(1, Node{0, 0, 0, 0, 0, 0});
+	OwnedLabels.clear();
+	attachedMemory.reset();
+
+	nodes = OwnedNodes.data();
+	nodeCount = OwnedNodes.size();
+	labels = OwnedLabels.data();
+	labelCount = 0;
+	entryCount = 0;
+
+	buildRoot.reset();
+	buildEntries = 0;
+
+	prefilter.Clear();
+}
+
+bool DomainTrie::Attach(const void *nodeData, size_t nodeBytes, const char *labelData, size_t labelBytes, size_t entries, std::shared_ptr<const void> backing,
+	const void *filterData, size_t filterBytes)
+{
+	if (nodeBytes == 0 || nodeBytes % sizeof(Node) != 0 || nodeBytes / sizeof(Node) > maxNodes)
+		return false;
+
+	// Validate once here, so Match() can trust every offset it follows
+	const Node *attachedNodes = (const Node *)nodeData;
+	const size_t attachedCount = nodeBytes / sizeof(Node);
+
+	for (size_t i = 0; i < attachedCount; i++)
+	{
+		const Node &node = attachedNodes[i];
+		if ((uint64_t)node.firstChild + node.childCount > attachedCount || (uint64_t)node.label + node.labelLength > labelBytes)
+			return false;
+		if (node.childCount && node.firstChild <= i)
+			return false; // children always follow their parent, this also rules out cycles
+	}
+
+	Clear();
+	OwnedNodes.clear();
+	OwnedNodes.shrink_to_fit();
+
+	nodes = attachedNodes;
+	nodeCount = attachedCount;
+	labels = labelData;
+	labelCount = labelBytes;
+	entryCount = entries;
+	attachedMemory = backing;
+
+	// Images written without the filter (or with a damaged one) still work, at the cost of building it here
+	if (!filterData || !prefilter.Attach(filterData, filterBytes, backing))
+		BuildPrefilter();
+
+	return true;
+}
+
+void DomainTrie::BuildPrefilter()
+{
+	// The suffix hash of a node continues the one of its parent with the dot and its own label, right to left.
+	// Parents always come before their children in the node array.
+	std::vector<uint64_t> nodeHashes(nodeCount, HashFnvOffset);
+	std::vector<uint64_t> keys;
+	keys.reserve(entryCount);
+
+	for (size_t i = 0; i < nodeCount; i++)
+	{
+		const Node &node = nodes[i];
+		const uint64_t parentHash = (i == 0) ? HashFnvOffset : HashFnv1a(".", 1, nodeHashes[i]);
+
+		for (uint32_t child = node.firstChild; child < node.firstChild + node.childCount; child++)
+		{
+			nodeHashes[child] = HashFnv1aReverse(&labels[nodes[child].label], nodes[child].labelLength, parentHash);
+			if (nodes[child].flags)
+				keys.push_back(nodeHashes[child]);
+		}
+	}
+
+	// Without a filter MayMatch() lets everything through, which is slower but still correct
+	prefilter.Build(std::move(keys));
+}
+
+bool DomainTrie::MayMatch(const NormalizedHost &host) const
+{
+	if (prefilter.Empty())
+		return nodes[0].childCount != 0;
+
+	// The host itself can be listed as hostname or domain. Its parents only count as domains, and not the top level one.
+	const unsigned int labels = host.Labels();
+	if (prefilter.Contains(host.SuffixHash(0)))
+		return true;
+
+	for (unsigned int label = 1; label + 1 < labels; label++)
+		if (prefilter.Contains(host.SuffixHash(label)))
+			return true;
+
+	return false;
+}
+
+void DomainTrie::Insert(std::string_view name, unsigned char flags)
+{
+	if (name.empty() || flags == 0)
+		return;
+
+	if (!buildRoot)
+		buildRoot.reset(new BuildNode());
+
+	BuildNode *node = buildRoot.get();
+	size_t end = name.size();
+
+	while (true)
+	{
+		size_t dotPos = name.rfind('.', end - 1);
+		size_t start = (dotPos == std::string_view::npos) ? 0 : dotPos + 1;
+
+		// Labels are limited to 63 characters by DNS, ignore anything that does not fit the node layout
+		if (end - start == 0 || end - start > 255)
+			return;
+
+		std::unique_ptr<BuildNode> &child = node->children[std::string(name.substr(start, end - start))];
+		if (!child)
+			child.reset(new BuildNode());
+		node = child.get();
+
+		if (dotPos == std::string_view::npos)
+			break;
+		end = dotPos;
+	}
+
+	if (node->flags == 0)
+		buildEntries++;
+	node->flags |= flags;
+}
+
+void DomainTrie::Build()
+{
+	OwnedNodes.assign(1, Node{0, 0, 0, 0, 0, 0});
+	OwnedLabels.clear();
+	attachedMemory.reset();
+	entryCount = buildEntries;
+
+	// Store every distinct label once, lists with many entries below the same domains repeat a lot of them
+	std::unordered_map<std::string, uint32_t> labelOffsets;
+
+	// Breadth first, so the children of a node end up next to each other. std::map already keeps them sorted.
+	std::deque<std::pair<BuildNode *, uint32_t>> pending;
+	pending.push_back(std::make_pair(buildRoot.get(), 0));
+
+	while (buildRoot && !pending.empty())
+	{
+		BuildNode *buildNode = pending.front().first;
+		uint32_t nodeIndex = pending.front().second;
+		pending.pop_front();
+
+		OwnedNodes[nodeIndex].firstChild = OwnedNodes.size();
+		OwnedNodes[nodeIndex].childCount = buildNode->children.size();
+
+		for (auto &child : buildNode->children)
+		{
+			auto offset = labelOffsets.find(child.first);
+			if (offset == labelOffsets.end())
+			{
+				offset = labelOffsets.insert(std::make_pair(child.first, (uint32_t)OwnedLabels.size())).first;
+				OwnedLabels.insert(OwnedLabels.end(), child.first.begin(), child.first.end());
+			}
+
+			Node node = {offset->second, (uint8_t)child.first.size(), child.second->flags, 0, 0, 0};
+			pending.push_back(std::make_pair(child.second.get(), (uint32_t)OwnedNodes.size()));
+			OwnedNodes.push_back(node);
+		}
+	}
+
+	OwnedNodes.shrink_to_fit();
+	OwnedLabels.shrink_to_fit();
+
+	nodes = OwnedNodes.data();
+	nodeCount = OwnedNodes.size();
+	labels = OwnedLabels.data();
+	labelCount = OwnedLabels.size();
+
+	buildRoot.reset();
+	buildEntries = 0;
+
+	BuildPrefilter();
+}
+
+const DomainTrie::Node *DomainTrie::FindChild(const Node &parent, const char *label, size_t length) const
+{
+	// Binary search, children are sorted the way std::map<std::string> sorted them
+	const Node *first = &nodes[parent.firstChild];
+	size_t count = parent.childCount;
+
+	while (count > 0)
+	{
+		size_t half = count / 2;
+		const Node &middle = first[half];
+
+		int compare = memcmp(&labels[middle.label], label, std::min<size_t>(middle.labelLength, length));
+		if (compare == 0)
+			compare = (int)middle.labelLength - (int)length;
+
+		if (compare == 0)
+			return &middle;
+
+		if (compare < 0)
+		{
+			first = &middle + 1;
+			count -= half + 1;
+		}
+		else count = half;
+	}
+
+	return nullptr;
+}
+
+unsigned char DomainTrie::Match(const NormalizedHost &host, size_t *matchStart) const
+{
+	if (host.Length() == 0 || !MayMatch(host))
+		return 0;
+
+	const Node *node = &nodes[0];
+	const std::string_view name = host.Name();
+	size_t end = name.size();
+	unsigned int depth = 0;
+
+	// The label boundaries are known already, empty labels (a leading, trailing or double dot) never match a node
+	for (unsigned int label = host.Labels(); label-- > 0;)
+	{
+		const size_t start = host.LabelStart(label);
+
+		node = FindChild(*node, name.data() + start, end - start);
+		if (!node)
+			return 0;
+		depth++;
+
+		// Do not block *.com: the top level domain on its own never counts as a domain match
+		if (depth >= 2 && (node->flags & tfDomain))
+		{
+			if (matchStart)
+				*matchStart = start;
+			return tfDomain;
+		}
+
+		end = start - 1;
+	}
+
+	if (matchStart)
+		*matchStart = 0;
+	return node->flags & tfHostname;
+}
+
+unsigned char DomainTrie::Match(std::string_view host, size_t *matchStart) const
+{
+	NormalizedHost normalized;
+	if (!normalized.Normalize(host))
+		return 0;
+
+	return Match(normalized, matchStart);
+}
+
+void DomainTrie::Visit(const std::function<void(const std::string &name, unsigned char flags)> &visitor) const
+{
+	std::string name;
+	VisitNode(nodes[0], name, visitor);
+}
+
+void DomainTrie::VisitNode(const Node &node, std::string &name, const std::function<void(const std::string &, unsigned char)> &visitor) const
+{
+	for (uint32_t i = 0; i < node.childCount; i++)
+	{
+		const Node &child = nodes[node.firstChild + i];
+		const size_t nameSize = name.size();
+
+		// Child labels are prepended: com -> example.com -> ads.example.com
+		std::string label(&labels[child.label], child.labelLength);
+		name = nameSize ? label + "." + name : label;
+
+		if (child.flags)
+			visitor(name, child.flags);
+
+		VisitNode(child, name, visitor);
+		name.erase(0, name.size() - nameSize);
+	}
+}
+
+size_t DomainTrie::MemoryUsage() const
+{
+	// Attached memory is shared with other processes through the page cache, it is not accounted here
+	return OwnedNodes.capacity() * sizeof(Node) + OwnedLabels.capacity() + prefilter.MemoryUsage();
+}
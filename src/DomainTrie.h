@@ -0,0 +1,101 @@
+#ifndef ECAP_NBLOCK_DOMAINTRIE_H
+#define ECAP_NBLOCK_DOMAINTRIE_H
+
+#include "HostName.h"
+#include "XorFilter.h"
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compact trie of host names keyed on their labels in reverse order (com -> example -> ads).
+// Entries are collected with Insert() and frozen by Build() into two flat arrays: the nodes, with the children of every
+// node stored next to each other sorted by label, and one pool holding every distinct label once.
+// Match() walks the labels of a NormalizedHost from right to left, without allocating. Entries are expected in lowercase.
+// An xor filter over the suffix hashes of all entries (see NormalizedHost) sits in front of the walk: most hosts that are
+// not listed are turned away by MayMatch() after a few reads from one small array.
+// A frozen trie can also be attached to memory owned by someone else, eg a memory mapped BlocklistImage.
+class DomainTrie {
+public:
+	enum Flags {
+		tfHostname = 1, // exact host name match only
+		tfDomain = 2 // matches the domain and all of its sub domains
+	};
+
+	DomainTrie();
+
+	void Insert(std::string_view name, unsigned char flags);
+	void Build();
+	void Clear();
+
+	// Uses the node and label arrays of a previously built trie in place, backing keeps that memory alive.
+	// Returns false if the arrays are inconsistent. The prefilter is attached as well when given, or built otherwise.
+	bool Attach(const void *nodeData, size_t nodeBytes, const char *labelData, size_t labelBytes, size_t entries, std::shared_ptr<const void> backing,
+		const void *filterData = nullptr, size_t filterBytes = 0);
+	const void *NodeData() const { return nodes; }
+	size_t NodeBytes() const { return nodeCount * sizeof(Node); }
+	const char *LabelData() const { return labels; }
+	size_t LabelBytes() const { return labelCount; }
+	const XorFilter &Prefilter() const { return prefilter; }
+
+	// False if Match() is certain to return 0, true if host may be listed
+	bool MayMatch(const NormalizedHost &host) const;
+
+	// Returns tfHostname if the host itself is listed as hostname, tfDomain if the host or any of its parent domains
+	// (excluding the top level domain) is listed as domain, or 0 when the host is not listed at all.
+	// matchStart receives the offset of the matching entry in host.
+	unsigned char Match(const NormalizedHost &host, size_t *matchStart = nullptr) const;
+	unsigned char Match(std::string_view host, size_t *matchStart = nullptr) const; // normalizes host first
+
+	// Calls visitor for every entry in the frozen trie
+	void Visit(const std::function<void(const std::string &name, unsigned char flags)> &visitor) const;
+
+	size_t Entries() const { return entryCount; }
+	size_t MemoryUsage() const;
+
+private:
+	struct Node {
+		uint32_t label; // offset in the label pool
+		uint8_t labelLength;
+		uint8_t flags;
+		uint16_t reserved;
+		uint32_t firstChild;
+		uint32_t childCount;
+	};
+
+	struct BuildNode {
+		std::map<std::string, std::unique_ptr<BuildNode>> children;
+		unsigned char flags = 0;
+	};
+
+	// Frozen trie, either pointing into the owned vectors below or into attached memory. nodes[0] is the root.
+	const Node *nodes;
+	size_t nodeCount;
+	const char *labels;
+	size_t labelCount;
+	size_t entryCount;
+
+	std::vector<Node> OwnedNodes;
+	std::vector<char> OwnedLabels;
+	std::shared_ptr<const void> attachedMemory;
+
+	std::unique_ptr<BuildNode> buildRoot;
+	size_t buildEntries;
+
+	XorFilter prefilter;
+
+	void BuildPrefilter();
+
+	const Node *FindChild(const Node &parent, const char *label, size_t length) const;
+	void VisitNode(const Node &node, std::string &name, const std::function<void(const std::string &, unsigned char)> &visitor) const;
+
+	/* prohibited and not implemented */
+	DomainTrie(const DomainTrie&);
+	DomainTrie &operator=(const DomainTrie&);
+};
+
+#endif
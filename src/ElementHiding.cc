@@ -0,0 +1,596 @@
+#include "ElementHiding.h"
+#include "Hash.h"
+#include "HostName.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <unordered_set>
+
+namespace {
+
+const size_t chunkSelectors = 32; // a selector the browser does not understand drops the whole rule it is part of
+const char hideDeclaration[] = "{display:none!important}\n";
+const char styleStart[] = "<style>";
+const char styleEnd[] = "</style>";
+
+struct ElementRule {
+	std::string selector;
+	std::vector<std::string> domains; // where the rule applies, everywhere if empty
+	std::vector<std::string> excluded; // ~domain
+	bool exception; // #@#
+};
+
+inline char LowerCase(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+std::string_view Trim(std::string_view text)
+{
+	while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r'))
+		text.remove_suffix(1);
+	while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+		text.remove_prefix(1);
+	return text;
+}
+
+// False for selectors that need an extended filter engine, or that would break out of the stylesheet
+bool PlainSelector(std::string_view selector)
+{
+	static const char *const procedural[] = {":-abp-", ":has-text(", ":xpath(", ":upward(", ":remove(", ":style(", ":matches-",
+		":min-text-length(", ":watch-attr(", ":others(", ":if(", ":if-not("};
+
+	if (selector.empty() || selector[0] == '+' || selector[0] == '^') // scriptlets and HTML filters
+		return false;
+	if (selector.find_first_of("{}<") != std::string_view::npos || selector.find("/*") != std::string_view::npos)
+		return false;
+
+	for (const char *pseudoClass : procedural)
+	{
+		if (selector.find(pseudoClass) != std::string_view::npos)
+			return false;
+	}
+
+	return true;
+}
+
+// Reads "example.com,~shop.example.com" into rule. False if the list only names domains that can not be matched by
+// suffix (entities like example.*, regular expressions), the rule must not turn into a generic one then.
+bool ParseDomains(std::string_view list, ElementRule &rule)
+{
+	if (list.empty())
+		return true;
+
+	bool skippedDomain = false;
+	while (!list.empty())
+	{
+		const size_t end = std::min(list.find(','), list.size());
+		std::string_view domain = Trim(list.substr(0, end));
+		list.remove_prefix(std::min(end + 1, list.size()));
+
+		const bool excluded = !domain.empty() && domain[0] == '~';
+		if (excluded)
+			domain.remove_prefix(1);
+
+		if (domain.empty() || domain.find_first_of("*/") != std::string_view::npos)
+		{
+			skippedDomain = skippedDomain || !excluded;
+			continue;
+		}
+
+		std::string name(domain);
+		std::transform(name.begin(), name.end(), name.begin(), LowerCase);
+		(excluded ? rule.excluded : rule.domains).push_back(name);
+	}
+
+	return !skippedDomain || !rule.domains.empty();
+}
+
+// Whether rule applies on domain: the most specific of its domains and exclusions that domain is in decides
+bool AppliesTo(const ElementRule &rule, std::string_view domain)
+{
+	for (std::string_view suffix = domain;;)
+	{
+		if (std::find(rule.excluded.begin(), rule.excluded.end(), suffix) != rule.excluded.end())
+			return false;
+		if (std::find(rule.domains.begin(), rule.domains.end(), suffix) != rule.domains.end())
+			return true;
+
+		const size_t dot = suffix.find('.');
+		if (dot == std::string_view::npos)
+			break;
+		suffix.remove_prefix(dot + 1);
+	}
+
+	return rule.domains.empty();
+}
+
+// One CSS rule hiding up to chunkSelectors selectors
+std::shared_ptr<const std::string> HideRule(const std::vector<const std::string *> &selectors)
+{
+	std::shared_ptr<std::string> css = std::make_shared<std::string>();
+	for (const std::string *selector : selectors)
+	{
+		if (!css->empty())
+			*css += ',';
+		*css += *selector;
+	}
+	*css += hideDeclaration;
+	return css;
+}
+
+std::shared_ptr<const std::string> HideRules(const std::vector<const std::string *> &selectors)
+{
+	std::shared_ptr<std::string> css = std::make_shared<std::string>();
+	for (size_t first = 0; first < selectors.size(); first += chunkSelectors)
+	{
+		const std::vector<const std::string *> chunk(selectors.begin() + first, selectors.begin() + std::min(first + chunkSelectors, selectors.size()));
+		*css += *HideRule(chunk);
+	}
+	return css;
+}
+
+// Hides the page elements with a <style> element spliced into the <head> of the page.
+// The page is tokenized only as far as needed to find that spot: the stylesheet goes right behind the <head> start tag,
+// or in front of the first tag other than <html> when the page has no <head> start tag (the browser opens the head
+// element there), or at the end of a page without any. Comments, doctype and processing instructions are stepped over.
+// Only the bytes of a tag name are held back, everything after the splice is copied through.
+class CosmeticScanner: public ContentScanner {
+public:
+	CosmeticScanner(std::shared_ptr<const ElementHiding::Chunks> aGeneric, std::shared_ptr<const std::string> aSpecific):
+		generic(std::move(aGeneric)),
+		specific(std::move(aSpecific)),
+		state(stText),
+		endTag(false),
+		insertAfterTag(false),
+		document(false),
+		dashes(0),
+		quote(0)
+	{
+	}
+
+	virtual void Scan(const char *data, size_t size, std::string &out);
+	virtual void Finish(std::string &out);
+
+private:
+	enum State {
+		stText,
+		stTagOpen, // after <, reading the tag name
+		stMarkup, // after <!, a comment or a doctype
+		stComment,
+		stDeclaration, // up to the next >
+		stTag, // attributes of <html> or <head>
+		stDone // stylesheet spliced in
+	};
+
+	static const size_t maxTagName = 8; // longer names are neither html nor head
+
+	std::shared_ptr<const ElementHiding::Chunks> generic;
+	std::shared_ptr<const std::string> specific;
+	State state;
+	std::string held; // < and the tag name so far
+	std::string tagName; // lowercase
+	bool endTag;
+	bool insertAfterTag; // <head>
+	bool document; // a doctype or <html> came first, the body is a whole page and not a fragment of one
+	unsigned int dashes;
+	char quote; // of the attribute value the tag is in
+
+	void TagNameEnd(std::string &out);
+	void Inject(std::string &out);
+};
+
+void CosmeticScanner::Scan(const char *data, size_t size, std::string &out)
+{
+	if (state == stDone)
+	{
+		out.append(data, size);
+		return;
+	}
+
+	size_t i = 0;
+	size_t spanStart = 0; // data before this offset is in out or held already
+
+	while (i < size && state != stDone)
+	{
+		const char c = data[i];
+
+		switch (state)
+		{
+			case stText:
+			{
+				const char *open = (const char *)memchr(data + i, '<', size - i);
+				if (!open)
+				{
+					i = size;
+					break;
+				}
+
+				i = open - data;
+				out.append(data + spanStart, i - spanStart);
+				held.assign(1, '<');
+				tagName.clear();
+				endTag = false;
+				state = stTagOpen;
+				spanStart = ++i;
+				break;
+			}
+
+			case stTagOpen:
+			{
+				const bool nameChar = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (!tagName.empty() && ((c >= '0' && c <= '9') || c == '-'));
+
+				if (held.size() == 1 && (c == '!' || c == '?'))
+				{
+					// Never spliced in front of these, hand them on
+					out += held;
+					held.clear();
+					state = (c == '!') ? stMarkup : stDeclaration;
+					dashes = 0;
+					spanStart = i++;
+				}
+				else if (held.size() == 1 && c == '/')
+				{
+					endTag = true;
+					held += c;
+					spanStart = ++i;
+				}
+				else if (nameChar && tagName.size() < maxTagName)
+				{
+					tagName += LowerCase(c);
+					held += c;
+					spanStart = ++i;
+				}
+				else if (tagName.empty())
+				{
+					// Not a tag after all ("a < b"), c is looked at again as text
+					out += held;
+					held.clear();
+					state = stText;
+					spanStart = i;
+				}
+				else
+				{
+					TagNameEnd(out);
+					spanStart = i;
+				}
+				break;
+			}
+
+			case stMarkup:
+				// <!-- starts a comment, anything else is a declaration like <!DOCTYPE html>
+				if (c == '-' && dashes < 2)
+				{
+					i++;
+					if (++dashes == 2)
+					{
+						state = stComment;
+						dashes = 0;
+					}
+				}
+				else
+				{
+					document = document || (dashes == 0 && (c == 'd' || c == 'D')); // <!DOCTYPE
+					state = stDeclaration;
+				}
+				break;
+
+			case stComment:
+				if (c == '>' && dashes >= 2)
+					state = stText;
+				dashes = (c == '-') ? dashes + 1 : 0;
+				i++;
+				break;
+
+			case stDeclaration:
+				if (c == '>')
+					state = stText;
+				i++;
+				break;
+
+			case stTag:
+				i++;
+				if (quote)
+				{
+					if (c == quote)
+						quote = 0;
+				}
+				else if (c == '"' || c == '\'')
+					quote = c;
+				else if (c == '>')
+				{
+					if (insertAfterTag)
+					{
+						out.append(data + spanStart, i - spanStart);
+						spanStart = i;
+						Inject(out);
+						state = stDone;
+					}
+					else
+						state = stText;
+				}
+				break;
+
+			case stDone:
+				break;
+		}
+	}
+
+	out.append(data + spanStart, size - spanStart);
+}
+
+// The tag name is complete: step over <html>, splice in behind <head>, or in front of anything else in a whole page.
+// A fragment (markup loaded into a page by a script) is passed on as it is.
+void CosmeticScanner::TagNameEnd(std::string &out)
+{
+	if (!endTag && (tagName == "html" || tagName == "head"))
+	{
+		out += held;
+		insertAfterTag = (tagName == "head");
+		document = true;
+		quote = 0;
+		state = stTag;
+	}
+	else
+	{
+		if (document)
+			Inject(out);
+		out += held;
+		state = stDone;
+	}
+
+	held.clear();
+}
+
+void CosmeticScanner::Finish(std::string &out)
+{
+	if (state == stDone)
+		return;
+
+	// A page without any tag past <html>, or one cut off inside a tag name
+	out += held;
+	held.clear();
+	if (document)
+		Inject(out);
+	state = stDone;
+}
+
+void CosmeticScanner::Inject(std::string &out)
+{
+	const size_t before = out.size();
+
+	out += styleStart;
+	if (generic)
+	{
+		for (const std::shared_ptr<const std::string> &chunk : *generic)
+			out += *chunk;
+	}
+	if (specific)
+		out += *specific;
+	out += styleEnd;
+
+	Stats &stats = Stats::getInstance();
+	stats.Count(Stats::scCosmeticPages);
+	stats.Count(Stats::scCosmeticBytes, out.size() - before);
+}
+
+} // namespace
+
+ElementHiding::Counts ElementHiding::Load(const std::string &rules)
+{
+	Counts counts;
+	std::vector<ElementRule> parsed;
+	std::unordered_set<std::string> exceptedEverywhere; // #@#selector
+	std::unordered_set<std::string_view> seen;
+
+	for (size_t lineStart = 0; lineStart < rules.size();)
+	{
+		size_t lineEnd = rules.find('\n', lineStart);
+		if (lineEnd == std::string::npos)
+			lineEnd = rules.size();
+		const std::string_view line = Trim(std::string_view(rules).substr(lineStart, lineEnd - lineStart));
+		lineStart = lineEnd + 1;
+
+		const size_t separator = line.find('#');
+		if (line.empty() || separator == std::string_view::npos || !seen.insert(line).second)
+			continue;
+
+		// ## hides, #@# is an exception, other separators (#?#, #$#, #%#) need an extended filter engine
+		ElementRule rule;
+		std::string_view selector;
+		rule.exception = (line.compare(separator, 3, "#@#") == 0);
+		if (rule.exception)
+			selector = line.substr(separator + 3);
+		else if (line.compare(separator, 2, "##") == 0)
+			selector = line.substr(separator + 2);
+
+		selector = Trim(selector);
+		if (!PlainSelector(selector) || !ParseDomains(line.substr(0, separator), rule))
+		{
+			counts.skipped++;
+			continue;
+		}
+
+		rule.selector = std::string(selector);
+		counts.rules++;
+
+		if (rule.exception && rule.domains.empty() && rule.excluded.empty())
+			exceptedEverywhere.insert(rule.selector);
+		else
+			parsed.push_back(std::move(rule));
+	}
+
+	// The generic selectors in list order, with the number of rules hiding each of them
+	std::vector<const std::string *> genericSelectors;
+	std::unordered_map<std::string_view, size_t> genericIndex;
+	std::vector<size_t> genericRules;
+	for (const ElementRule &rule : parsed)
+	{
+		if (rule.exception || !rule.domains.empty() || exceptedEverywhere.count(rule.selector))
+			continue;
+
+		auto inserted = genericIndex.emplace(rule.selector, genericSelectors.size());
+		if (inserted.second)
+		{
+			genericSelectors.push_back(&rule.selector);
+			genericRules.push_back(0);
+		}
+		genericRules[inserted.first->second]++;
+	}
+
+	std::unique_ptr<Stylesheets> next(new Stylesheets());
+	std::shared_ptr<Chunks> genericChunks = std::make_shared<Chunks>();
+	for (size_t first = 0; first < genericSelectors.size(); first += chunkSelectors)
+	{
+		const std::vector<const std::string *> chunk(genericSelectors.begin() + first, genericSelectors.begin() + std::min(first + chunkSelectors, genericSelectors.size()));
+		genericChunks->push_back(HideRule(chunk));
+		counts.bytes += genericChunks->back()->size();
+	}
+	next->generic = genericChunks;
+	counts.genericSelectors = genericSelectors.size();
+
+	// Every domain a rule names gets a stylesheet, from the rules naming that domain or one of its parents
+	std::unordered_map<std::string_view, std::vector<size_t>> named;
+	for (size_t ruleIndex = 0; ruleIndex < parsed.size(); ruleIndex++)
+	{
+		for (const std::string &domain : parsed[ruleIndex].domains)
+			named[domain].push_back(ruleIndex);
+		for (const std::string &domain : parsed[ruleIndex].excluded)
+			named[domain].push_back(ruleIndex);
+	}
+
+	for (const auto &entry : named)
+	{
+		const std::string_view domain = entry.first;
+
+		std::vector<size_t> candidates;
+		for (std::string_view suffix = domain;;)
+		{
+			auto found = named.find(suffix);
+			if (found != named.end())
+				candidates.insert(candidates.end(), found->second.begin(), found->second.end());
+
+			const size_t dot = suffix.find('.');
+			if (dot == std::string_view::npos)
+				break;
+			suffix.remove_prefix(dot + 1);
+		}
+		std::sort(candidates.begin(), candidates.end());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+		std::vector<const std::string *> specific;
+		std::unordered_set<std::string_view> excepted;
+		std::unordered_map<size_t, size_t> genericExcluded; // generic selector, rules of it that do not apply here
+		for (size_t ruleIndex : candidates)
+		{
+			const ElementRule &rule = parsed[ruleIndex];
+			const bool applies = AppliesTo(rule, domain);
+
+			if (rule.exception)
+			{
+				if (applies)
+					excepted.insert(rule.selector);
+			}
+			else if (!rule.domains.empty())
+			{
+				if (applies)
+					specific.push_back(&rule.selector);
+			}
+			else if (!applies && genericIndex.count(rule.selector))
+				genericExcluded[genericIndex[rule.selector]]++;
+		}
+
+		// Generic selectors no rule hides here any more
+		std::unordered_set<size_t> removed;
+		for (const auto &excluded : genericExcluded)
+		{
+			if (excluded.second == genericRules[excluded.first])
+				removed.insert(excluded.first);
+		}
+		for (std::string_view selector : excepted)
+		{
+			auto found = genericIndex.find(selector);
+			if (found != genericIndex.end())
+				removed.insert(found->second);
+		}
+
+		DomainSheet sheet;
+		sheet.domain = std::string(domain);
+		sheet.generic = genericChunks;
+		if (!removed.empty())
+		{
+			std::shared_ptr<Chunks> chunks = std::make_shared<Chunks>(*genericChunks);
+			for (size_t chunk = 0; chunk < chunks->size(); chunk++)
+			{
+				std::vector<const std::string *> kept;
+				const size_t first = chunk * chunkSelectors;
+				for (size_t selector = first; selector < std::min(first + chunkSelectors, genericSelectors.size()); selector++)
+				{
+					if (!removed.count(selector))
+						kept.push_back(genericSelectors[selector]);
+				}
+
+				if (kept.size() == std::min(chunkSelectors, genericSelectors.size() - first))
+					continue;
+
+				(*chunks)[chunk] = kept.empty() ? std::make_shared<const std::string>() : HideRule(kept);
+				counts.bytes += (*chunks)[chunk]->size();
+			}
+			counts.bytes += chunks->size() * sizeof(Chunks::value_type);
+			sheet.generic = chunks;
+		}
+
+		std::sort(specific.begin(), specific.end(), [](const std::string *a, const std::string *b) { return *a < *b; });
+		specific.erase(std::unique(specific.begin(), specific.end(), [](const std::string *a, const std::string *b) { return *a == *b; }), specific.end());
+		specific.erase(std::remove_if(specific.begin(), specific.end(), [&excepted](const std::string *selector) { return excepted.count(*selector) != 0; }), specific.end());
+		if (!specific.empty())
+		{
+			sheet.specific = HideRules(specific);
+			counts.bytes += sheet.specific->size();
+		}
+
+		// A hash collision leaves the second domain to the stylesheet of its parent
+		next->domains.emplace(HashFnv1aReverse(domain.data(), domain.size()), std::move(sheet));
+	}
+	counts.domains = next->domains.size();
+
+	stylesheets.Publish(std::move(next));
+	return counts;
+}
+
+std::unique_ptr<ContentScanner> ElementHiding::CreateScanner(const ContentScanner::Context &context) const
+{
+	std::shared_ptr<const Chunks> genericChunks;
+	std::shared_ptr<const std::string> specific;
+
+	{
+		auto sheets = stylesheets.Read();
+		genericChunks = sheets->generic;
+
+		// The longest suffix of the host with a stylesheet of its own
+		const std::string_view name = UriHost(context.uri);
+		NormalizedHost host;
+		if (!name.empty() && host.Normalize(name))
+		{
+			for (unsigned int label = 0; label < host.Labels(); label++)
+			{
+				auto found = sheets->domains.find(host.SuffixHash(label));
+				if (found != sheets->domains.end() && found->second.domain == host.Suffix(label))
+				{
+					genericChunks = found->second.generic;
+					specific = found->second.specific;
+					break;
+				}
+			}
+		}
+	}
+
+	if (!generic.load() || genericChunks->empty())
+		genericChunks.reset();
+	if (!genericChunks && !specific)
+		return nullptr;
+
+	return std::unique_ptr<ContentScanner>(new CosmeticScanner(std::move(genericChunks), std::move(specific)));
+}
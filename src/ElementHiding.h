@@ -0,0 +1,73 @@
+#ifndef ECAP_NBLOCK_ELEMENTHIDING_H
+#define ECAP_NBLOCK_ELEMENTHIDING_H
+
+#include "ContentScanner.h"
+#include "SnapshotPointer.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Element hiding filters of the Adblock lists (example.com##.banner, ##.ad-box and example.com#@#.ad-box exceptions),
+// applied by the "cosmetic" body scanner: it hides the elements with a stylesheet spliced into the <head> of HTML pages.
+//
+// Load() works out the stylesheet of every domain the filters name up front. A page then costs one lookup of the
+// longest suffix of its host that has a stylesheet (rules can only name suffixes of the host, so that suffix has all of
+// them) and the splice. Generic filters make up one stylesheet shared by every host, kept in chunks so a domain with
+// exceptions to a few generic filters only has the chunks holding those rebuilt.
+// Procedural filters (#?#, :has-text() and the like) and scriptlets are not supported and skipped.
+// Kept free of libecap so the offline tools can use it as well.
+class ElementHiding {
+public:
+	typedef std::vector<std::shared_ptr<const std::string>> Chunks; // CSS rules, spliced one after the other
+
+	struct Counts {
+		size_t rules = 0; // element hiding filters loaded
+		size_t skipped = 0; // filters that can not be expressed in CSS
+		size_t genericSelectors = 0;
+		size_t domains = 0; // domains with a stylesheet of their own
+		size_t bytes = 0; // memory held by all stylesheets
+	};
+
+	static ElementHiding& getInstance()
+	{
+		static ElementHiding instance;
+		return instance;
+	}
+
+	// One filter per line, as collected by ListReader::ReadAdblockRules(). Pages keep using the previous stylesheets
+	// until the new ones are complete.
+	Counts Load(const std::string &rules);
+
+	// cosmetic_generic, also inject the filters that apply to every host
+	void SetGeneric(bool enabled) { generic = enabled; }
+
+	// Factory of the "cosmetic" body scanner, nullptr if nothing is hidden on the host of the page
+	std::unique_ptr<ContentScanner> CreateScanner(const ContentScanner::Context &context) const;
+
+private:
+	struct DomainSheet {
+		std::string domain;
+		std::shared_ptr<const Chunks> generic; // the shared generic chunks, or a copy with some chunks rebuilt
+		std::shared_ptr<const std::string> specific;
+	};
+
+	struct Stylesheets {
+		std::shared_ptr<const Chunks> generic = std::make_shared<const Chunks>();
+		std::unordered_map<uint64_t, DomainSheet> domains; // keyed by HashFnv1aReverse() of the domain, see NormalizedHost
+	};
+
+	SnapshotPointer<Stylesheets> stylesheets;
+	std::atomic<bool> generic{true};
+
+	ElementHiding() {}
+
+	/* prohibited and not implemented */
+	ElementHiding(const ElementHiding&);
+	ElementHiding &operator=(const ElementHiding&);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef ECAP_NBLOCK_HASH_H
+#define ECAP_NBLOCK_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+static const uint64_t HashFnvOffset = 14695981039346656037ull;
+static const uint64_t HashFnvPrime = 1099511628211ull;
+
+// 64 bit FNV-1a, pass the result of a previous call as hash to continue hashing
+inline uint64_t HashFnv1a(const void *data, size_t size, uint64_t hash = HashFnvOffset)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * HashFnvPrime;
+	}
+	return hash;
+}
+
+// FNV-1a over the bytes from the last one to the first. Hashing a host name this way passes all of its suffixes
+// (com, example.com, ads.example.com), see NormalizedHost.
+inline uint64_t HashFnv1aReverse(const void *data, size_t size, uint64_t hash = HashFnvOffset)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = size; i > 0; i--)
+	{
+		hash = (hash ^ bytes[i - 1]) * HashFnvPrime;
+	}
+	return hash;
+}
+
+#endif
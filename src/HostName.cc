@@ -0,0 +1,114 @@
+#include "HostName.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline char LowerCase(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Copies host into name lowercased, up to the port separator, and records the start of every label.
+// Returns the length of the host without the port.
+size_t NormalizedHost::LowerAndFindDots(const char *host, size_t size)
+{
+	size_t i = 0;
+	labelCount = 1;
+	labelStart[0] = 0;
+
+#if defined(__SSE2__)
+	// 16 bytes at a time: most host names are done in one or two rounds, the rest is left to the scalar loop below.
+	// Bytes of 0x80 and up compare as negative and are left alone, just like LowerCase() does.
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i dot = _mm_set1_epi8('.');
+	const __m128i beforeA = _mm_set1_epi8('A' - 1);
+	const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+	const __m128i caseBit = _mm_set1_epi8('a' - 'A');
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m128i bytes = _mm_loadu_si128((const __m128i *)(host + i));
+		const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, beforeA), _mm_cmplt_epi8(bytes, afterZ));
+		_mm_storeu_si128((__m128i *)(name + i), _mm_or_si128(bytes, _mm_and_si128(upper, caseBit)));
+
+		unsigned int dots = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, dot));
+		const unsigned int colons = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, colon));
+		if (colons)
+			dots &= (colons & -colons) - 1; // only the dots in front of the port
+
+		for (; dots; dots &= dots - 1)
+			labelStart[labelCount++] = i + __builtin_ctz(dots) + 1;
+
+		if (colons)
+			return i + __builtin_ctz(colons);
+	}
+#endif
+
+	for (; i < size; i++)
+	{
+		const char c = host[i];
+		if (c == ':')
+			return i;
+		if (c == '.')
+			labelStart[labelCount++] = i + 1;
+		name[i] = LowerCase(c);
+	}
+
+	return size;
+}
+
+bool NormalizedHost::Normalize(std::string_view host)
+{
+	// Scanning one byte past maxLength is enough to tell whether the host fits
+	length = LowerAndFindDots(host.data(), std::min(host.size(), maxLength + 1));
+	if (length > maxLength)
+	{
+		length = 0;
+		labelCount = 0;
+		return false;
+	}
+
+	// FNV is sequential, so this part stays scalar: a single walk from the right that takes the hash at every label start
+	uint64_t hash = HashFnvOffset;
+	size_t end = length;
+	for (unsigned int label = labelCount; label-- > 0;)
+	{
+		hash = HashFnv1aReverse(name + labelStart[label], end - labelStart[label], hash);
+		suffixHash[label] = hash;
+		end = labelStart[label];
+	}
+
+	return true;
+}
+
+std::string_view UriHost(std::string_view uri)
+{
+	size_t hostStart = uri.find("://");
+	if (hostStart == std::string_view::npos)
+		return std::string_view();
+
+	hostStart += 3;
+	std::string_view authority = uri.substr(hostStart, uri.find_first_of("/?#", hostStart) - hostStart);
+	if (authority.find('@') != std::string_view::npos)
+		return std::string_view();
+
+	return authority.substr(0, authority.find(':'));
+}
+
+// Get hostname (or so called domain according to ad-block..) from referer
+// Ad-block client uses this to determine if it's dealing with a 3rd party request.
+std::string_view ReferringHost(std::string_view requestReferer)
+{
+	if (requestReferer.empty())
+		return std::string_view();
+
+	size_t posStart = requestReferer.find_first_of(":/", 4);
+	if (posStart == std::string_view::npos || posStart + 3 > requestReferer.size())
+		return std::string_view();
+
+	size_t posEnd = requestReferer.find_first_of('/', posStart + 6);
+	return requestReferer.substr(posStart + 3, posEnd == std::string_view::npos ? posEnd : posEnd - posStart - 3);
+}
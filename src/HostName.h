@@ -0,0 +1,48 @@
+#ifndef ECAP_NBLOCK_HOSTNAME_H
+#define ECAP_NBLOCK_HOSTNAME_H
+
+#include "Hash.h"
+
+#include <stdint.h>
+#include <string_view>
+
+// A host header value prepared for the hostname / domain lookups in a single pass: lowercased, port stripped, with the
+// start of every label and the hash of every suffix (ads.example.com, example.com, com).
+// The suffix hashes are HashFnv1aReverse() of the suffix, so anything keyed on that hash (DecisionCache, the trie
+// prefilter) can be probed without hashing the host again.
+// Kept free of libecap so the offline tools can use it as well.
+class NormalizedHost {
+public:
+	static const size_t maxLength = 255; // DNS names are at most 253 characters
+	static const unsigned int maxLabels = maxLength + 2; // the scan looks at one byte more, every byte could be a dot
+
+	// Returns false if host (without the port) does not fit maxLength, such a host can not be in any list
+	bool Normalize(std::string_view host);
+
+	std::string_view Name() const { return std::string_view(name, length); }
+	size_t Length() const { return length; }
+
+	// Labels are numbered from left to right, label 0 is the leftmost one
+	unsigned int Labels() const { return labelCount; }
+	size_t LabelStart(unsigned int label) const { return labelStart[label]; }
+	std::string_view Suffix(unsigned int label) const { return std::string_view(name + labelStart[label], length - labelStart[label]); }
+	uint64_t SuffixHash(unsigned int label) const { return suffixHash[label]; }
+	uint64_t Hash() const { return suffixHash[0]; } // of the whole name
+
+private:
+	char name[maxLength + 1];
+	size_t length;
+	unsigned int labelCount;
+	uint16_t labelStart[maxLabels];
+	uint64_t suffixHash[maxLabels];
+
+	size_t LowerAndFindDots(const char *host, size_t size);
+};
+
+// Host of an absolute uri without the port, empty when there is none or it is preceded by user info
+std::string_view UriHost(std::string_view uri);
+
+// Host of a Referer header value as AdBlockClient expects it for third party checks, may include the port
+std::string_view ReferringHost(std::string_view requestReferer);
+
+#endif
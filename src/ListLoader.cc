@@ -0,0 +1,215 @@
+#include "ListLoader.h"
+#include "Debugger.h"
+#include "DomainTrie.h"
+#include "ElementHiding.h"
+#include "ListReader.h"
+#include "NetFilterAdblock.h"
+#include "NetFilterDns.h"
+#include "RuleOptimizer.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+
+namespace {
+
+struct ParsedList {
+	enum Type { plHostnames, plDomains, plAdblock };
+
+	Type type;
+	std::string fileName;
+	std::vector<std::string> entries; // hostnames or domains
+	std::string rules; // adblock filters, one per line
+	std::string elementRules; // adblock element hiding filters, one per line
+	size_t count = 0;
+	long milliseconds = 0;
+	bool loaded = false;
+};
+
+void ParseList(ParsedList &list)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	switch (list.type)
+	{
+		case ParsedList::plHostnames:
+			list.loaded = ListReader::ReadHostnames(list.fileName, list.entries);
+			list.count = list.entries.size();
+			break;
+		case ParsedList::plDomains:
+			list.loaded = ListReader::ReadDomains(list.fileName, list.entries);
+			list.count = list.entries.size();
+			break;
+		case ParsedList::plAdblock:
+			list.loaded = ListReader::ReadAdblockRules(list.fileName, list.rules, &list.elementRules);
+			list.count = std::count(list.rules.begin(), list.rules.end(), '\n') + std::count(list.elementRules.begin(), list.elementRules.end(), '\n');
+			break;
+	}
+
+	list.milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void BuildBlockList(std::vector<ParsedList> &lists)
+{
+	std::unique_ptr<DomainTrie> blockList(new DomainTrie());
+
+	for (ParsedList &list : lists)
+	{
+		if (list.type == ParsedList::plAdblock)
+			continue;
+
+		const unsigned char flags = (list.type == ParsedList::plHostnames) ? DomainTrie::tfHostname : DomainTrie::tfDomain;
+		for (const std::string &entry : list.entries)
+		{
+			blockList->Insert(entry, flags); // the trie drops duplicates
+		}
+		std::vector<std::string>().swap(list.entries);
+	}
+
+	blockList->Build();
+	NetFilterDns::getInstance().LoadBlockList(std::move(blockList));
+}
+
+void LoadElementHiding(const std::string &elementRules)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	const ElementHiding::Counts counts = ElementHiding::getInstance().Load(elementRules);
+
+	Debugger(ilNormal | flApplication) << "[nBlock] Built element hiding stylesheets in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count()
+		<< " ms: " << counts.rules << " filters (" << counts.skipped << " skipped, not plain CSS), " << counts.genericSelectors << " generic selectors, "
+		<< counts.domains << " domains, " << counts.bytes / 1024 << " KiB";
+}
+
+void BuildAdblockList(std::vector<ParsedList> &lists, bool optimize)
+{
+	std::string rules, elementRules;
+	for (ParsedList &list : lists)
+	{
+		if (list.type != ParsedList::plAdblock)
+			continue;
+
+		rules += list.rules;
+		elementRules += list.elementRules;
+		std::string().swap(list.rules);
+		std::string().swap(list.elementRules);
+	}
+
+	// Only the response service makes use of these, but they come from the same lists
+	LoadElementHiding(elementRules);
+	std::string().swap(elementRules);
+
+	auto startTime = std::chrono::steady_clock::now();
+	RuleOptimizer::Result result;
+	if (optimize)
+	{
+		{
+			// Runs against whatever hostname / domain index is live, Load() publishes the new one before getting here
+			auto blockList = NetFilterDns::getInstance().ReadBlockList();
+			rules = RuleOptimizer::Optimize(rules, blockList.get(), result);
+		}
+
+		Debugger(ilNormal | flApplication) << "[nBlock] Optimized Adblock lists in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count()
+			<< " ms: " << result.inputRules << " -> " << result.outputRules << " filters (" << result.duplicates << " duplicate, " << result.dnsCovered << " covered by the DNS lists, "
+			<< result.subsumed << " covered by a broader filter), " << (result.inputBytes - result.outputBytes) / 1024 << " KiB less to parse";
+	}
+	else
+	{
+		rules = RuleOptimizer::Deduplicate(rules, result);
+		Debugger(ilNormal | flApplication) << "[nBlock] Merged Adblock lists, skipped " << result.duplicates << " duplicate filters";
+	}
+
+	NetFilterAdblock::getInstance().LoadAdblockRules(rules);
+}
+
+} // namespace
+
+bool ListLoader::Load(const ListSet &lists, std::string &error)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	// Nothing is published before every list has been read, a list that cannot be read leaves the live lists alone
+	std::shared_ptr<BlocklistImage> image;
+	if (!lists.compiled.empty())
+	{
+		image.reset(new BlocklistImage());
+		if (!image->Open(lists.compiled, error))
+			return false;
+	}
+
+	std::vector<ParsedList> parsed;
+	for (const std::string &fileName : lists.hostnames)
+	{
+		parsed.push_back(ParsedList());
+		parsed.back().type = ParsedList::plHostnames;
+		parsed.back().fileName = fileName;
+	}
+	for (const std::string &fileName : lists.domains)
+	{
+		parsed.push_back(ParsedList());
+		parsed.back().type = ParsedList::plDomains;
+		parsed.back().fileName = fileName;
+	}
+	for (const std::string &fileName : lists.adblock)
+	{
+		parsed.push_back(ParsedList());
+		parsed.back().type = ParsedList::plAdblock;
+		parsed.back().fileName = fileName;
+	}
+
+	unsigned int threads = 0;
+	if (!parsed.empty())
+	{
+		const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+		WorkerPool pool(std::min<size_t>(cores, parsed.size()));
+		threads = pool.Size();
+
+		for (ParsedList &list : parsed)
+		{
+			pool.Submit([&list] { ParseList(list); });
+		}
+		pool.Wait();
+	}
+
+	for (const ParsedList &list : parsed)
+	{
+		if (!list.loaded)
+		{
+			error = "Unable to read blocklist " + list.fileName;
+			return false;
+		}
+	}
+
+	if (image)
+	{
+		NetFilterDns::getInstance().LoadImage(image);
+		NetFilterAdblock::getInstance().LoadImage(image);
+
+		size_t size = 0;
+		uint64_t entries = 0;
+		const char *elementRules = image->Find(BlocklistImage::stElementHiding, size, entries);
+		LoadElementHiding(elementRules ? std::string(elementRules, size) : std::string());
+	}
+
+	if (parsed.empty())
+		return true;
+
+	for (const ParsedList &list : parsed)
+	{
+		Debugger(ilNormal | flApplication) << "[nBlock] Read " << list.count << " entries from " << list.fileName << " in " << list.milliseconds << " ms";
+	}
+
+	// Text lists replace whatever the compiled image provided for the same list type.
+	// The optimizer drops Adblock filters the hostname / domain index already covers, so that index goes live first
+	if (!lists.hostnames.empty() || !lists.domains.empty())
+		BuildBlockList(parsed);
+	if (!lists.adblock.empty())
+		BuildAdblockList(parsed, lists.optimize);
+
+	Debugger(ilNormal | flApplication) << "[nBlock] Loaded " << parsed.size() << " blocklists on " << threads << " threads in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count() << " ms";
+
+	return true;
+}
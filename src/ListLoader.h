@@ -0,0 +1,25 @@
+#ifndef ECAP_NBLOCK_LISTLOADER_H
+#define ECAP_NBLOCK_LISTLOADER_H
+
+#include <string>
+#include <vector>
+
+// Loads all configured blocklists: every text list is parsed concurrently on a worker pool, then the lists of each type
+// are merged (without duplicates) into one index and handed to NetFilterDns / NetFilterAdblock.
+class ListLoader {
+public:
+	struct ListSet {
+		std::vector<std::string> hostnames; // list_hostnames, list_hostnames.*
+		std::vector<std::string> domains; // list_domains, list_domains.*
+		std::vector<std::string> adblock; // list_adblockplus, list_adblockplus.*
+		std::string compiled; // list_compiled
+		bool optimize = true; // list_optimize, run the Adblock filters through RuleOptimizer
+
+		bool empty() const { return hostnames.empty() && domains.empty() && adblock.empty() && compiled.empty(); }
+		void clear() { *this = ListSet(); }
+	};
+
+	static bool Load(const ListSet &lists, std::string &error);
+};
+
+#endif
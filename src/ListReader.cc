@@ -0,0 +1,96 @@
+#include "ListReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// Host names are matched in lowercase, see NormalizedHost
+static std::string LowerCase(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; });
+	return name;
+}
+
+bool ListReader::ReadHostnames(const std::string &fileName, std::vector<std::string> &hostnames)
+{
+	std::ifstream HostnameBlockListFile(fileName);
+	if (!HostnameBlockListFile)
+		return false;
+
+	for (std::string line; std::getline(HostnameBlockListFile, line);)
+	{
+		if (strncmp(line.c_str(), "0.0.0.0 ", 8) == 0) // strncmp returns 0 on match
+		{
+			hostnames.push_back(LowerCase(line.substr(8, line.size() - 8)));
+		}
+	}
+
+	return true;
+}
+
+// TODO: should make a hostname importer out of this function: out of scope for first proto type.
+bool ListReader::ReadDomains(const std::string &fileName, std::vector<std::string> &domains)
+{
+	std::ifstream DomainBlockListFile(fileName);
+	if (!DomainBlockListFile)
+		return false;
+
+	for (std::string line; std::getline(DomainBlockListFile, line);)
+	{
+		if (strncmp(line.c_str(), "address=/", 9) == 0) // strncmp returns 0 on match
+		{
+			domains.push_back(LowerCase(line.substr(9, line.size() - (9 + 8))));
+		}
+	}
+
+	return true;
+}
+
+bool ListReader::ReadBypass(const std::string &fileName, std::vector<std::string> &hostnames, std::vector<std::string> &domains)
+{
+	std::ifstream bypassFile(fileName);
+	if (!bypassFile)
+		return false;
+
+	for (std::string line; std::getline(bypassFile, line);)
+	{
+		const size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line[start] == '#')
+			continue;
+		std::string name = LowerCase(line.substr(start, line.find_first_of(" \t\r", start) - start));
+
+		if (name.compare(0, 2, "*.") == 0)
+			domains.push_back(name.substr(2));
+		else if (name[0] == '.')
+			domains.push_back(name.substr(1));
+		else
+			hostnames.push_back(name);
+	}
+
+	return true;
+}
+
+bool ListReader::ReadAdblockRules(const std::string &fileName, std::string &rules, std::string *elementRules)
+{
+	std::ifstream adBlockListFile(fileName);
+	if (!adBlockListFile)
+		return false;
+
+	for (std::string line; std::getline(adBlockListFile, line);)
+	{
+		// Do not add any cosmetic filters here since we cannot do anything with them in the REQMOD
+		if (line.find_first_of('#') == std::string::npos)
+		{
+			// TODO: should also check for conditional filters like iframes etc
+			// Filters already covered by NetFilterDns are removed later on by RuleOptimizer
+			rules += line + "\n"; // Newlines are stripped by getline(), these are required for the list parser to work
+		}
+		else if (elementRules && line[0] != '!' && line[0] != '[')
+		{
+			// Kept for the response side, see ElementHiding
+			*elementRules += line + "\n";
+		}
+	}
+
+	return true;
+}
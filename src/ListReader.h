@@ -0,0 +1,25 @@
+#ifndef ECAP_NBLOCK_LISTREADER_H
+#define ECAP_NBLOCK_LISTREADER_H
+
+#include <string>
+#include <vector>
+
+// Parsers for the supported text list formats. Kept free of libecap so the offline tools can use them as well.
+class ListReader {
+public:
+	// hosts file format: "0.0.0.0 host.com"
+	static bool ReadHostnames(const std::string &fileName, std::vector<std::string> &hostnames);
+
+	// dnsmasq format: "address=/host.com/0.0.0.0"
+	static bool ReadDomains(const std::string &fileName, std::vector<std::string> &domains);
+
+	// One name per line (list_bypass): "intranet.example.com" for the host alone, "*.example.com" or ".example.com" for
+	// the domain and all of its sub domains. Lines starting with # are comments.
+	static bool ReadBypass(const std::string &fileName, std::vector<std::string> &hostnames, std::vector<std::string> &domains);
+
+	// Adblock Plus format, appends the network filters (one per line) to rules and, when given, the element hiding
+	// filters (example.com##.banner) to elementRules
+	static bool ReadAdblockRules(const std::string &fileName, std::string &rules, std::string *elementRules = nullptr);
+};
+
+#endif
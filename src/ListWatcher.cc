@@ -0,0 +1,189 @@
+#include "ListWatcher.h"
+#include "Debugger.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// List updates usually arrive as a burst of writes (or a download followed by a rename), wait for things to settle
+static const int settleMilliseconds = 1000;
+
+static std::string DirectoryOf(const std::string &fileName)
+{
+	size_t slashPos = fileName.find_last_of('/');
+	if (slashPos == std::string::npos)
+		return ".";
+	if (slashPos == 0)
+		return "/";
+	return fileName.substr(0, slashPos);
+}
+
+ListWatcher::ListWatcher():
+	stopFd(-1)
+{
+}
+
+ListWatcher::~ListWatcher()
+{
+	Stop();
+}
+
+void ListWatcher::Start(const ListLoader::ListSet &aLists)
+{
+	Stop();
+
+	if (aLists.empty())
+		return;
+
+	stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (stopFd < 0)
+	{
+		Debugger(ilCritical | flApplication) << "[nBlock] Unable to start the list watcher: " << strerror(errno);
+		return;
+	}
+
+	lists = aLists;
+	watcherThread = std::thread(&ListWatcher::Run, this);
+}
+
+void ListWatcher::Stop()
+{
+	if (watcherThread.joinable())
+	{
+		uint64_t wakeUp = 1;
+		if (write(stopFd, &wakeUp, sizeof(wakeUp)) != sizeof(wakeUp))
+			Debugger(ilCritical | flApplication) << "[nBlock] Unable to signal the list watcher: " << strerror(errno);
+		watcherThread.join();
+	}
+
+	if (stopFd >= 0)
+	{
+		close(stopFd);
+		stopFd = -1;
+	}
+}
+
+unsigned int ListWatcher::GroupsOf(const std::string &fileName) const
+{
+	unsigned int groups = lgNone;
+
+	for (const std::string &listName : lists.hostnames)
+		if (listName == fileName) groups |= lgDns;
+	for (const std::string &listName : lists.domains)
+		if (listName == fileName) groups |= lgDns;
+	for (const std::string &listName : lists.adblock)
+		if (listName == fileName) groups |= lgAdblock;
+	if (lists.compiled == fileName)
+		groups |= lgCompiled;
+
+	return groups;
+}
+
+void ListWatcher::Reload(unsigned int groups)
+{
+	// A new image replaces every list type it holds, text lists configured next to it have to be re-applied on top
+	if (groups & lgCompiled)
+		groups |= lgDns | lgAdblock;
+
+	// The optimizer dropped Adblock filters based on the previous DNS lists, those may be needed again now
+	if ((groups & lgDns) && lists.optimize)
+		groups |= lgAdblock;
+
+	ListLoader::ListSet changed;
+	changed.optimize = lists.optimize;
+	if (groups & lgCompiled)
+		changed.compiled = lists.compiled;
+	if (groups & lgDns)
+	{
+		changed.hostnames = lists.hostnames;
+		changed.domains = lists.domains;
+	}
+	if (groups & lgAdblock)
+		changed.adblock = lists.adblock;
+
+	Debugger(ilNormal | flApplication) << "[nBlock] Blocklist change detected, reloading in the background";
+
+	std::string error;
+	if (!ListLoader::Load(changed, error))
+		Debugger(ilCritical | flApplication) << "[nBlock] Blocklist reload failed, keeping the current lists: " << error;
+}
+
+void ListWatcher::Run()
+{
+	int inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (inotifyFd < 0)
+	{
+		Debugger(ilCritical | flApplication) << "[nBlock] Unable to watch the blocklists: " << strerror(errno);
+		return;
+	}
+
+	// Watch the directories rather than the files: lists are commonly replaced with a rename, which a file watch misses
+	std::map<int, std::string> watchedDirectories;
+	std::vector<std::string> fileNames(lists.hostnames);
+	fileNames.insert(fileNames.end(), lists.domains.begin(), lists.domains.end());
+	fileNames.insert(fileNames.end(), lists.adblock.begin(), lists.adblock.end());
+	if (!lists.compiled.empty())
+		fileNames.push_back(lists.compiled);
+
+	for (const std::string &fileName : fileNames)
+	{
+		const std::string directory = DirectoryOf(fileName);
+		int watch = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watch < 0)
+			Debugger(ilCritical | flApplication) << "[nBlock] Unable to watch " << directory << ": " << strerror(errno);
+		else
+			watchedDirectories[watch] = directory;
+	}
+
+	unsigned int pendingGroups = lgNone;
+	alignas(struct inotify_event) char events[sizeof(struct inotify_event) + NAME_MAX + 1];
+
+	while (true)
+	{
+		struct pollfd fds[2] = {{stopFd, POLLIN, 0}, {inotifyFd, POLLIN, 0}};
+		int ready = poll(fds, 2, pendingGroups ? settleMilliseconds : -1);
+
+		if (ready < 0 && errno != EINTR)
+			break;
+
+		if (fds[0].revents & POLLIN)
+			break;
+
+		if (ready == 0)
+		{
+			// Quiet for a while after the last change, reload now
+			Reload(pendingGroups);
+			pendingGroups = lgNone;
+			continue;
+		}
+
+		if (!(fds[1].revents & POLLIN))
+			continue;
+
+		for (ssize_t length = read(inotifyFd, events, sizeof(events)); length > 0; length = read(inotifyFd, events, sizeof(events)))
+		{
+			for (char *position = events; position < events + length;)
+			{
+				const struct inotify_event *event = (const struct inotify_event *)position;
+				position += sizeof(struct inotify_event) + event->len;
+
+				auto directory = watchedDirectories.find(event->wd);
+				if (directory == watchedDirectories.end() || event->len == 0)
+					continue;
+
+				std::string fileName = event->name;
+				if (directory->second != ".")
+					fileName = (directory->second == "/" ? "" : directory->second) + "/" + fileName;
+				pendingGroups |= GroupsOf(fileName);
+			}
+		}
+	}
+
+	close(inotifyFd);
+}
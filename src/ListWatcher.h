@@ -0,0 +1,41 @@
+#ifndef ECAP_NBLOCK_LISTWATCHER_H
+#define ECAP_NBLOCK_LISTWATCHER_H
+
+#include "ListLoader.h"
+
+#include <thread>
+
+// Background thread that watches the configured list files with inotify and reloads the lists of a filter when any
+// of its files is rewritten or replaced. Reloads run on the watcher thread and swap in the new indexes atomically.
+class ListWatcher {
+public:
+	ListWatcher();
+	~ListWatcher();
+
+	void Start(const ListLoader::ListSet &aLists); // restarts the watcher if it is already running
+	void Stop();
+	bool Running() const { return watcherThread.joinable(); }
+
+private:
+	// Changes to any file of a group reload the whole group, the lists of a filter are merged into one index
+	enum ListGroup {
+		lgNone = 0,
+		lgDns = 1, // list_hostnames, list_domains
+		lgAdblock = 2, // list_adblockplus
+		lgCompiled = 4 // list_compiled
+	};
+
+	ListLoader::ListSet lists;
+	std::thread watcherThread;
+	int stopFd; // eventfd used to wake up the watcher thread when stopping
+
+	void Run();
+	unsigned int GroupsOf(const std::string &fileName) const;
+	void Reload(unsigned int groups);
+
+	/* prohibited and not implemented */
+	ListWatcher(const ListWatcher&);
+	ListWatcher &operator=(const ListWatcher&);
+};
+
+#endif
@@ -1,4 +1,8 @@
 #include "NetFilterAdblock.h"
+#include "AreaView.h"
+#include "HostName.h"
+#include "RequestClassifier.h"
+#include "Stats.h"
 
 #include <libecap/common/name.h>
 #include <libecap/common/area.h>
@@ -9,74 +13,149 @@
 #include <iterator>
 #include <algorithm>
 #include <chrono>
+#include <charconv>
+
+static void LogCanonicalizer(const UriCanonicalizer &canonicalizer)
+{
+	if (canonicalizer.Enabled())
+		Debugger(ilNormal | flApplication) << "[nBlock] Query string tokens no filter looks at are left out of cache keys (" << canonicalizer.FilterTokens() << " filter tokens)";
+	else if (canonicalizer.RegexFilters() > 0)
+		Debugger(ilNormal | flApplication) << "[nBlock] Cache keys keep the full uri, " << canonicalizer.RegexFilters() << " regex filters are loaded";
+}
+
+static void LogHostIndex(const AdblockHostIndex &hosts)
+{
+	if (hosts.Enabled())
+		Debugger(ilNormal | flApplication) << "[nBlock] " << hosts.HostFilters() << " filters block whole hosts, their verdicts are cached per host";
+	else if (hosts.UnrestrictedExceptions() > 0)
+		Debugger(ilNormal | flApplication) << "[nBlock] No verdicts are cached per host, " << hosts.UnrestrictedExceptions() << " exception filters may apply to any host";
+}
+
+static std::unique_ptr<AdblockMatcher> BuildMatcher(const std::string &rules)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	std::unique_ptr<AdblockMatcher> matcher(new AdblockMatcher());
+	matcher->Build(rules);
+
+	Debugger(ilNormal | flApplication) << "[nBlock] Built the native Adblock matcher in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count()
+		<< " ms: " << matcher->Filters() << " filters (" << matcher->ExceptionFilters() << " exceptions, " << matcher->RegexFilters() << " regex, "
+		<< matcher->UnkeyedFilters() << " checked on every request, " << matcher->IgnoredFilters() << " unsupported), " << matcher->States() << " states, "
+		<< matcher->MemoryUsage() / 1024 << " KiB";
+	return matcher;
+}
 
 // TODO: Filter out all netblock rules, ignore cosmetic filters completely.
-// TODO: Optimize list, remove duped entries that are already present in the DNS block lists, since that trumps all.
-bool NetFilterAdblock::LoadAdblockList(std::string fileName)
+bool NetFilterAdblock::LoadAdblockRules(const std::string &rules)
 {
-	RequestCacheWhiteList.clear();
-	RequestCacheBlackList.clear();
+	// Parse into a new client off to the side, requests keep matching against the current one until it is swapped in
+	const bool native = nativeMatcher.load();
+	std::unique_ptr<AdblockSnapshot> snapshot(new AdblockSnapshot());
+	if (native)
+		snapshot->matcher = BuildMatcher(rules);
+	else
+		snapshot->client.parse(rules.c_str());
+	snapshot->canonicalizer.Build(rules);
+	snapshot->hosts.Build(rules, native);
 	
-	std::ifstream adBlockListFile(fileName);
-	std::string rules;
+	if (!native)
+		Debugger(ilNormal | flApplication) << "[nBlock] Loaded " << snapshot->client.numFilters << " filters in the Adblock parser";
+	LogCanonicalizer(snapshot->canonicalizer);
+	LogHostIndex(snapshot->hosts);
+
+	// Publish() returns once no request can still be matching against the previous client
+	AdBlockNetfilterClient.Publish(std::move(snapshot));
+	DecisionCache::getInstance().Clear(DecisionCache::cdRequest);
 	
-	for (std::string line; std::getline(adBlockListFile, line);)
+	return true;
+}
+
+bool NetFilterAdblock::LoadImage(const std::shared_ptr<BlocklistImage> &image)
+{
+	size_t size = 0;
+	uint64_t entries = 0;
+	char *data = image->Find(BlocklistImage::stAdblock, size, entries);
+
+	if (!data)
 	{
-		// Do not add any cosmetic filters here since we cannot do anything with them in the REQMOD
-		if (line.find_first_of('#') == std::string::npos)
+		Debugger(ilNormal | flApplication) << "[nBlock] " << image->FileName() << " holds no Adblock filters";
+		return false;
+	}
+
+	// The native matcher is built from the filter text, images written before that section existed only work with the parser
+	bool native = nativeMatcher.load();
+	const char *rules = native ? image->Find(BlocklistImage::stAdblockRules, size, entries) : nullptr;
+	if (native && !rules)
+	{
+		Debugger(ilCritical | flApplication) << "[nBlock] " << image->FileName() << " holds no Adblock filter text, matching with the Adblock parser instead";
+		native = false;
+	}
+
+	std::unique_ptr<AdblockSnapshot> snapshot(new AdblockSnapshot());
+	if (native)
+	{
+		snapshot->matcher = BuildMatcher(std::string(rules, size));
+	}
+	else
+	{
+		// The deserialized filters point into the image, the snapshot keeps it mapped for as long as it is in use
+		snapshot->image = image;
+		if (!snapshot->client.deserialize(data))
 		{
-			// TODO: should also check for conditional filters like iframes etc
-			// TODO: Remove filters that are already covered by NetFilterDns
-			rules += line + "\n"; // Newlines are stripped by getline(), these are required for the list parser to work
+			Debugger(ilCritical | flApplication) << "[nBlock] " << image->FileName() << " holds corrupt Adblock filters";
+			return false;
 		}
+
+		Debugger(ilNormal | flApplication) << "[nBlock] Mapped " << snapshot->client.numFilters << " filters from " << image->FileName();
 	}
-	adBlockListFile.close();
-	AdBlockNetfilterClient.parse(rules.c_str());
-	
-	Debugger(ilNormal | flApplication) << "[nBlock] Loaded " << AdBlockNetfilterClient.numFilters << " filters in the Adblock parser";
-	
-	return true;
-}
 
-void NetFilterAdblock::PushCache(std::unordered_set<std::string> &cacheSet, std::string newValue)
-{
-	mutexCache.lock();
-	
-	if (cacheSet.size() > localCacheSize)
-		cacheSet.erase(cacheSet.begin());
+	// Images written before the section existed keep the full uri in the cache keys
+	const char *tokenData = image->Find(BlocklistImage::stUriTokens, size, entries);
+	if (tokenData && !snapshot->canonicalizer.Deserialize(tokenData, size))
+	{
+		Debugger(ilCritical | flApplication) << "[nBlock] " << image->FileName() << " holds corrupt uri tokens, ignoring them";
+		snapshot->canonicalizer = UriCanonicalizer();
+	}
+	LogCanonicalizer(snapshot->canonicalizer);
 
-	cacheSet.insert(newValue);
-	
-	mutexCache.unlock();
+	// The host filters are stored as text, they are few enough to be parsed again here
+	const char *hostRules = image->Find(BlocklistImage::stAdblockHosts, size, entries);
+	if (hostRules)
+		snapshot->hosts.Build(std::string(hostRules, size), native);
+	LogHostIndex(snapshot->hosts);
+
+	AdBlockNetfilterClient.Publish(std::move(snapshot));
+	DecisionCache::getInstance().Clear(DecisionCache::cdRequest);
+
+	return true;
 }
 
-bool NetFilterAdblock::IsCached(std::unordered_set<std::string> &cacheSet, std::string uniqueRequestIdentifier)
+void NetFilterAdblock::SetCanonicalKeys(bool enabled)
 {
-	mutexCache.lock();
-	
-	if (cacheSet.find(uniqueRequestIdentifier) != cacheSet.end())
-	{
-		mutexCache.unlock();
-		return true;
-	}	
-	
-	mutexCache.unlock();
-	return false;
+	// Keys of both kinds would otherwise live next to each other in the cache
+	if (canonicalKeys.exchange(enabled) != enabled)
+		DecisionCache::getInstance().Clear(DecisionCache::cdRequest);
 }
 
-bool NetFilterAdblock::IsBlackListed(std::string requestedUri, const libecap::Header &header)
+bool NetFilterAdblock::IsBlackListed(std::string_view requestedUri, const libecap::Header &header)
 {
-	// Extract some header info from the virgin request.
+	// Extract some header info from the virgin request, the Areas keep the header values alive while they are viewed
 	static const libecap::Name headerAccept("Accept");
 	static const libecap::Name headerXRequest("X-Requested-With");
 	static const libecap::Name headerContentType("Content-Type");
 	static const libecap::Name headerReferer("Referer");
 	
-	std::string requestAccept = header.value(headerAccept).toString();
-	std::string requestXRequest = header.value(headerXRequest).toString();
-	std::string requestContentType = header.value(headerContentType).toString();
-	std::string requestReferer = header.value(headerReferer).toString();
-	
+	const libecap::Area requestAccept = header.value(headerAccept);
+	const libecap::Area requestXRequest = header.value(headerXRequest);
+	const libecap::Area requestContentType = header.value(headerContentType);
+	const libecap::Area requestReferer = header.value(headerReferer);
+
+	return IsBlackListed(requestedUri, AreaView(requestAccept), AreaView(requestXRequest), AreaView(requestContentType), AreaView(requestReferer));
+}
+
+// Does not touch any libecap object, so it can also run off the main thread (async_workers)
+bool NetFilterAdblock::IsBlackListed(std::string_view requestedUri, std::string_view requestAccept, std::string_view requestXRequest,
+	std::string_view requestContentType, std::string_view requestReferer)
+{
 	FilterOption options = FONoFilterOption;
 	
 	// Try to detect the correct request type, this is somewhat limited compared to browser-based ad-blockers, because we do not
@@ -112,36 +191,12 @@ bool NetFilterAdblock::IsBlackListed(std::string requestedUri, const libecap::He
 	// Scripts, images and CSS are detected only based if there is a 'file extension' in the requested uri, eg http://host.com/script.js
 	// This could also be determined by a server response header 'Content-Type', but we do not want to send out a request at all.
 	// Only other possibility is to examine the main documents html code and scrap <script> tags, though they could also be manipulated by javascript.
+	// The extension to type mapping is table driven and can be extended with the ext_* configuration options, see RequestClassifier.
 	// TODO: These checks are tested only with Firefox / Internet Explorer, other browsers might behave slightly differently.
-	
-	if (std::regex_search(requestedUri, std::regex("\\.(js|json)")))
-	{
-		options = (FilterOption)(options | FOScript);
-	}
-	
-	else if (std::regex_search(requestedUri, std::regex("\\.(jpeg|jpg|gif|png|bmp|svg)")))
-	{
-		options = (FilterOption)(options | FOImage);
-	}
-	
-	// When a browser requests a CSS source, it will actually set the 'Accept' header, allowing us to get a better prediction for this file type.
-	else if (std::regex_search(requestedUri, std::regex("\\.(css)")) || std::regex_search(requestAccept, std::regex("text/css")))
-	{
-		options = (FilterOption)(options | FOStylesheet);
-	}
-
-	// FOXmlHttpRequest can be detected using 2 methods:
-	// - 'X-Requested-With' request header is set to: "XMLHttpRequest"
-	// - POST requests made by javascript will set the ContentType to x-www-form-urlencoded, while regular POST requests do not.
-	if (requestXRequest == "XMLHttpRequest" || requestContentType == "application/x-www-form-urlencoded")
-	{
-		options = (FilterOption)(options | FOXmlHttpRequest);
-	}
-	
-	if (requestReferer == "" && std::regex_search(requestAccept, std::regex("text/html")))
-	{
-		options = (FilterOption)(options | FODocument);
-	}
+	Stats &stats = Stats::getInstance();
+	uint64_t stageStart = Stats::Now();
+	options = RequestClassifier::getInstance().Classify(requestedUri, requestAccept, requestXRequest, requestContentType, requestReferer);
+	stats.Record(Stats::stClassify, stageStart);
 
 	/*
 	// For debugging, display the content types for each request
@@ -169,43 +224,147 @@ bool NetFilterAdblock::IsBlackListed(std::string requestedUri, const libecap::He
 	*/
 	
 	// Get the domain / hostname of the referring url.
-	std::string referringHost = "";
-	if (requestReferer != "")
-	{
-		// Get hostname (or so called domain according to ad-block..) from referer
-		// Ad-block client uses this to determine if it's dealing with a 3rd party request.
-		int posStart = requestReferer.find_first_of(":/", 4);
-		int posEnd = requestReferer.find_first_of("/", posStart+6);
-		referringHost = requestReferer.substr(posStart+3, posEnd - posStart - 3);
-	}
+	std::string_view referringHost = ReferringHost(requestReferer);
 	
 	//Debugger(ilNormal | flApplication) << "Execution Time premodding AdblockFilter: " << (std::chrono::high_resolution_clock::now() - startTime).count() << "us";
 
-	// Generate a request unique string with all parameters that are of influence to the ad-block lib for local caching
-	std::string uniqueIdentifier = requestedUri + std::to_string(options) + referringHost;
-	
-	// First check our local host whitelist cache for previous checked entries
-	if (IsCached(RequestCacheWhiteList, uniqueIdentifier))
+	// Generate a request unique string with all parameters that are of influence to the ad-block lib for local caching.
+	// The buffer is reused by every request on this thread, it only allocates while it grows to the longest key seen.
+	thread_local std::string uniqueIdentifier;
+	char optionDigits[16];
+	const size_t optionLength = std::to_chars(optionDigits, optionDigits + sizeof(optionDigits), (int)options).ptr - optionDigits;
+
+	// The key depends on the filters, so the snapshot is pinned before it is built and stays pinned until the verdict is cached
+	auto snapshot = AdBlockNetfilterClient.Read();
+	DecisionCache &cache = DecisionCache::getInstance();
+	DecisionCache::Verdict verdict;
+
+	// The parser wants zero terminated strings, again reusing per thread buffers
+	thread_local std::string matchUri, matchHost;
+
+	// Requests to a host that a ||host^ filter may block are first answered per host, type and referring host, whatever
+	// their path. An allow at this level only means the host filters do not block, the full uri is checked below.
+	NormalizedHost host;
+	if (snapshot->hosts.Enabled() && host.Normalize(UriHost(requestedUri)) && snapshot->hosts.Covers(host, referringHost))
 	{
-		return false;
+		// "||" never starts a uri, so these keys do not collide with the ones below
+		thread_local std::string hostKey;
+		hostKey.assign("||");
+		hostKey.append(host.Name().data(), host.Name().size());
+		hostKey += '^';
+		hostKey.append(optionDigits, optionLength);
+		hostKey.append(referringHost.data(), referringHost.size());
+
+		stageStart = Stats::Now();
+		verdict = cache.Lookup(DecisionCache::cdRequest, hostKey);
+		stats.Record(Stats::stCache, stageStart);
+
+		if (verdict == DecisionCache::vdMiss)
+		{
+			matchUri.assign(requestedUri.data(), requestedUri.size());
+			matchHost.assign(referringHost.data(), referringHost.size());
+
+			stageStart = Stats::Now();
+			const bool hostBlocked = snapshot->hosts.Blocked(matchUri.c_str(), options, matchHost.c_str());
+			stats.Record(Stats::stMatch, stageStart);
+			stats.Count(Stats::scHostMatches);
+
+			cache.Insert(DecisionCache::cdRequest, hostKey, hostBlocked);
+			if (hostBlocked)
+				return true;
+		}
+		else if (verdict == DecisionCache::vdBlock)
+		{
+			stats.Count(Stats::scHostHits);
+			return true;
+		}
 	}
+
+	// Query string tokens no filter can match on are replaced by a placeholder, see UriCanonicalizer
+	uniqueIdentifier.clear();
+	bool canonical = false;
+	if (canonicalKeys.load(std::memory_order_relaxed))
+		canonical = snapshot->canonicalizer.AppendKey(requestedUri, uniqueIdentifier);
+	else
+		uniqueIdentifier.append(requestedUri.data(), requestedUri.size());
+	uniqueIdentifier.append(optionDigits, optionLength);
+	uniqueIdentifier.append(referringHost.data(), referringHost.size());
+	if (canonical)
+		stats.Count(Stats::scCanonicalKeys);
 	
-	// And check our local host blacklist cache for previous checked entries
-	if (IsCached(RequestCacheBlackList, uniqueIdentifier))
+	// First check our local request cache for previous checked entries, a single probe answers both allow and block
+	stageStart = Stats::Now();
+	verdict = cache.Lookup(DecisionCache::cdRequest, uniqueIdentifier);
+	stats.Record(Stats::stCache, stageStart);
+	if (verdict != DecisionCache::vdMiss)
 	{
-		return true;
+		if (canonical)
+			stats.Count(Stats::scCanonicalHits);
+		return verdict == DecisionCache::vdBlock;
 	}
 	
 	//Debugger(ilNormal | flApplication) << requestedUri;
-	
-	if (AdBlockNetfilterClient.matches(requestedUri.c_str(), options, referringHost.c_str()))
+
+	stageStart = Stats::Now();
+	bool matched;
+	if (snapshot->matcher)
 	{
-		PushCache(RequestCacheBlackList, uniqueIdentifier);
+		matched = snapshot->matcher->Matches(requestedUri, options, referringHost);
+	}
+	else
+	{
+		matchUri.assign(requestedUri.data(), requestedUri.size());
+		matchHost.assign(referringHost.data(), referringHost.size());
+		matched = snapshot->client.matches(matchUri.c_str(), options, matchHost.c_str());
+	}
+	stats.Record(Stats::stMatch, stageStart);
+
+	if (matched)
+	{
+		cache.Insert(DecisionCache::cdRequest, uniqueIdentifier, true);
 		return true;
 	}
 	
 	// Request is allowed, cache it to our whitelist the the next time it will be requested
-	PushCache(RequestCacheWhiteList, uniqueIdentifier);
+	cache.Insert(DecisionCache::cdRequest, uniqueIdentifier, false);
 	
 	return false;
 }
+
+bool NetFilterAdblock::MatchedRule(std::string_view requestedUri, const libecap::Header &header, std::string &rule)
+{
+	static const libecap::Name headerAccept("Accept");
+	static const libecap::Name headerXRequest("X-Requested-With");
+	static const libecap::Name headerContentType("Content-Type");
+	static const libecap::Name headerReferer("Referer");
+
+	const libecap::Area requestAccept = header.value(headerAccept);
+	const libecap::Area requestXRequest = header.value(headerXRequest);
+	const libecap::Area requestContentType = header.value(headerContentType);
+	const libecap::Area requestReferer = header.value(headerReferer);
+
+	return MatchedRule(requestedUri, AreaView(requestAccept), AreaView(requestXRequest), AreaView(requestContentType), AreaView(requestReferer), rule);
+}
+
+// Matches the request once more to find the filter that blocked it, only used for the block log
+bool NetFilterAdblock::MatchedRule(std::string_view requestedUri, std::string_view requestAccept, std::string_view requestXRequest,
+	std::string_view requestContentType, std::string_view requestReferer, std::string &rule)
+{
+	const FilterOption options = RequestClassifier::getInstance().Classify(requestedUri, requestAccept, requestXRequest, requestContentType, requestReferer);
+
+	auto snapshot = AdBlockNetfilterClient.Read();
+	if (snapshot->matcher)
+		return snapshot->matcher->Matches(requestedUri, options, ReferringHost(requestReferer), &rule);
+
+	thread_local std::string matchUri, matchHost;
+	matchUri.assign(requestedUri.data(), requestedUri.size());
+	matchHost.assign(ReferringHost(requestReferer));
+
+	Filter *matchingFilter = nullptr;
+	Filter *matchingExceptionFilter = nullptr;
+	if (!snapshot->client.findMatchingFilters(matchUri.c_str(), options, matchHost.c_str(), &matchingFilter, &matchingExceptionFilter) || !matchingFilter || !matchingFilter->data)
+		return false;
+
+	rule.assign(matchingFilter->data, matchingFilter->dataLen >= 0 ? matchingFilter->dataLen : strlen(matchingFilter->data));
+	return true;
+}
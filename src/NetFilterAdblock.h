@@ -2,6 +2,12 @@
 #define ECAP_NBLOCK_NetFilterAdblock
 
 #include "Debugger.h"
+#include "AdblockHostIndex.h"
+#include "AdblockMatcher.h"
+#include "BlocklistImage.h"
+#include "DecisionCache.h"
+#include "SnapshotPointer.h"
+#include "UriCanonicalizer.h"
 #include "ad_block_client.h"
 
 #include <iostream>
@@ -10,12 +16,22 @@
 #include <iostream>
 #include <set>
 #include <string.h>
+#include <string_view>
 #include <unordered_set>
 #include <mutex>
-#include <regex>
+#include <atomic>
 #include <libecap/common/header.h>
 #include <libecap/common/names.h>
 
+// AdBlockClient together with the image memory its filters point into when it was deserialized from a BlocklistImage
+struct AdblockSnapshot {
+	std::shared_ptr<BlocklistImage> image; // declared first, so it is released after the client
+	AdBlockClient client; // left empty when matcher is set
+	std::unique_ptr<AdblockMatcher> matcher; // matcher=native
+	UriCanonicalizer canonicalizer; // cache keys for client, see IsBlackListed()
+	AdblockHostIndex hosts; // host level verdicts, see IsBlackListed()
+};
+
 class NetFilterAdblock {
 public:
 	static NetFilterAdblock& getInstance()
@@ -24,22 +40,25 @@ public:
 		return instance;
 	}
 
-	bool LoadAdblockList(std::string fileName);
-	bool IsBlackListed(std::string requestedUrl, const libecap::Header &header);
+	bool LoadAdblockRules(const std::string &rules); // one filter per line
+	bool LoadImage(const std::shared_ptr<BlocklistImage> &image);
+	void SetCanonicalKeys(bool enabled); // cache_canonical
+	void SetNativeMatcher(bool enabled) { nativeMatcher = enabled; } // matcher, applies to the lists loaded after the call
+	bool IsBlackListed(std::string_view requestedUri, const libecap::Header &header);
+	bool IsBlackListed(std::string_view requestedUri, std::string_view requestAccept, std::string_view requestXRequest,
+		std::string_view requestContentType, std::string_view requestReferer);
 
-	unsigned int localCacheSize;
+	// The filter that blocks the request, for the block log
+	bool MatchedRule(std::string_view requestedUri, const libecap::Header &header, std::string &rule);
+	bool MatchedRule(std::string_view requestedUri, std::string_view requestAccept, std::string_view requestXRequest,
+		std::string_view requestContentType, std::string_view requestReferer, std::string &rule);
 
 protected:
 
 private:
-	AdBlockClient AdBlockNetfilterClient;
-	
-	std::mutex mutexCache;
-	std::unordered_set<std::string> RequestCacheWhiteList;
-	std::unordered_set<std::string> RequestCacheBlackList;
-	
-	void PushCache(std::unordered_set<std::string> &cacheSet, std::string newValue);
-	bool IsCached(std::unordered_set<std::string> &cacheSet, std::string host);
+	SnapshotPointer<AdblockSnapshot> AdBlockNetfilterClient;
+	std::atomic<bool> canonicalKeys{true};
+	std::atomic<bool> nativeMatcher{false};
 };
 
 #endif
@@ -1,4 +1,5 @@
 #include "NetFilterDns.h"
+#include "Stats.h"
 
 #include <libecap/common/name.h>
 #include <libecap/common/area.h>
@@ -8,145 +9,163 @@
 #include <stdexcept>
 #include <chrono>
 
-bool NetFilterDns::LoadHostnames(std::string fileName)
+static void LogPrefilter(const DomainTrie &blockList)
 {
-	mutexBlocklists.lock();
-	
-	HostnameBlockList.clear();
-	HostCacheWhiteList.clear();
-	HostCacheBlackList.clear();
-
-	std::ifstream HostnameBlockListFile(fileName);
-	for (std::string line; std::getline(HostnameBlockListFile, line);)
-	{
-		if (strncmp(line.c_str(), "0.0.0.0 ", 8) == 0) // strncmp returns 0 on match
-		{
-			HostnameBlockList.insert(line.substr(8, line.size() - 8));
-		}
+	const XorFilter &prefilter = blockList.Prefilter();
+	if (prefilter.Empty())
+	{
+		if (blockList.Entries())
+			Debugger(ilCritical | flApplication) << "[nBlock] Unable to build the blocklist prefilter, every host walks the index";
+		return;
 	}
-	HostnameBlockListFile.close();
-	Debugger(ilNormal | flApplication) << "[nBlock] Loaded " << HostnameBlockList.size() << " entries in to hostname blocklist";
 
-	mutexBlocklists.unlock();
-	return true;
+	Debugger(ilNormal | flApplication) << "[nBlock] Blocklist prefilter holds " << prefilter.Keys() << " entries in " << prefilter.Bytes() / 1024
+		<< " KiB, false positive rate " << prefilter.MeasureFalsePositiveRate() * 100 << "%";
 }
 
-// TODO: should make a hostname importer out of this function: out of scope for first proto type.
-bool NetFilterDns::LoadDomains(std::string fileName)
+void NetFilterDns::LoadBlockList(std::unique_ptr<DomainTrie> blockList)
 {
-	mutexBlocklists.lock();
-	
-	DomainBlockList.clear();
-	HostCacheWhiteList.clear();
-	HostCacheBlackList.clear();
-
-	std::ifstream DomainBlockListFile(fileName);
-	for (std::string line; std::getline(DomainBlockListFile, line);)
-	{
-		if (strncmp(line.c_str(), "address=/", 9) == 0) // strncmp returns 0 on match
-		{
-			DomainBlockList.insert(line.substr(9, line.size() - (9 + 8)));
-		}
-	}
-	DomainBlockListFile.close();
-	mutexBlocklists.unlock();
-	
-	Debugger(ilNormal | flApplication) << "[nBlock] Loaded " << DomainBlockList.size() << " entries in to domain blocklist";
-	return true;
+	Debugger(ilNormal | flApplication) << "[nBlock] Blocklist index holds " << blockList->Entries() << " hostnames and domains in " << blockList->MemoryUsage() / 1024 << " KiB";
+	LogPrefilter(*blockList);
+	PublishBlockList(std::move(blockList));
 }
 
-void NetFilterDns::PushCache(std::unordered_set<std::string> &cacheSet, std::string newValue)
+void NetFilterDns::PublishBlockList(std::unique_ptr<DomainTrie> blockList)
 {
-	mutexCache.lock();
-	
-	if (cacheSet.size() > localCacheSize)
-		cacheSet.erase(cacheSet.begin());
-
-	cacheSet.insert(newValue);
-	
-	mutexCache.unlock();
-}
+	std::lock_guard<std::mutex> lock(mutexReload);
 
-bool NetFilterDns::IsCached(std::unordered_set<std::string> &cacheSet, std::string host)
-{
-	mutexCache.lock();
-	
-	if (cacheSet.find(host) != cacheSet.end())
+	// Only cached hosts that match an added, removed or changed entry can get a different verdict
+	std::unique_ptr<DomainTrie> changes;
 	{
-		mutexCache.unlock();
-		return true;
-	}	
-	
-	mutexCache.unlock();
-	return false;
-}
+		auto current = BlockList.Read();
+		if (current->Entries() != 0)
+			changes = ChangedEntries(*current, *blockList);
+	}
 
-bool NetFilterDns::IsInBlockList(std::unordered_set<std::string> &blocklistSet, std::string host)
-{
-	mutexBlocklists.lock();
-	
-	if (blocklistSet.find(host) != blocklistSet.end())
+	// Lookups keep using the current snapshot until the new one is swapped in. Publish() returns once no lookup
+	// can still be using the previous index, so verdicts based on it are all cached by now.
+	BlockList.Publish(std::move(blockList));
+
+	DecisionCache &cache = DecisionCache::getInstance();
+	if (!changes)
 	{
-		mutexBlocklists.unlock();
-		return true;
-	}	
-	
-	mutexBlocklists.unlock();
-	return false;
+		cache.Clear(DecisionCache::cdHost);
+		return;
+	}
+
+	size_t invalidated = cache.Invalidate(DecisionCache::cdHost, [&changes](const std::string &host) {
+		return changes->Match(host) != 0;
+	});
+	Debugger(ilNormal | flApplication) << "[nBlock] Blocklist reload changed " << changes->Entries() << " entries, invalidated " << invalidated << " cached hosts";
 }
 
-bool NetFilterDns::IsBlackListed(std::string host)
+std::unique_ptr<DomainTrie> NetFilterDns::ChangedEntries(const DomainTrie &previous, const DomainTrie &next)
 {
-	// Remove port part if present (for https requests)
-	size_t port_pos = host.find_first_of(':');
-	if (port_pos != std::string::npos)
+	std::unordered_map<std::string, unsigned char> previousEntries;
+	previousEntries.reserve(previous.Entries());
+	previous.Visit([&previousEntries](const std::string &name, unsigned char flags) {
+		previousEntries.emplace(name, flags);
+	});
+
+	std::unique_ptr<DomainTrie> changes(new DomainTrie());
+	next.Visit([&previousEntries, &changes](const std::string &name, unsigned char flags) {
+		auto previousEntry = previousEntries.find(name);
+		if (previousEntry == previousEntries.end())
+		{
+			changes->Insert(name, flags);
+			return;
+		}
+
+		// Listed before as well, matters only if it moved between the hostname and domain lists
+		if (previousEntry->second != flags)
+			changes->Insert(name, previousEntry->second | flags);
+		previousEntries.erase(previousEntry);
+	});
+
+	// Whatever is left got removed
+	for (const auto &entry : previousEntries)
 	{
-		host = host.substr(0, port_pos);
+		changes->Insert(entry.first, entry.second);
 	}
 
-	// First check our local host whitelist cache for previous checked entries
-	if (IsCached(HostCacheWhiteList, host))
+	changes->Build();
+	return changes;
+}
+
+bool NetFilterDns::LoadImage(const std::shared_ptr<BlocklistImage> &image)
+{
+	size_t nodeBytes = 0, labelBytes = 0, filterBytes = 0;
+	uint64_t entries = 0, labelEntries = 0, filterEntries = 0;
+	const char *nodeData = image->Find(BlocklistImage::stTrieNodes, nodeBytes, entries);
+	const char *labelData = image->Find(BlocklistImage::stTrieLabels, labelBytes, labelEntries);
+	const char *filterData = image->Find(BlocklistImage::stTrieFilter, filterBytes, filterEntries);
+
+	if (!nodeData || !labelData)
 	{
+		Debugger(ilNormal | flApplication) << "[nBlock] " << image->FileName() << " holds no hostname / domain blocklist";
 		return false;
 	}
-	
-	// And check our local host blacklist cache for previous checked entries
-	if (IsCached(HostCacheBlackList, host))
+
+	// The trie is used in place, the image stays mapped for as long as this snapshot is alive
+	std::unique_ptr<DomainTrie> blockList(new DomainTrie());
+	if (!blockList->Attach(nodeData, nodeBytes, labelData, labelBytes, entries, image, filterData, filterBytes))
 	{
-		return true;
+		Debugger(ilCritical | flApplication) << "[nBlock] " << image->FileName() << " holds a corrupt hostname / domain blocklist";
+		return false;
 	}
+	Debugger(ilNormal | flApplication) << "[nBlock] Mapped " << entries << " hostname and domain entries from " << image->FileName();
+	LogPrefilter(*blockList);
+
+	PublishBlockList(std::move(blockList));
+
+	return true;
+}
 
-	// First check for matches with our hostnames list (faster)
-	if (IsInBlockList(HostnameBlockList, host))
+bool NetFilterDns::IsBlackListed(std::string_view host)
+{
+	// Lowercase, remove the port part if present (for https requests) and find the labels and their hashes in one go
+	NormalizedHost normalized;
+	if (!normalized.Normalize(host))
 	{
-		PushCache(HostCacheBlackList, host);
-		return true;
+		return false; // longer than any DNS name, so it is not in any list either
 	}
 
-	// Now check for matching domain filters, matching against subdomains, eg: host.com, evil.host.com, a.evil.host.com
-	size_t dotpos = host.find_last_of('.'); // First part is always skipped, do not block *.com
-	std::string subhost;
+	// The snapshot stays pinned until the verdict is cached, see LoadBlockList()
+	auto blockList = BlockList.Read();
 
-	while (dotpos != std::string::npos)
+	// Then check our local host cache for previous checked entries, a single probe answers both allow and block
+	DecisionCache &cache = DecisionCache::getInstance();
+	const uint64_t lookupStart = Stats::Now();
+	DecisionCache::Verdict verdict = cache.Lookup(DecisionCache::cdHost, normalized.Name(), normalized.Hash());
+	Stats::getInstance().Record(Stats::stCache, lookupStart);
+	if (verdict != DecisionCache::vdMiss)
 	{
-		dotpos = host.find_last_of('.', dotpos-1);
+		return verdict == DecisionCache::vdBlock;
+	}
 
-		if (dotpos != std::string::npos)
-		{
-			subhost = host.substr(dotpos + 1, host.size() - dotpos);
-		}
-		else subhost = host;
+	// Check the hostnames and domains index in one walk over the host labels, domain filters match against
+	// subdomains as well, eg: host.com, evil.host.com, a.evil.host.com. Match() runs the prefilter first, which turns
+	// most unlisted hosts away without walking the trie.
 
-		// Check if the sub-host matches any domain in the block-lists
-		if (IsInBlockList(DomainBlockList, subhost))
-		{
-			PushCache(HostCacheBlackList, host);			
-			return true;
-		}
+	if (blockList->Match(normalized) != 0)
+	{
+		cache.Insert(DecisionCache::cdHost, normalized.Name(), normalized.Hash(), true);
+		return true;
 	}
 
 	// Host is found to be clear, add it to the local cache for faster filtering the next time it is requested
-	PushCache(HostCacheWhiteList, host);
+	cache.Insert(DecisionCache::cdHost, normalized.Name(), normalized.Hash(), false);
 
 	return false;
 }
+
+bool NetFilterDns::MatchedEntry(std::string_view host, std::string &entry)
+{
+	NormalizedHost normalized;
+	size_t matchStart = 0;
+	if (!normalized.Normalize(host) || BlockList.Read()->Match(normalized, &matchStart) == 0)
+		return false;
+
+	entry.assign(normalized.Name().substr(matchStart));
+	return true;
+}
@@ -2,6 +2,10 @@
 #define ECAP_NBLOCK_NETFILTERDNS
 
 #include "Debugger.h"
+#include "BlocklistImage.h"
+#include "DecisionCache.h"
+#include "DomainTrie.h"
+#include "SnapshotPointer.h"
 
 #include <iostream>
 #include <fstream>
@@ -9,7 +13,9 @@
 #include <iostream>
 #include <set>
 #include <string.h>
-#include <unordered_set>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include <mutex>
 
 class NetFilterDns {
@@ -20,28 +26,23 @@ public:
 		return instance;
 	}
 
-	bool LoadHostnames(std::string fileName);
-	bool LoadDomains(std::string fileName);
-	bool LoadAdblockList(std::string fileName);
+	void LoadBlockList(std::unique_ptr<DomainTrie> blockList);
+	bool LoadImage(const std::shared_ptr<BlocklistImage> &image);
 
-	bool IsBlackListed(std::string host);
+	bool IsBlackListed(std::string_view host); // host header value, port included or not
+	bool MatchedEntry(std::string_view host, std::string &entry); // the list entry that blocks host, for the block log
 
-	unsigned int localCacheSize;
+	// Pins the current hostname / domain index, eg for RuleOptimizer while the Adblock lists are loaded
+	SnapshotPointer<DomainTrie>::ReadGuard ReadBlockList() const { return BlockList.Read(); }
 
 protected:
 
 private:
-	std::mutex mutexBlocklists;
-	std::unordered_set<std::string> HostnameBlockList;
-	std::unordered_set<std::string> DomainBlockList;
-
-	std::mutex mutexCache;
-	std::unordered_set<std::string> HostCacheWhiteList;
-	std::unordered_set<std::string> HostCacheBlackList;
-	
-	void PushCache(std::unordered_set<std::string> &cacheSet, std::string newValue);
-	bool IsCached(std::unordered_set<std::string> &cacheSet, std::string host);
-	bool IsInBlockList(std::unordered_set<std::string> &blocklistSet, std::string host);
+	std::mutex mutexReload; // serializes reloads, lookups never lock
+	SnapshotPointer<DomainTrie> BlockList;
+
+	void PublishBlockList(std::unique_ptr<DomainTrie> blockList);
+	static std::unique_ptr<DomainTrie> ChangedEntries(const DomainTrie &previous, const DomainTrie &next);
 };
 
 #endif
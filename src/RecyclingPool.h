@@ -0,0 +1,99 @@
+#ifndef ECAP_NBLOCK_RECYCLINGPOOL_H
+#define ECAP_NBLOCK_RECYCLINGPOOL_H
+
+#include <cstddef>
+#include <new>
+
+// Recycles the memory of objects made and released once per request (Adapter::Xaction, VerdictQueue::Job), so the
+// steady state takes no trip to malloc() for them. Blocks of one size are kept on a free list per thread: no lock, and a
+// block released on another thread than the one it came from simply joins the list of that thread. Every thread keeps
+// at most maxFree blocks of a size, anything beyond goes back to the heap.
+template <size_t Size>
+class RecyclingPool {
+public:
+	static const size_t maxFree = 4096;
+
+	static void *Allocate()
+	{
+		FreeList &list = Local();
+		if (Block *block = list.head)
+		{
+			list.head = block->next;
+			list.count--;
+			return block;
+		}
+		return ::operator new(Size);
+	}
+
+	static void Release(void *memory)
+	{
+		FreeList &list = Local();
+		if (list.count >= maxFree)
+		{
+			::operator delete(memory);
+			return;
+		}
+
+		Block *block = static_cast<Block *>(memory);
+		block->next = list.head;
+		list.head = block;
+		list.count++;
+	}
+
+private:
+	struct Block {
+		Block *next;
+	};
+
+	struct FreeList {
+		Block *head = nullptr;
+		size_t count = 0;
+
+		~FreeList()
+		{
+			while (Block *block = head)
+			{
+				head = block->next;
+				::operator delete(block);
+			}
+			count = maxFree; // releases during thread exit go straight to the heap
+		}
+	};
+
+	static_assert(Size >= sizeof(Block), "blocks hold the free list link");
+
+	static FreeList &Local()
+	{
+		thread_local FreeList list;
+		return list;
+	}
+};
+
+// Allocator for std::allocate_shared(): the object and its control block come from one RecyclingPool block
+template <class T>
+class PoolAllocator {
+public:
+	typedef T value_type;
+
+	PoolAllocator() noexcept {}
+	template <class U> PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+	T *allocate(size_t n)
+	{
+		static_assert(alignof(T) <= alignof(std::max_align_t), "the pool does not align beyond operator new");
+		return static_cast<T *>(n == 1 ? RecyclingPool<sizeof(T)>::Allocate() : ::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T *memory, size_t n)
+	{
+		if (n == 1)
+			RecyclingPool<sizeof(T)>::Release(memory);
+		else
+			::operator delete(memory);
+	}
+
+	template <class U> bool operator ==(const PoolAllocator<U> &) const { return true; }
+	template <class U> bool operator !=(const PoolAllocator<U> &) const { return false; }
+};
+
+#endif
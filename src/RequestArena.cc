@@ -0,0 +1,48 @@
+#include "RequestArena.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+static const size_t chunkSize = 4096;
+
+std::string_view RequestArena::Copy(std::string_view text)
+{
+	if (text.empty())
+		return std::string_view();
+
+	char *copy;
+	if (text.size() <= inlineSize - used)
+	{
+		copy = buffer + used;
+		used += text.size();
+	}
+	else
+	{
+		if (!chunks || text.size() > chunks->size - chunks->used)
+		{
+			const size_t size = std::max(chunkSize, text.size());
+			Chunk *chunk = static_cast<Chunk *>(::operator new(sizeof(Chunk) + size));
+			chunk->next = chunks;
+			chunk->size = size;
+			chunk->used = 0;
+			chunks = chunk;
+		}
+
+		copy = reinterpret_cast<char *>(chunks + 1) + chunks->used;
+		chunks->used += text.size();
+	}
+
+	memcpy(copy, text.data(), text.size());
+	return std::string_view(copy, text.size());
+}
+
+void RequestArena::Reset()
+{
+	while (Chunk *chunk = chunks)
+	{
+		chunks = chunk->next;
+		::operator delete(chunk);
+	}
+	used = 0;
+}
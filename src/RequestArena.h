@@ -0,0 +1,39 @@
+#ifndef ECAP_NBLOCK_REQUESTARENA_H
+#define ECAP_NBLOCK_REQUESTARENA_H
+
+#include <stddef.h>
+#include <string_view>
+
+// Bump allocator for the buffers of one request, eg the copy of its uri and headers an async verdict works on.
+// Copies are carved from a block inside the arena, so an arena that lives in a pooled object allocates nothing. Requests
+// that do not fit (very long uris) spill into heap chunks. Everything is released at once by Reset() or with the arena.
+class RequestArena {
+public:
+	RequestArena(): used(0), chunks(nullptr) {}
+	~RequestArena() { Reset(); }
+
+	// Returns a view of the copy, valid until the next Reset()
+	std::string_view Copy(std::string_view text);
+
+	void Reset();
+
+private:
+	static const size_t inlineSize = 2048; // a long uri, a referer and the usual headers
+
+	struct Chunk {
+		Chunk *next;
+		size_t size;
+		size_t used;
+		// followed by size bytes
+	};
+
+	char buffer[inlineSize];
+	size_t used;
+	Chunk *chunks; // most recent first
+
+	/* prohibited and not implemented */
+	RequestArena(const RequestArena&);
+	RequestArena &operator=(const RequestArena&);
+};
+
+#endif
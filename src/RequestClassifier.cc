@@ -0,0 +1,165 @@
+#include "RequestClassifier.h"
+
+#include <cstring>
+
+static inline char ToLower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+RequestClassifier::RequestClassifier():
+	extensionCount(0)
+{
+	memset(ExtensionTable, 0, sizeof(ExtensionTable));
+
+	// Default mapping, matches what the old regex based detection used to look for
+	AddExtensions(FOScript, "js,json");
+	AddExtensions(FOImage, "jpeg,jpg,gif,png,bmp,svg");
+	AddExtensions(FOStylesheet, "css");
+}
+
+unsigned int RequestClassifier::HashExtension(const char *extension, unsigned int length)
+{
+	unsigned int hash = 2166136261u;
+	for (unsigned int i = 0; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)extension[i]) * 16777619u;
+	}
+	return hash;
+}
+
+bool RequestClassifier::AddExtension(std::string_view extension, FilterOption option)
+{
+	if (extension.empty() || extension.size() > maxExtensionLength)
+		return false;
+
+	// Keep the table at most half full so probe sequences stay short
+	if (extensionCount >= extensionTableSize / 2)
+		return false;
+
+	char name[maxExtensionLength + 1] = {0};
+	for (size_t i = 0; i < extension.size(); i++)
+	{
+		name[i] = ToLower(extension[i]);
+	}
+
+	unsigned int slot = HashExtension(name, extension.size()) & (extensionTableSize - 1);
+	while (ExtensionTable[slot].length != 0)
+	{
+		// Re-mapping an existing extension just changes its type
+		if (ExtensionTable[slot].length == extension.size() && memcmp(ExtensionTable[slot].name, name, extension.size()) == 0)
+		{
+			ExtensionTable[slot].option = option;
+			return true;
+		}
+		slot = (slot + 1) & (extensionTableSize - 1);
+	}
+
+	memcpy(ExtensionTable[slot].name, name, sizeof(name));
+	ExtensionTable[slot].length = extension.size();
+	ExtensionTable[slot].option = option;
+	extensionCount++;
+
+	return true;
+}
+
+bool RequestClassifier::AddExtensions(FilterOption option, const std::string &extensions)
+{
+	std::string_view list(extensions);
+
+	while (!list.empty())
+	{
+		size_t comma = list.find(',');
+		std::string_view extension = list.substr(0, comma);
+
+		// Allow both "js" and ".js" notations, ignore surrounding whitespace
+		while (!extension.empty() && (extension.front() == ' ' || extension.front() == '.'))
+			extension.remove_prefix(1);
+		while (!extension.empty() && extension.back() == ' ')
+			extension.remove_suffix(1);
+
+		if (!extension.empty() && !AddExtension(extension, option))
+			return false;
+
+		if (comma == std::string_view::npos)
+			break;
+		list.remove_prefix(comma + 1);
+	}
+
+	return true;
+}
+
+FilterOption RequestClassifier::ExtensionType(std::string_view requestedUri) const
+{
+	// Skip the scheme and authority part, only the path carries a 'file extension'
+	size_t pathStart = requestedUri.find("://");
+	if (pathStart == std::string_view::npos)
+		return FONoFilterOption;
+
+	pathStart = requestedUri.find('/', pathStart + 3);
+	if (pathStart == std::string_view::npos)
+		return FONoFilterOption;
+
+	size_t pathEnd = requestedUri.find_first_of("?#", pathStart);
+	if (pathEnd == std::string_view::npos)
+		pathEnd = requestedUri.size();
+
+	// Walk back from the end of the path to the last dot of the last path segment
+	size_t dotPos = pathEnd;
+	while (dotPos > pathStart && requestedUri[dotPos - 1] != '.' && requestedUri[dotPos - 1] != '/')
+		dotPos--;
+
+	if (dotPos == pathStart || requestedUri[dotPos - 1] != '.')
+		return FONoFilterOption;
+
+	size_t length = pathEnd - dotPos;
+	if (length == 0 || length > maxExtensionLength)
+		return FONoFilterOption;
+
+	char name[maxExtensionLength];
+	for (size_t i = 0; i < length; i++)
+	{
+		name[i] = ToLower(requestedUri[dotPos + i]);
+	}
+
+	unsigned int slot = HashExtension(name, length) & (extensionTableSize - 1);
+	while (ExtensionTable[slot].length != 0)
+	{
+		if (ExtensionTable[slot].length == length && memcmp(ExtensionTable[slot].name, name, length) == 0)
+			return ExtensionTable[slot].option;
+
+		slot = (slot + 1) & (extensionTableSize - 1);
+	}
+
+	return FONoFilterOption;
+}
+
+FilterOption RequestClassifier::Classify(std::string_view requestedUri, std::string_view requestAccept, std::string_view requestXRequest,
+	std::string_view requestContentType, std::string_view requestReferer) const
+{
+	// Scripts, images and CSS are detected based on the 'file extension' of the requested uri, eg http://host.com/script.js
+	// See NetFilterAdblock::IsBlackListed for the reasoning behind each of these checks.
+	FilterOption options = ExtensionType(requestedUri);
+
+	// When a browser requests a CSS source, it will actually set the 'Accept' header, allowing us to get a better prediction for this file type.
+	if (options == FONoFilterOption && requestAccept.find("text/css") != std::string_view::npos)
+	{
+		options = FOStylesheet;
+	}
+
+	// FOXmlHttpRequest can be detected using 2 methods:
+	// - 'X-Requested-With' request header is set to: "XMLHttpRequest"
+	// - POST requests made by javascript will set the ContentType to x-www-form-urlencoded, while regular POST requests do not.
+	static const std::string_view formUrlEncoded("application/x-www-form-urlencoded");
+	if (requestXRequest == "XMLHttpRequest" || requestContentType.compare(0, formUrlEncoded.size(), formUrlEncoded) == 0)
+	{
+		options = (FilterOption)(options | FOXmlHttpRequest);
+	}
+
+	if (requestReferer.empty() && requestAccept.find("text/html") != std::string_view::npos)
+	{
+		options = (FilterOption)(options | FODocument);
+	}
+
+	return options;
+}
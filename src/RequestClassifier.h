@@ -0,0 +1,47 @@
+#ifndef ECAP_NBLOCK_REQUESTCLASSIFIER_H
+#define ECAP_NBLOCK_REQUESTCLASSIFIER_H
+
+#include "filter.h"
+
+#include <string>
+#include <string_view>
+
+// Detects the ad-block resource type (FOScript, FOImage, ...) of a request in a single pass over the uri and a
+// handful of request headers. Replaces the per request std::regex checks, nothing in here allocates.
+class RequestClassifier {
+public:
+	static RequestClassifier& getInstance()
+	{
+		static RequestClassifier instance;
+		return instance;
+	}
+
+	// Adds a comma separated list of file extensions (without dot) for the given resource type, eg: "js,json,mjs"
+	bool AddExtensions(FilterOption option, const std::string &extensions);
+
+	FilterOption Classify(std::string_view requestedUri, std::string_view requestAccept, std::string_view requestXRequest,
+		std::string_view requestContentType, std::string_view requestReferer) const;
+
+	// Returns the resource type mapped to the extension of the uri path, or FONoFilterOption
+	FilterOption ExtensionType(std::string_view requestedUri) const;
+
+private:
+	RequestClassifier();
+
+	static const unsigned int maxExtensionLength = 15;
+	static const unsigned int extensionTableSize = 256; // power of two, open addressing
+
+	struct Extension {
+		char name[maxExtensionLength + 1];
+		unsigned char length;
+		FilterOption option;
+	};
+
+	Extension ExtensionTable[extensionTableSize];
+	unsigned int extensionCount;
+
+	bool AddExtension(std::string_view extension, FilterOption option);
+	static unsigned int HashExtension(const char *extension, unsigned int length);
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "RuleOptimizer.h"
+
+#include <unordered_set>
+#include <vector>
+
+static bool IsHostChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '_';
+}
+
+bool RuleOptimizer::ParseHostRule(std::string_view rule, HostRule &hostRule)
+{
+	if (rule.compare(0, 2, "||") != 0)
+		return false;
+
+	size_t hostEnd = 2;
+	while (hostEnd < rule.size() && IsHostChar(rule[hostEnd]))
+		hostEnd++;
+
+	// The host has to be terminated by a separator or a path, "||ads.example" would also match "ads.example.net"
+	if (hostEnd == 2 || hostEnd == rule.size() || (rule[hostEnd] != '^' && rule[hostEnd] != '/'))
+		return false;
+
+	hostRule.host = rule.substr(2, hostEnd - 2);
+	if (hostRule.host.front() == '.' || hostRule.host.back() == '.')
+		return false;
+
+	const size_t optionsPos = rule.find('$', hostEnd);
+	hostRule.hasOptions = optionsPos != std::string_view::npos;
+	hostRule.broad = !hostRule.hasOptions && rule.size() == hostEnd + 1 && rule[hostEnd] == '^';
+	hostRule.keep = hostRule.hasOptions && (rule.find("important", optionsPos) != std::string_view::npos || rule.find("badfilter", optionsPos) != std::string_view::npos);
+
+	return true;
+}
+
+// The filter a $badfilter rule disables: the same rule without that option
+bool RuleOptimizer::BadfilterTarget(std::string_view rule, std::string &target)
+{
+	const size_t optionsPos = rule.rfind('$');
+	if (optionsPos == std::string_view::npos || rule.find("badfilter", optionsPos) == std::string_view::npos)
+		return false;
+
+	std::string options;
+	std::string_view input = rule.substr(optionsPos + 1);
+	while (!input.empty())
+	{
+		size_t optionEnd = input.find(',');
+		std::string_view option = input.substr(0, optionEnd);
+		input.remove_prefix(optionEnd == std::string_view::npos ? input.size() : optionEnd + 1);
+		if (option == "badfilter")
+			continue;
+		options += options.empty() ? "" : ",";
+		options.append(option.data(), option.size());
+	}
+
+	target.assign(rule.data(), optionsPos);
+	if (!options.empty())
+		target += "$" + options;
+	return true;
+}
+
+std::vector<std::string_view> RuleOptimizer::SplitRules(const std::string &rules, Result &result)
+{
+	std::vector<std::string_view> lines;
+	std::unordered_set<std::string_view> seenRules;
+
+	result = Result();
+	result.inputBytes = rules.size();
+
+	std::string_view input(rules);
+	while (!input.empty())
+	{
+		size_t lineEnd = input.find('\n');
+		std::string_view rule = input.substr(0, lineEnd);
+		input.remove_prefix(lineEnd == std::string_view::npos ? input.size() : lineEnd + 1);
+
+		if (!rule.empty() && rule.back() == '\r')
+			rule.remove_suffix(1);
+		if (rule.empty())
+			continue;
+
+		result.inputRules++;
+		if (!seenRules.insert(rule).second)
+		{
+			result.duplicates++;
+			continue;
+		}
+		lines.push_back(rule);
+	}
+
+	return lines;
+}
+
+std::string RuleOptimizer::JoinRules(const std::vector<std::string_view> &lines, Result &result)
+{
+	std::string joined;
+	joined.reserve(result.inputBytes);
+
+	for (std::string_view rule : lines)
+	{
+		joined.append(rule.data(), rule.size());
+		joined += '\n'; // the Adblock parser needs the newlines
+	}
+
+	result.outputRules = lines.size();
+	result.outputBytes = joined.size();
+	return joined;
+}
+
+std::string RuleOptimizer::Deduplicate(const std::string &rules, Result &result)
+{
+	return JoinRules(SplitRules(rules, result), result);
+}
+
+std::string RuleOptimizer::Optimize(const std::string &rules, const DomainTrie *dnsIndex, Result &result)
+{
+	std::vector<std::string_view> lines = SplitRules(rules, result);
+
+	// $badfilter disables the filter that is the same except for that option, as in AdblockMatcher::Build()
+	std::unordered_set<std::string> disabled;
+	std::string target;
+	for (std::string_view rule : lines)
+	{
+		if (BadfilterTarget(rule, target))
+			disabled.insert(target);
+	}
+
+	// The broad ||domain^ filters block everything below them, whatever other filters say about those hosts
+	DomainTrie broadHosts;
+	for (std::string_view rule : lines)
+	{
+		HostRule hostRule;
+		if (ParseHostRule(rule, hostRule) && hostRule.broad && disabled.count(std::string(rule)) == 0)
+			broadHosts.Insert(hostRule.host, DomainTrie::tfDomain);
+	}
+	broadHosts.Build();
+
+	// Drop the filters that can only ever match requests that are blocked anyway
+	std::vector<std::string_view> kept;
+	kept.reserve(lines.size());
+
+	for (std::string_view rule : lines)
+	{
+		HostRule hostRule;
+		if (ParseHostRule(rule, hostRule) && !hostRule.keep)
+		{
+			// Only a domain entry covers the sub domains that ||host also matches, a hostname entry does not
+			if (dnsIndex && dnsIndex->Match(hostRule.host) == DomainTrie::tfDomain)
+			{
+				result.dnsCovered++;
+				continue;
+			}
+
+			// A broad filter would match itself, it is only redundant if one of its parent domains is listed
+			std::string_view coveringHost = hostRule.host;
+			if (hostRule.broad)
+			{
+				size_t dotPos = coveringHost.find('.');
+				coveringHost = (dotPos == std::string_view::npos) ? std::string_view() : coveringHost.substr(dotPos + 1);
+			}
+
+			if (!coveringHost.empty() && broadHosts.Match(coveringHost) == DomainTrie::tfDomain)
+			{
+				result.subsumed++;
+				continue;
+			}
+		}
+
+		kept.push_back(rule);
+	}
+
+	return JoinRules(kept, result);
+}
@@ -0,0 +1,49 @@
+#ifndef ECAP_NBLOCK_RULEOPTIMIZER_H
+#define ECAP_NBLOCK_RULEOPTIMIZER_H
+
+#include "DomainTrie.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Removes Adblock Plus network filters that can never change a verdict before they are handed to AdBlockClient:
+// - exact duplicates
+// - filters anchored to a host (||host^ or ||host/path) that NetFilterDns already blocks as a domain, those requests
+//   never reach the Adblock filter
+// - filters anchored to a host that is blocked entirely by a broader, option-less ||domain^ filter, unless a $badfilter
+//   disables that one
+// Exception (@@) filters are always kept.
+class RuleOptimizer {
+public:
+	struct Result {
+		size_t inputRules = 0;
+		size_t outputRules = 0;
+		size_t duplicates = 0;
+		size_t dnsCovered = 0;
+		size_t subsumed = 0;
+		size_t inputBytes = 0;
+		size_t outputBytes = 0;
+	};
+
+	// rules holds one filter per line, dnsIndex is the hostname / domain index of NetFilterDns (may be nullptr)
+	static std::string Optimize(const std::string &rules, const DomainTrie *dnsIndex, Result &result);
+
+	// Only drops the exact duplicates
+	static std::string Deduplicate(const std::string &rules, Result &result);
+
+private:
+	struct HostRule {
+		std::string_view host;
+		bool hasOptions; // $...
+		bool broad; // ||host^ without path or options, blocks everything on host and its sub domains
+		bool keep; // $important / $badfilter change how other filters apply, never drop those
+	};
+
+	static bool ParseHostRule(std::string_view rule, HostRule &hostRule);
+	static bool BadfilterTarget(std::string_view rule, std::string &target);
+	static std::vector<std::string_view> SplitRules(const std::string &rules, Result &result);
+	static std::string JoinRules(const std::vector<std::string_view> &lines, Result &result);
+};
+
+#endif
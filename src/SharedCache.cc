@@ -0,0 +1,210 @@
+#include "SharedCache.h"
+#include "Hash.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+	"the shared cache needs address free atomics");
+
+static const char sharedMagic[8] = {'n', 'B', 'l', 'k', 'V', 'r', 'd', 't'};
+
+static uint64_t Mix(uint64_t value)
+{
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdull;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ull;
+	value ^= value >> 33;
+	return value;
+}
+
+SharedCache::SharedCache():
+	capacity(0),
+	header(nullptr),
+	slots(nullptr),
+	mappedSize(0)
+{
+}
+
+SharedCache::~SharedCache()
+{
+	Close();
+}
+
+void SharedCache::Close()
+{
+	if (header)
+		munmap(header, mappedSize);
+
+	header = nullptr;
+	slots = nullptr;
+	mappedSize = 0;
+}
+
+bool SharedCache::Open(const std::string &aName, unsigned int entries, std::string &error)
+{
+	Close();
+	name = aName;
+	capacity = entries;
+
+	// At most half full, so probe windows stay short
+	uint64_t slotCount = 64;
+	while (slotCount < 2 * (uint64_t)entries)
+		slotCount *= 2;
+	const size_t size = sizeof(Header) + slotCount * sizeof(uint64_t);
+
+	// Every worker opens the same segment, the first one creates it. One that exists with another size may still be in
+	// use by other workers, it is not replaced under them.
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+	{
+		error = "cannot open shared memory " + name + ": " + strerror(errno);
+		return false;
+	}
+
+	struct stat segmentStat;
+	if (fstat(fd, &segmentStat) != 0 || (segmentStat.st_size == 0 && ftruncate(fd, size) != 0))
+	{
+		error = "cannot size shared memory " + name + ": " + strerror(errno);
+		close(fd);
+		return false;
+	}
+
+	if (segmentStat.st_size != 0 && (size_t)segmentStat.st_size != size)
+	{
+		error = "shared memory " + name + " is sized for another cache value, configure every worker with the same cache value or remove /dev/shm" + name + " with Squid stopped";
+		close(fd);
+		return false;
+	}
+
+	void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		error = "cannot map shared memory " + name + ": " + strerror(errno);
+		return false;
+	}
+
+	header = (Header *)mapped;
+	slots = (std::atomic<uint64_t> *)((char *)mapped + sizeof(Header));
+	mappedSize = size;
+
+	// A new segment is all zeroes, whoever gets here first fills in the header
+	uint32_t state = 0;
+	if (header->state.compare_exchange_strong(state, 2))
+	{
+		memcpy(header->magic, sharedMagic, sizeof(sharedMagic));
+		header->version = layoutVersion;
+		header->slotCount = slotCount;
+		header->state.store(1);
+	}
+	else
+	{
+		for (int wait = 0; wait < 1000 && header->state.load() != 1; wait++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	if (header->state.load() != 1 || memcmp(header->magic, sharedMagic, sizeof(sharedMagic)) != 0 || header->version != layoutVersion || header->slotCount != slotCount)
+	{
+		error = "shared memory " + name + " is in use by something else, or by another nBlock version";
+		Close();
+		return false;
+	}
+
+	// The workers of one Squid share its master process. A segment left by a previous Squid holds verdicts of lists that
+	// may have changed since: the first worker of this Squid to get here starts new generations, the workers that come
+	// later or are reconfigured keep the verdicts the others shared.
+	const uint64_t instance = getppid();
+	uint64_t previous = header->instance.load();
+	if (previous != instance && header->instance.compare_exchange_strong(previous, instance))
+	{
+		for (unsigned int slot = 0; slot < generationSlots; slot++)
+			Clear(slot);
+	}
+
+	return true;
+}
+
+uint64_t SharedCache::Slot(unsigned int generationSlot, uint64_t hash, size_t &index) const
+{
+	const uint32_t generation = header->generations[generationSlot].load(std::memory_order_relaxed);
+	const uint64_t keyed = HashFnv1a(&generation, sizeof(generation), hash);
+
+	index = Mix(keyed) & (header->slotCount - 1);
+
+	// The low two bits hold the verdict, an all zero slot is empty
+	const uint64_t tag = keyed & ~3ull;
+	return tag ? tag : 4;
+}
+
+SharedCache::Result SharedCache::Lookup(unsigned int generationSlot, uint64_t hash) const
+{
+	size_t index = 0;
+	const uint64_t tag = Slot(generationSlot, hash, index);
+	const uint64_t mask = header->slotCount - 1;
+
+	for (unsigned int i = 0; i < probeWindow; i++)
+	{
+		const uint64_t value = slots[(index + i) & mask].load(std::memory_order_relaxed);
+		if (value == 0)
+			return srMiss; // slots are never emptied, the key would have been stored here
+		if ((value & ~3ull) == tag)
+			return (Result)(value & 3);
+	}
+
+	return srMiss;
+}
+
+void SharedCache::Insert(unsigned int generationSlot, uint64_t hash, bool blocked)
+{
+	size_t index = 0;
+	const uint64_t tag = Slot(generationSlot, hash, index);
+	const uint64_t mask = header->slotCount - 1;
+	const uint64_t entry = tag | (blocked ? srBlock : srAllow);
+
+	for (unsigned int i = 0; i < probeWindow; i++)
+	{
+		std::atomic<uint64_t> &slot = slots[(index + i) & mask];
+		uint64_t value = slot.load(std::memory_order_relaxed);
+
+		// Another worker may claim the same empty slot, check again what it stored then
+		if (value == 0 && slot.compare_exchange_strong(value, entry, std::memory_order_relaxed))
+		{
+			header->used.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		if ((value & ~3ull) == tag)
+		{
+			if (value != entry)
+				slot.store(entry, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	// Window full, replace one of its entries (spread by the hash, so no slot is always the victim)
+	slots[(index + (tag >> 8) % probeWindow) & mask].store(entry, std::memory_order_relaxed);
+	header->evictions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SharedCache::Clear(unsigned int generationSlot)
+{
+	header->generations[generationSlot].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t SharedCache::Entries() const
+{
+	return header->used.load(std::memory_order_relaxed);
+}
+
+uint64_t SharedCache::Evictions() const
+{
+	return header->evictions.load(std::memory_order_relaxed);
+}
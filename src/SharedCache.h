@@ -0,0 +1,72 @@
+#ifndef ECAP_NBLOCK_SHAREDCACHE_H
+#define ECAP_NBLOCK_SHAREDCACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// Verdict table in a POSIX shared memory segment (cache_shared=), so every Squid worker (SMP "workers N") profits from
+// the lookups of the others and the cache memory does not grow with the number of workers.
+//
+// Open addressing with linear probing over 64 bit slots, without locks: a slot holds the upper 62 bits of the key hash
+// and the verdict, and is read and written as a whole. Keys themselves are not stored, two keys with the same 62 bit
+// hash share a verdict. A full probe window evicts its first slot.
+// Clearing a key namespace bumps its generation, which is part of the hash, so old entries are no longer found and get
+// overwritten over time.
+class SharedCache {
+public:
+	enum Result {
+		srMiss = 0,
+		srAllow,
+		srBlock
+	};
+
+	SharedCache();
+	~SharedCache();
+
+	// Maps (and creates, if needed) the segment name with room for entries verdicts. Fails when the segment exists
+	// with another size: other workers may still use it, all of them have to be configured with the same cache size.
+	bool Open(const std::string &name, unsigned int entries, std::string &error);
+	const std::string &Name() const { return name; }
+	unsigned int Capacity() const { return capacity; }
+
+	// generationSlot selects one of the independently cleared key namespaces
+	Result Lookup(unsigned int generationSlot, uint64_t hash) const;
+	void Insert(unsigned int generationSlot, uint64_t hash, bool blocked);
+	void Clear(unsigned int generationSlot);
+
+	uint64_t Entries() const; // occupied slots, including ones of a previous generation
+	uint64_t Evictions() const;
+
+	static const unsigned int generationSlots = 2;
+
+private:
+	static const unsigned int probeWindow = 8; // slots, one cache line
+	static const uint32_t layoutVersion = 2;
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		std::atomic<uint32_t> state; // 0 in a new segment, 2 while its creator fills in the header, 1 when ready
+		uint64_t slotCount; // power of two
+		std::atomic<uint64_t> used;
+		std::atomic<uint64_t> evictions;
+		std::atomic<uint64_t> instance; // getppid() of the workers that use the segment, see Open()
+		alignas(64) std::atomic<uint32_t> generations[generationSlots];
+	};
+
+	std::string name;
+	unsigned int capacity;
+	Header *header;
+	std::atomic<uint64_t> *slots;
+	size_t mappedSize;
+
+	uint64_t Slot(unsigned int generationSlot, uint64_t hash, size_t &index) const;
+	void Close();
+
+	/* prohibited and not implemented */
+	SharedCache(const SharedCache&);
+	SharedCache &operator=(const SharedCache&);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef ECAP_NBLOCK_SNAPSHOTPOINTER_H
+#define ECAP_NBLOCK_SNAPSHOTPOINTER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Holds an immutable snapshot of T that can be read without taking a lock (RCU style).
+// Readers pin the current snapshot with a ReadGuard for the duration of a lookup. Publish() swaps in a new snapshot
+// atomically and reclaims the previous one once every reader that could still see it has released its guard.
+//
+// Readers register in one of two counters selected by the parity of the publish epoch. A writer flips the epoch twice
+// and waits for the counter of the previous parity to drain each time, after which no reader can hold the old pointer.
+template <class T>
+class SnapshotPointer {
+public:
+	class ReadGuard {
+	public:
+		ReadGuard(ReadGuard &&other): owner(other.owner), slot(other.slot), snapshot(other.snapshot) { other.owner = nullptr; }
+		~ReadGuard()
+		{
+			if (owner)
+				owner->readers[slot].fetch_sub(1);
+		}
+
+		T *get() const { return snapshot; }
+		T *operator ->() const { return snapshot; }
+		T &operator *() const { return *snapshot; }
+
+	private:
+		friend class SnapshotPointer;
+
+		ReadGuard(const SnapshotPointer *aOwner):
+			owner(aOwner)
+		{
+			slot = owner->epoch.load() & 1;
+			owner->readers[slot].fetch_add(1);
+			snapshot = owner->current.load();
+		}
+
+		/* prohibited and not implemented */
+		ReadGuard(const ReadGuard&);
+		ReadGuard &operator=(const ReadGuard&);
+
+		const SnapshotPointer *owner;
+		unsigned int slot;
+		T *snapshot;
+	};
+
+	SnapshotPointer():
+		current(new T()),
+		epoch(0)
+	{
+		readers[0] = 0;
+		readers[1] = 0;
+	}
+
+	~SnapshotPointer()
+	{
+		delete current.load();
+	}
+
+	// Pins the current snapshot, the guard must be released before the same thread calls Publish()
+	ReadGuard Read() const
+	{
+		return ReadGuard(this);
+	}
+
+	// Makes next the current snapshot, blocks until no reader can observe the previous one and deletes it
+	void Publish(std::unique_ptr<T> next)
+	{
+		std::lock_guard<std::mutex> lock(mutexPublish);
+
+		T *previous = current.exchange(next.release());
+
+		for (int phase = 0; phase < 2; phase++)
+		{
+			unsigned int drain = epoch.fetch_add(1) & 1;
+			while (readers[drain].load() != 0)
+				std::this_thread::yield();
+		}
+
+		delete previous;
+	}
+
+private:
+	/* prohibited and not implemented */
+	SnapshotPointer(const SnapshotPointer&);
+	SnapshotPointer &operator=(const SnapshotPointer&);
+
+	std::atomic<T *> current;
+	mutable std::atomic<unsigned int> epoch;
+	mutable std::atomic<unsigned int> readers[2];
+	std::mutex mutexPublish;
+};
+
+#endif
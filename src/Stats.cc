@@ -0,0 +1,249 @@
+#include "Stats.h"
+#include "DecisionCache.h"
+
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+static const char *stageNames[Stats::stageCount] = {"request", "dns", "classify", "cache", "match"};
+
+// Coarse le= boundaries for the exported histograms, the fine buckets are only used for the quantiles
+static const double exportBounds[] = {100e-9, 250e-9, 500e-9, 1e-6, 2.5e-6, 5e-6, 10e-6, 25e-6, 50e-6, 100e-6, 250e-6, 500e-6,
+	1e-3, 2.5e-3, 5e-3, 10e-3, 25e-3, 50e-3, 100e-3, 250e-3, 1};
+
+Stats::Stats():
+	startTicks(Now()),
+	startTime(std::chrono::steady_clock::now())
+{
+}
+
+Stats::ThreadStats &Stats::Local()
+{
+	// Gives the block back when the thread exits, so pools that come and go do not grow the list
+	struct ThreadSlot {
+		ThreadStats *stats = nullptr;
+		~ThreadSlot() { if (stats) Stats::getInstance().Release(stats); }
+	};
+	thread_local ThreadSlot slot;
+
+	if (!slot.stats)
+		slot.stats = Acquire();
+	return *slot.stats;
+}
+
+Stats::ThreadStats *Stats::Acquire()
+{
+	std::lock_guard<std::mutex> lock(mutexThreads);
+
+	for (ThreadStats *stats : Threads)
+	{
+		if (!stats->inUse)
+		{
+			stats->inUse = true;
+			return stats;
+		}
+	}
+
+	ThreadStats *stats = new ThreadStats();
+	for (auto &counter : stats->counters)
+		counter.store(0, std::memory_order_relaxed);
+	for (auto &sum : stats->sums)
+		sum.store(0, std::memory_order_relaxed);
+	for (auto &stage : stats->buckets)
+		for (auto &bucket : stage)
+			bucket.store(0, std::memory_order_relaxed);
+	stats->inUse = true;
+
+	Threads.push_back(stats);
+	return stats;
+}
+
+void Stats::Release(ThreadStats *stats)
+{
+	std::lock_guard<std::mutex> lock(mutexThreads);
+	stats->inUse = false;
+}
+
+void Stats::Aggregate(Snapshot &snapshot)
+{
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	std::lock_guard<std::mutex> lock(mutexThreads);
+	for (ThreadStats *stats : Threads)
+	{
+		for (unsigned int i = 0; i < counterCount; i++)
+			snapshot.counters[i] += stats->counters[i].load(std::memory_order_relaxed);
+
+		for (unsigned int stage = 0; stage < stageCount; stage++)
+		{
+			snapshot.sums[stage] += stats->sums[stage].load(std::memory_order_relaxed);
+			for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+				snapshot.buckets[stage][bucket] += stats->buckets[stage][bucket].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+uint64_t Stats::BucketUpperBound(unsigned int bucket)
+{
+	if (bucket < (1u << subBucketBits))
+		return bucket + 1;
+
+	const unsigned int bits = (bucket >> subBucketBits) + subBucketBits - 1;
+	const uint64_t subBucket = bucket & ((1u << subBucketBits) - 1);
+	const unsigned int shift = bits - subBucketBits;
+	return (((1ull << subBucketBits) + subBucket + 1) << shift);
+}
+
+double Stats::TicksPerSecond() const
+{
+#if defined(__x86_64__) || defined(__i386__)
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	if (seconds < 0.001)
+		return 1e9; // too early to tell, any sensible TSC runs at GHz rates
+	return (Now() - startTicks) / seconds;
+#else
+	return 1e9;
+#endif
+}
+
+double Stats::Quantile(const uint64_t *buckets, double fraction)
+{
+	uint64_t total = 0;
+	for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+		total += buckets[bucket];
+	if (total == 0)
+		return 0;
+
+	const uint64_t rank = (uint64_t)(fraction * (total - 1)) + 1;
+	uint64_t seen = 0;
+	for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+	{
+		seen += buckets[bucket];
+		if (seen >= rank)
+			return BucketUpperBound(bucket);
+	}
+	return BucketUpperBound(bucketCount - 1);
+}
+
+void Stats::WritePrometheus(std::ostream &os)
+{
+	std::unique_ptr<Snapshot> snapshot(new Snapshot());
+	Aggregate(*snapshot);
+	const double ticksPerSecond = TicksPerSecond();
+
+	os << "# HELP nblock_requests_total Requests checked by the nBlock request filters.\n";
+	os << "# TYPE nblock_requests_total counter\n";
+	os << "nblock_requests_total " << snapshot->counters[scRequests] << "\n";
+	os << "# HELP nblock_bypassed_total Requests of list_bypass= hosts, not checked.\n";
+	os << "# TYPE nblock_bypassed_total counter\n";
+	os << "nblock_bypassed_total " << snapshot->counters[scBypassed] << "\n";
+
+	os << "# HELP nblock_blocked_total Requests blocked, by the filter that blocked them.\n";
+	os << "# TYPE nblock_blocked_total counter\n";
+	os << "nblock_blocked_total{filter=\"dns\"} " << snapshot->counters[scBlockedDns] << "\n";
+	os << "nblock_blocked_total{filter=\"adblock\"} " << snapshot->counters[scBlockedAdblock] << "\n";
+
+	os << "# HELP nblock_adblock_canonical_keys_total Adblock cache keys with query string tokens left out, and cache hits on them.\n";
+	os << "# TYPE nblock_adblock_canonical_keys_total counter\n";
+	os << "nblock_adblock_canonical_keys_total{result=\"rewritten\"} " << snapshot->counters[scCanonicalKeys] << "\n";
+	os << "nblock_adblock_canonical_keys_total{result=\"hit\"} " << snapshot->counters[scCanonicalHits] << "\n";
+
+	os << "# HELP nblock_adblock_host_verdicts_total Adblock requests answered per host: blocked by a cached host verdict, or matched against the host filters.\n";
+	os << "# TYPE nblock_adblock_host_verdicts_total counter\n";
+	os << "nblock_adblock_host_verdicts_total{result=\"hit\"} " << snapshot->counters[scHostHits] << "\n";
+	os << "nblock_adblock_host_verdicts_total{result=\"match\"} " << snapshot->counters[scHostMatches] << "\n";
+
+	os << "# HELP nblock_bodies_total Response bodies while body_scan= is set, scanned or passed on untouched.\n";
+	os << "# TYPE nblock_bodies_total counter\n";
+	os << "nblock_bodies_total{result=\"scanned\"} " << snapshot->counters[scBodiesScanned] << "\n";
+	os << "nblock_bodies_total{result=\"passed\"} " << snapshot->counters[scBodiesPassed] << "\n";
+	os << "nblock_bodies_total{result=\"error\"} " << snapshot->counters[scBodyErrors] << "\n";
+	os << "# HELP nblock_body_bytes_total Bytes of scanned response bodies, as received and as sent on.\n";
+	os << "# TYPE nblock_body_bytes_total counter\n";
+	os << "nblock_body_bytes_total{direction=\"in\"} " << snapshot->counters[scBodyBytesIn] << "\n";
+	os << "nblock_body_bytes_total{direction=\"out\"} " << snapshot->counters[scBodyBytesOut] << "\n";
+	os << "# HELP nblock_cosmetic_pages_total Pages the element hiding stylesheet was spliced into, and its bytes.\n";
+	os << "# TYPE nblock_cosmetic_pages_total counter\n";
+	os << "nblock_cosmetic_pages_total " << snapshot->counters[scCosmeticPages] << "\n";
+	os << "# HELP nblock_cosmetic_bytes_total Bytes of element hiding stylesheets spliced into pages.\n";
+	os << "# TYPE nblock_cosmetic_bytes_total counter\n";
+	os << "nblock_cosmetic_bytes_total " << snapshot->counters[scCosmeticBytes] << "\n";
+
+	os << "# HELP nblock_block_responses_total Blocked requests nBlock answered itself instead of Squid's error page, by response.\n";
+	os << "# TYPE nblock_block_responses_total counter\n";
+	os << "nblock_block_responses_total{response=\"image\"} " << snapshot->counters[scRespondedImage] << "\n";
+	os << "nblock_block_responses_total{response=\"script\"} " << snapshot->counters[scRespondedScript] << "\n";
+	os << "nblock_block_responses_total{response=\"stylesheet\"} " << snapshot->counters[scRespondedStylesheet] << "\n";
+	os << "nblock_block_responses_total{response=\"no_content\"} " << snapshot->counters[scRespondedNoContent] << "\n";
+
+	os << "# HELP nblock_cdn_hits_total Requests for CDN resources answered from the local store.\n";
+	os << "# TYPE nblock_cdn_hits_total counter\n";
+	os << "nblock_cdn_hits_total " << snapshot->counters[scCdnHits] << "\n";
+	os << "# HELP nblock_cdn_bytes_saved_total Body bytes of CDN resources answered from the local store instead of the CDN.\n";
+	os << "# TYPE nblock_cdn_bytes_saved_total counter\n";
+	os << "nblock_cdn_bytes_saved_total " << snapshot->counters[scCdnBytes] << "\n";
+
+	os << "# HELP nblock_block_log_events_total Block log events, by what happened to them.\n";
+	os << "# TYPE nblock_block_log_events_total counter\n";
+	os << "nblock_block_log_events_total{result=\"written\"} " << snapshot->counters[scLogWritten] << "\n";
+	os << "nblock_block_log_events_total{result=\"suppressed\"} " << snapshot->counters[scLogSuppressed] << "\n";
+	os << "nblock_block_log_events_total{result=\"dropped\"} " << snapshot->counters[scLogDropped] << "\n";
+
+	DecisionCache::Counters cache = DecisionCache::getInstance().GetCounters();
+	os << "# HELP nblock_cache_lookups_total Verdict cache lookups, by result.\n";
+	os << "# TYPE nblock_cache_lookups_total counter\n";
+	os << "nblock_cache_lookups_total{result=\"hit\"} " << cache.hits << "\n";
+	os << "nblock_cache_lookups_total{result=\"miss\"} " << cache.misses << "\n";
+	os << "# HELP nblock_cache_evictions_total Verdict cache entries evicted to make room.\n";
+	os << "# TYPE nblock_cache_evictions_total counter\n";
+	os << "nblock_cache_evictions_total " << cache.evictions << "\n";
+	os << "# HELP nblock_cache_entries Verdict cache entries.\n";
+	os << "# TYPE nblock_cache_entries gauge\n";
+	os << "nblock_cache_entries " << cache.entries << "\n";
+
+	os << "# HELP nblock_stage_duration_seconds Time spent per filter stage.\n";
+	os << "# TYPE nblock_stage_duration_seconds histogram\n";
+	for (unsigned int stage = 0; stage < stageCount; stage++)
+	{
+		const uint64_t *buckets = snapshot->buckets[stage];
+		unsigned int bucket = 0;
+		uint64_t cumulative = 0;
+
+		for (double bound : exportBounds)
+		{
+			// A fine bucket is counted below the first boundary that holds all of it
+			while (bucket < bucketCount && BucketUpperBound(bucket) / ticksPerSecond <= bound)
+				cumulative += buckets[bucket++];
+			os << "nblock_stage_duration_seconds_bucket{stage=\"" << stageNames[stage] << "\",le=\"" << bound << "\"} " << cumulative << "\n";
+		}
+		while (bucket < bucketCount)
+			cumulative += buckets[bucket++];
+
+		os << "nblock_stage_duration_seconds_bucket{stage=\"" << stageNames[stage] << "\",le=\"+Inf\"} " << cumulative << "\n";
+		os << "nblock_stage_duration_seconds_sum{stage=\"" << stageNames[stage] << "\"} " << snapshot->sums[stage] / ticksPerSecond << "\n";
+		os << "nblock_stage_duration_seconds_count{stage=\"" << stageNames[stage] << "\"} " << cumulative << "\n";
+	}
+
+	os << "# HELP nblock_stage_duration_quantile_seconds Latency quantiles per filter stage since startup (12.5% precision).\n";
+	os << "# TYPE nblock_stage_duration_quantile_seconds gauge\n";
+	for (unsigned int stage = 0; stage < stageCount; stage++)
+	{
+		for (double quantile : {0.5, 0.99, 0.999})
+		{
+			os << "nblock_stage_duration_quantile_seconds{stage=\"" << stageNames[stage] << "\",quantile=\"" << quantile << "\"} "
+				<< Quantile(snapshot->buckets[stage], quantile) / ticksPerSecond << "\n";
+		}
+	}
+}
+
+void Stats::WriteSummary(std::ostream &os)
+{
+	std::unique_ptr<Snapshot> snapshot(new Snapshot());
+	Aggregate(*snapshot);
+	const double ticksPerMicrosecond = TicksPerSecond() / 1e6;
+
+	os << "requests: " << snapshot->counters[scRequests] << ", blocked: " << snapshot->counters[scBlockedDns] << " dns / "
+		<< snapshot->counters[scBlockedAdblock] << " adblock, p99 us:";
+	for (unsigned int stage = 0; stage < stageCount; stage++)
+		os << " " << stageNames[stage] << " " << std::setprecision(3) << Quantile(snapshot->buckets[stage], 0.99) / ticksPerMicrosecond;
+}
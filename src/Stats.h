@@ -0,0 +1,151 @@
+#ifndef ECAP_NBLOCK_STATS_H
+#define ECAP_NBLOCK_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Per stage latency histograms and request counters, cheap enough to stay enabled.
+// Every thread writes to its own block of relaxed atomics (single writer, no locked instructions), blocks are only
+// summed when the statistics are read. Latencies are kept in ticks (TSC on x86, nanoseconds elsewhere) in log-linear
+// buckets with 8 sub buckets per power of two (HDR style, 12.5% precision), ticks are converted when reading.
+class Stats {
+public:
+	enum Stage {
+		stRequest, // Xaction::start() until the verdict is applied
+		stDns, // NetFilterDns::IsBlackListed(), cache probe included
+		stClassify, // RequestClassifier::Classify()
+		stCache, // DecisionCache::Lookup(), both filters
+		stMatch, // AdBlockClient::matches()
+		stageCount
+	};
+
+	enum Counter {
+		scRequests,
+		scBypassed, // requests of list_bypass= hosts, turned away by wantsUrl() or passed on untouched by the transaction
+		scBlockedDns,
+		scBlockedAdblock,
+		scLogWritten, // block_log events written
+		scLogSuppressed, // block_log events skipped by sampling or the rate limit
+		scLogDropped, // block_log events dropped because the ring of the thread was full
+		scCanonicalKeys, // Adblock cache keys with query string tokens left out, see UriCanonicalizer
+		scCanonicalHits, // cache hits on such keys, an upper bound for the hits gained by leaving them out
+		scHostHits, // Adblock requests blocked by a cached host level verdict, see AdblockHostIndex
+		scHostMatches, // requests matched against the host filters alone
+		scBodiesScanned, // responses whose body goes through the body_scan= scanners
+		scBodiesPassed, // responses passed on untouched while body_scan= is set (type, encoding, or no scanner wanted them)
+		scBodyBytesIn, // virgin body bytes, as sent by the server
+		scBodyBytesOut, // adapted body bytes, encoded again
+		scBodyErrors, // bodies that could not be decoded and were truncated
+		scCosmeticPages, // pages the cosmetic scanner spliced a stylesheet into
+		scCosmeticBytes, // bytes of those stylesheets
+		scRespondedImage, // blocked requests answered by nBlock itself (block_response=), per response
+		scRespondedScript,
+		scRespondedStylesheet,
+		scRespondedNoContent,
+		scCdnHits, // requests answered from the CDN store (cdn_store=)
+		scCdnBytes, // body bytes of those answers, not fetched from the CDN
+		counterCount
+	};
+
+	static Stats& getInstance()
+	{
+		static Stats instance;
+		return instance;
+	}
+
+	static uint64_t Now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	void Record(Stage stage, uint64_t startTicks)
+	{
+		ThreadStats &stats = Local();
+		const uint64_t ticks = Now() - startTicks;
+		Add(stats.buckets[stage][BucketOf(ticks)], 1);
+		Add(stats.sums[stage], ticks);
+	}
+
+	void Count(Counter counter, uint64_t amount = 1)
+	{
+		Add(Local().counters[counter], amount);
+	}
+
+	// Prometheus text exposition format, eg for the node_exporter textfile collector
+	void WritePrometheus(std::ostream &os);
+
+	// One line summary for Service::describe()
+	void WriteSummary(std::ostream &os);
+
+private:
+	static const unsigned int subBucketBits = 3;
+	static const unsigned int maxBits = 40; // ~18 minutes at 1 tick per ns, longer latencies land in the last bucket
+	static const unsigned int bucketCount = (maxBits - subBucketBits + 1) << subBucketBits;
+
+	struct alignas(64) ThreadStats {
+		std::atomic<uint64_t> counters[counterCount];
+		std::atomic<uint64_t> sums[stageCount];
+		std::atomic<uint64_t> buckets[stageCount][bucketCount];
+		bool inUse;
+	};
+
+	struct Snapshot {
+		uint64_t counters[counterCount];
+		uint64_t sums[stageCount];
+		uint64_t buckets[stageCount][bucketCount];
+	};
+
+	Stats();
+
+	std::mutex mutexThreads; // guards Threads, only taken when a thread records for the first time and when reading
+	std::vector<ThreadStats *> Threads; // never freed, blocks of exited threads are reused and keep their counts
+
+	// Tick rate, measured against the steady clock over the lifetime of the process
+	uint64_t startTicks;
+	std::chrono::steady_clock::time_point startTime;
+
+	static void Add(std::atomic<uint64_t> &value, uint64_t amount)
+	{
+		value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	static unsigned int BucketOf(uint64_t ticks)
+	{
+		if (ticks < (1u << subBucketBits))
+			return ticks;
+
+		unsigned int bits = 63 - __builtin_clzll(ticks);
+		if (bits >= maxBits)
+			return bucketCount - 1;
+
+		const unsigned int shift = bits - subBucketBits;
+		return ((bits - subBucketBits + 1) << subBucketBits) + ((ticks >> shift) & ((1u << subBucketBits) - 1));
+	}
+	static uint64_t BucketUpperBound(unsigned int bucket); // exclusive, in ticks
+
+	ThreadStats &Local();
+	ThreadStats *Acquire();
+	void Release(ThreadStats *stats);
+	void Aggregate(Snapshot &snapshot);
+	double TicksPerSecond() const;
+	static double Quantile(const uint64_t *buckets, double fraction);
+
+	/* prohibited and not implemented */
+	Stats(const Stats&);
+	Stats &operator=(const Stats&);
+};
+
+#endif
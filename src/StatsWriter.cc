@@ -0,0 +1,82 @@
+#include "StatsWriter.h"
+#include "Debugger.h"
+#include "Stats.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+StatsWriter::StatsWriter():
+	intervalSeconds(10),
+	stopping(false)
+{
+}
+
+StatsWriter::~StatsWriter()
+{
+	Stop();
+}
+
+void StatsWriter::Start(const std::string &aFileName, unsigned int aIntervalSeconds)
+{
+	Stop();
+
+	if (aFileName.empty())
+		return;
+
+	fileName = aFileName;
+	intervalSeconds = aIntervalSeconds ? aIntervalSeconds : 1;
+	stopping = false;
+	writerThread = std::thread(&StatsWriter::Run, this);
+}
+
+void StatsWriter::Stop()
+{
+	if (!writerThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutexStop);
+		stopping = true;
+	}
+	stopRequested.notify_all();
+	writerThread.join();
+}
+
+void StatsWriter::Run()
+{
+	std::unique_lock<std::mutex> lock(mutexStop);
+
+	while (!stopping)
+	{
+		stopRequested.wait_for(lock, std::chrono::seconds(intervalSeconds), [this] { return stopping; });
+
+		lock.unlock();
+		Write();
+		lock.lock();
+	}
+}
+
+void StatsWriter::Write()
+{
+	const std::string tempName = fileName + ".tmp";
+	{
+		std::ofstream statsFile(tempName, std::ios::trunc);
+		if (statsFile)
+		{
+			Stats::getInstance().WritePrometheus(statsFile);
+			statsFile.close();
+		}
+
+		if (!statsFile)
+		{
+			Debugger(ilCritical | flApplication) << "[nBlock] Unable to write statistics to " << tempName << ": " << strerror(errno);
+			return;
+		}
+	}
+
+	if (rename(tempName.c_str(), fileName.c_str()) != 0)
+		Debugger(ilCritical | flApplication) << "[nBlock] Unable to replace " << fileName << ": " << strerror(errno);
+}
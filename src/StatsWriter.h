@@ -0,0 +1,37 @@
+#ifndef ECAP_NBLOCK_STATSWRITER_H
+#define ECAP_NBLOCK_STATSWRITER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Background thread that periodically writes the Stats in Prometheus text format to a file (stats_file=), eg into the
+// directory of the node_exporter textfile collector. The file is replaced atomically, scrapers never see half of it.
+class StatsWriter {
+public:
+	StatsWriter();
+	~StatsWriter();
+
+	void Start(const std::string &aFileName, unsigned int aIntervalSeconds); // restarts the writer if it is already running
+	void Stop(); // writes the file one last time
+	bool Running() const { return writerThread.joinable(); }
+
+private:
+	std::string fileName;
+	unsigned int intervalSeconds;
+
+	std::thread writerThread;
+	std::mutex mutexStop;
+	std::condition_variable stopRequested;
+	bool stopping;
+
+	void Run();
+	void Write();
+
+	/* prohibited and not implemented */
+	StatsWriter(const StatsWriter&);
+	StatsWriter &operator=(const StatsWriter&);
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include "UriCanonicalizer.h"
+#include "AdblockMatcher.h"
+#include "Hash.h"
+
+#include <cstring>
+
+static const char serializedMagic[4] = {'n', 'B', 'u', 'c'};
+
+const size_t UriCanonicalizer::maxTokenLength; // std::min() takes it by reference
+
+static inline bool IsTokenChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static inline char LowerCase(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+UriCanonicalizer::UriCanonicalizer():
+	lengths{0, 0, 0, 0},
+	filterTokens(0),
+	regexFilters(0)
+{
+}
+
+uint64_t UriCanonicalizer::Seed(Fit fit)
+{
+	const char fitByte = 'A' + fit;
+	return HashFnv1a(&fitByte, 1);
+}
+
+void UriCanonicalizer::Build(const std::string &rules)
+{
+	bitmap.assign(bitmapBits / 64, 0);
+	memset(lengths, 0, sizeof(lengths));
+	placeholder.clear();
+	filterTokens = 0;
+	regexFilters = 0;
+
+	for (size_t lineStart = 0; lineStart < rules.size();)
+	{
+		size_t lineEnd = rules.find('\n', lineStart);
+		if (lineEnd == std::string::npos)
+			lineEnd = rules.size();
+
+		AddFilter(std::string_view(rules).substr(lineStart, lineEnd - lineStart));
+		lineStart = lineEnd + 1;
+	}
+
+	if (regexFilters == 0)
+		ChoosePlaceholder();
+}
+
+void UriCanonicalizer::AddFilter(std::string_view filter)
+{
+	while (!filter.empty() && (filter.back() == '\r' || filter.back() == ' '))
+		filter.remove_suffix(1);
+
+	// Comments, the list header and cosmetic filters never look at the uri
+	if (filter.empty() || filter[0] == '!' || filter[0] == '[' || filter.find('#') != std::string_view::npos)
+		return;
+
+	// Exception filters can change a verdict just as well, their pattern counts the same
+	if (filter.compare(0, 2, "@@") == 0)
+		filter.remove_prefix(2);
+
+	// The same regex detection as the native matcher: /foo$/ is an expression, not the pattern /foo with options
+	bool regex = false;
+	const size_t optionsPos = AdblockMatcher::OptionsStart(filter, regex);
+	if (regex)
+	{
+		regexFilters++;
+		return;
+	}
+	std::string_view pattern = filter.substr(0, optionsPos);
+
+	// Anchors (|http, ||host, gif|) pin the pattern to the start of the uri, a host or the end of the uri
+	bool startAnchored = false, endAnchored = false;
+	if (!pattern.empty() && pattern.front() == '|')
+	{
+		startAnchored = true;
+		pattern.remove_prefix(pattern.compare(0, 2, "||") == 0 ? 2 : 1);
+	}
+	if (!pattern.empty() && pattern.back() == '|')
+	{
+		endAnchored = true;
+		pattern.remove_suffix(1);
+	}
+
+	for (size_t position = 0; position < pattern.size();)
+	{
+		if (!IsTokenChar(pattern[position]))
+		{
+			position++;
+			continue;
+		}
+
+		const size_t start = position;
+		while (position < pattern.size() && IsTokenChar(pattern[position]))
+			position++;
+
+		// Anything but a * next to the token is a character that does not belong to a uri token (or ^, which can not
+		// match one), so the token has to line up with the start / end of a uri token on that side
+		const bool leftBounded = (start == 0) ? startAnchored : pattern[start - 1] != '*';
+		const bool rightBounded = (position == pattern.size()) ? endAnchored : pattern[position] != '*';
+		const Fit fit = leftBounded ? (rightBounded ? tfExact : tfPrefix) : (rightBounded ? tfSuffix : tfInfix);
+
+		AddToken(fit, pattern.substr(start, position - start));
+	}
+}
+
+void UriCanonicalizer::AddToken(Fit fit, std::string_view token)
+{
+	// Cutting a long token keeps the side it is bounded on, the cut token matches at least where the full one does
+	if (token.size() > maxTokenLength)
+	{
+		if (fit == tfSuffix)
+			token = token.substr(token.size() - maxTokenLength);
+		else
+			token = token.substr(0, maxTokenLength);
+
+		if (fit == tfExact)
+			fit = tfPrefix;
+	}
+
+	char lowered[maxTokenLength];
+	for (size_t i = 0; i < token.size(); i++)
+		lowered[i] = LowerCase(token[i]);
+
+	// Suffixes are hashed from the right, the way Fits() walks a uri token looking for them
+	const uint64_t hash = (fit == tfSuffix) ? HashFnv1aReverse(lowered, token.size(), Seed(fit)) : HashFnv1a(lowered, token.size(), Seed(fit));
+	const uint64_t bit = Bit(hash);
+
+	bitmap[bit / 64] |= 1ull << (bit % 64);
+	lengths[fit] |= 1ull << (token.size() - 1);
+	filterTokens++;
+}
+
+bool UriCanonicalizer::Fits(const char *token, size_t length) const
+{
+	// Only probe for lengths some filter token of that fit actually has
+	if (length <= maxTokenLength && ((lengths[tfExact] >> (length - 1)) & 1) && Test(HashFnv1a(token, length, Seed(tfExact))))
+		return true;
+
+	const size_t shortest = std::min(length, maxTokenLength);
+
+	uint64_t prefixHash = Seed(tfPrefix), suffixHash = Seed(tfSuffix);
+	for (size_t size = 1; size <= shortest; size++)
+	{
+		prefixHash = (prefixHash ^ (unsigned char)token[size - 1]) * HashFnvPrime;
+		suffixHash = (suffixHash ^ (unsigned char)token[length - size]) * HashFnvPrime;
+
+		if (((lengths[tfPrefix] >> (size - 1)) & 1) && Test(prefixHash))
+			return true;
+		if (((lengths[tfSuffix] >> (size - 1)) & 1) && Test(suffixHash))
+			return true;
+	}
+
+	if (!lengths[tfInfix])
+		return false;
+
+	const size_t longestInfix = 64 - __builtin_clzll(lengths[tfInfix]);
+	for (size_t start = 0; start < length; start++)
+	{
+		uint64_t infixHash = Seed(tfInfix);
+		const size_t longest = std::min(longestInfix, length - start);
+
+		for (size_t size = 1; size <= longest; size++)
+		{
+			infixHash = (infixHash ^ (unsigned char)token[start + size - 1]) * HashFnvPrime;
+			if (((lengths[tfInfix] >> (size - 1)) & 1) && Test(infixHash))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void UriCanonicalizer::ChoosePlaceholder()
+{
+	// The placeholder has to be a token no filter fits into either, the shortest one will do
+	static const char characters[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	const size_t count = sizeof(characters) - 1;
+
+	for (size_t first = 0; first < count; first++)
+	{
+		if (!Fits(&characters[first], 1))
+		{
+			placeholder.assign(1, characters[first]);
+			return;
+		}
+	}
+
+	for (size_t first = 0; first < count; first++)
+	{
+		for (size_t second = 0; second < count; second++)
+		{
+			const char candidate[2] = {characters[first], characters[second]};
+			if (!Fits(candidate, 2))
+			{
+				placeholder.assign(candidate, 2);
+				return;
+			}
+		}
+	}
+}
+
+bool UriCanonicalizer::AppendKey(std::string_view uri, std::string &key) const
+{
+	const size_t queryPos = uri.find('?');
+	if (!Enabled() || queryPos == std::string_view::npos)
+	{
+		key.append(uri.data(), uri.size());
+		return false;
+	}
+
+	// Scheme, host and path stay as they are
+	key.append(uri.data(), queryPos + 1);
+
+	bool changed = false;
+	char lowered[maxUriToken];
+
+	for (size_t position = queryPos + 1; position < uri.size();)
+	{
+		if (!IsTokenChar(uri[position]))
+		{
+			key.push_back(uri[position++]);
+			continue;
+		}
+
+		const size_t start = position;
+		while (position < uri.size() && IsTokenChar(uri[position]))
+			position++;
+
+		const size_t length = position - start;
+		if (length <= maxUriToken)
+		{
+			for (size_t i = 0; i < length; i++)
+				lowered[i] = LowerCase(uri[start + i]);
+
+			if (!Fits(lowered, length))
+			{
+				key.append(placeholder);
+				changed = true;
+				continue;
+			}
+		}
+
+		key.append(uri.data() + start, length);
+	}
+
+	return changed;
+}
+
+std::string UriCanonicalizer::Serialize() const
+{
+	SerializedHeader header;
+	memcpy(header.magic, serializedMagic, sizeof(serializedMagic));
+	header.placeholderLength = placeholder.size();
+	header.filterTokens = filterTokens;
+	header.regexFilters = regexFilters;
+	memcpy(header.lengths, lengths, sizeof(lengths));
+
+	std::string serialized((const char *)&header, sizeof(header));
+	serialized.append((const char *)bitmap.data(), bitmap.size() * sizeof(uint64_t));
+	serialized.append(placeholder);
+	return serialized;
+}
+
+bool UriCanonicalizer::Deserialize(const char *data, size_t size)
+{
+	SerializedHeader header;
+	const size_t bitmapBytes = bitmapBits / 8;
+	if (size < sizeof(header))
+		return false;
+
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, serializedMagic, sizeof(serializedMagic)) != 0 || size != sizeof(header) + bitmapBytes + header.placeholderLength)
+		return false;
+
+	bitmap.resize(bitmapBits / 64);
+	memcpy(bitmap.data(), data + sizeof(header), bitmapBytes);
+	memcpy(lengths, header.lengths, sizeof(lengths));
+	placeholder.assign(data + sizeof(header) + bitmapBytes, header.placeholderLength);
+	filterTokens = header.filterTokens;
+	regexFilters = header.regexFilters;
+
+	return true;
+}
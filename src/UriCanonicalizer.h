@@ -0,0 +1,75 @@
+#ifndef ECAP_NBLOCK_URICANONICALIZER_H
+#define ECAP_NBLOCK_URICANONICALIZER_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Verdict cache keys for NetFilterAdblock that leave out what no loaded filter can look at, so cache busters, nonces and
+// tracking ids in the query string no longer turn every request into a cache miss.
+//
+// A filter pattern is literal text with * and ^ in between. Its alphanumeric runs ("filter tokens") can only match
+// inside a single alphanumeric run of the uri ("uri token"), because the characters around them are either non
+// alphanumeric themselves or match nothing alphanumeric (^). Where a filter token is bounded by such a character it has
+// to line up with the start or end of the uri token, where it touches a * or an open end of the pattern it does not.
+// A uri token that no filter token fits into can therefore be replaced by any other such token without changing whether
+// any filter matches: the query string tokens for which that holds are all replaced by one placeholder.
+//
+// The filter tokens are kept as hashes in a bitmap. A collision only means a uri token is kept that could have been
+// replaced. Regex filters can not be analyzed this way, with any of them loaded the query string is kept as is.
+class UriCanonicalizer {
+public:
+	UriCanonicalizer();
+
+	// Collects the filter tokens of rules (one filter per line, as passed to AdBlockClient::parse())
+	void Build(const std::string &rules);
+
+	// Binary form for a BlocklistImage, next to the serialized AdBlockClient
+	std::string Serialize() const;
+	bool Deserialize(const char *data, size_t size);
+
+	bool Enabled() const { return !placeholder.empty(); }
+	size_t FilterTokens() const { return filterTokens; }
+	size_t RegexFilters() const { return regexFilters; }
+
+	// Appends the key for uri to key. Returns true if it differs from uri.
+	bool AppendKey(std::string_view uri, std::string &key) const;
+
+private:
+	enum Fit {
+		tfExact, // bounded on both sides, has to be the whole uri token
+		tfPrefix, // bounded on the left only, the uri token starts with it
+		tfSuffix, // bounded on the right only, the uri token ends with it
+		tfInfix, // open on both sides, anywhere in the uri token
+		fitCount
+	};
+
+	static const unsigned int bitmapBits = 1 << 21;
+	static const size_t maxTokenLength = 63; // longer filter tokens are cut, which only makes them match more uri tokens
+	static const size_t maxUriToken = 256; // longer uri tokens are kept as they are
+
+	struct SerializedHeader {
+		char magic[4];
+		uint32_t placeholderLength;
+		uint64_t filterTokens;
+		uint64_t regexFilters;
+		uint64_t lengths[fitCount];
+	};
+
+	std::vector<uint64_t> bitmap;
+	uint64_t lengths[fitCount]; // bit n - 1 is set if there is a filter token of length n for that fit
+	std::string placeholder; // empty while disabled
+	size_t filterTokens;
+	size_t regexFilters;
+
+	void AddFilter(std::string_view filter);
+	void AddToken(Fit fit, std::string_view token);
+	void ChoosePlaceholder();
+	bool Fits(const char *token, size_t length) const; // token is in lowercase
+	bool Test(uint64_t hash) const { return (bitmap[Bit(hash) / 64] >> (Bit(hash) % 64)) & 1; }
+	static uint64_t Bit(uint64_t hash) { return (hash * 0x9e3779b97f4a7c15ull) >> (64 - 21); }
+	static uint64_t Seed(Fit fit);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "VerdictQueue.h"
+#include "BlockLog.h"
+#include "NetFilterAdblock.h"
+#include "NetFilterDns.h"
+#include "RecyclingPool.h"
+#include "Stats.h"
+
+VerdictQueue::VerdictQueue():
+	workerCount(0),
+	pendingJobs(0)
+{
+}
+
+void VerdictQueue::SetWorkers(unsigned int workers)
+{
+	if (workers == workerCount)
+		return;
+
+	// Destroying the old pool finishes its queued jobs, they still show up in TakeCompleted()
+	Pool.reset();
+	if (workers > 0)
+		Pool.reset(new WorkerPool(workers));
+
+	workerCount = workers;
+}
+
+std::shared_ptr<VerdictQueue::Job> VerdictQueue::NewJob()
+{
+	return std::allocate_shared<Job>(PoolAllocator<Job>());
+}
+
+void VerdictQueue::Submit(const std::shared_ptr<Job> &job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutexCompleted);
+		pendingJobs++;
+	}
+
+	// The closure carries a plain pointer: small enough for std::function to store without allocating, which a
+	// shared_ptr capture is not. The job keeps itself alive through queued until it is handed to Completed.
+	job->queued = job;
+	Job *queuedJob = job.get();
+	Pool->Submit([this, queuedJob]
+	{
+		queuedJob->verdict = Evaluate(*queuedJob);
+
+		std::lock_guard<std::mutex> lock(mutexCompleted);
+		Completed.push_back(std::move(queuedJob->queued));
+		pendingJobs--;
+	});
+}
+
+void VerdictQueue::TakeCompleted(std::vector<std::shared_ptr<Job>> &jobs)
+{
+	std::lock_guard<std::mutex> lock(mutexCompleted);
+	jobs.clear();
+	jobs.swap(Completed);
+}
+
+bool VerdictQueue::Idle()
+{
+	std::lock_guard<std::mutex> lock(mutexCompleted);
+	return pendingJobs == 0 && Completed.empty();
+}
+
+VerdictQueue::Verdict VerdictQueue::Evaluate(Job &job)
+{
+	Stats &stats = Stats::getInstance();
+	thread_local std::string rule; // the matching rule for the block log, copied to the job's arena
+
+	const uint64_t dnsStart = Stats::Now();
+	const bool blockedHost = NetFilterDns::getInstance().IsBlackListed(job.host);
+	stats.Record(Stats::stDns, dnsStart);
+
+	if (blockedHost)
+	{
+		stats.Count(Stats::scBlockedDns);
+		job.logEvent = BlockLog::getInstance().Admit();
+		if (job.logEvent && NetFilterDns::getInstance().MatchedEntry(job.host, rule))
+			job.rule = job.arena.Copy(rule);
+		return vtBlockHost;
+	}
+
+	// Ignore initial https connections (those should be covered by the dns filters)
+	if (job.uri.compare(0, 4, "http") == 0 &&
+		NetFilterAdblock::getInstance().IsBlackListed(job.uri, job.accept, job.xRequest, job.contentType, job.referer))
+	{
+		stats.Count(Stats::scBlockedAdblock);
+		job.logEvent = BlockLog::getInstance().Admit();
+		if (job.logEvent && NetFilterAdblock::getInstance().MatchedRule(job.uri, job.accept, job.xRequest, job.contentType, job.referer, rule))
+			job.rule = job.arena.Copy(rule);
+		return vtBlockRequest;
+	}
+
+	return vtAllow;
+}
@@ -0,0 +1,85 @@
+#ifndef ECAP_NBLOCK_VERDICTQUEUE_H
+#define ECAP_NBLOCK_VERDICTQUEUE_H
+
+#include "RequestArena.h"
+#include "WorkerPool.h"
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace libecap {
+	namespace host {
+		class Xaction;
+	}
+}
+
+// Evaluates request verdicts on a worker pool instead of Squid's main thread (async_workers=N).
+// Xaction::start() copies the request into a Job and submits it, the Service collects the finished jobs from its
+// resume() call on the main thread and resumes the matching host transactions, which then call Xaction::resume().
+class VerdictQueue {
+public:
+	enum Verdict {
+		vtAllow,
+		vtBlockHost, // NetFilterDns
+		vtBlockRequest // NetFilterAdblock
+	};
+
+	struct Job {
+		// Request copy in arena, the libecap message may only be touched on the main thread
+		RequestArena arena;
+		std::string_view host;
+		std::string_view uri;
+		std::string_view accept;
+		std::string_view xRequest;
+		std::string_view contentType;
+		std::string_view referer;
+
+		uint64_t started = 0; // Stats::Now() when the transaction started
+		Verdict verdict = vtAllow; // written by the worker
+		bool logEvent = false; // blocked and admitted to the block log, with the matching rule below
+		std::string_view rule; // in arena
+		libecap::host::Xaction *hostx = nullptr; // main thread only, reset when the transaction goes away first
+		std::shared_ptr<Job> queued; // the queue's reference from Submit() until the job is completed
+	};
+
+	// Jobs and their reference counts come from a RecyclingPool
+	static std::shared_ptr<Job> NewJob();
+
+	static VerdictQueue& getInstance()
+	{
+		static VerdictQueue instance;
+		return instance;
+	}
+
+	// 0 evaluates every request on the main thread. Main thread only, waits for the jobs of the previous pool.
+	void SetWorkers(unsigned int workers);
+	unsigned int Workers() const { return workerCount; }
+
+	void Submit(const std::shared_ptr<Job> &job);
+
+	// Hands out the jobs finished since the last call
+	void TakeCompleted(std::vector<std::shared_ptr<Job>> &jobs);
+	bool Idle();
+
+	// The filters in the same order Xaction::start() runs them synchronously
+	static Verdict Evaluate(Job &job);
+
+private:
+	VerdictQueue();
+
+	std::unique_ptr<WorkerPool> Pool;
+	unsigned int workerCount;
+
+	std::mutex mutexCompleted;
+	std::vector<std::shared_ptr<Job>> Completed;
+	size_t pendingJobs;
+
+	/* prohibited and not implemented */
+	VerdictQueue(const VerdictQueue&);
+	VerdictQueue &operator=(const VerdictQueue&);
+};
+
+#endif
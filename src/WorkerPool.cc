@@ -0,0 +1,87 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int workers):
+	queueHead(0),
+	queueCount(0),
+	runningJobs(0),
+	stopping(false)
+{
+	if (workers == 0)
+		workers = 1;
+
+	for (unsigned int i = 0; i < workers; i++)
+	{
+		Workers.push_back(std::thread(&WorkerPool::Run, this));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutexQueue);
+		stopping = true;
+	}
+	queueChanged.notify_all();
+
+	for (std::thread &worker : Workers)
+	{
+		worker.join();
+	}
+}
+
+void WorkerPool::Submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutexQueue);
+		if (queueCount == Queue.size())
+			Grow();
+		Queue[(queueHead + queueCount) % Queue.size()] = std::move(job);
+		queueCount++;
+	}
+	queueChanged.notify_one();
+}
+
+// Called with mutexQueue held. Unlike a deque, which allocates and frees blocks as jobs pass through, the ring only
+// allocates until it holds the largest backlog seen.
+void WorkerPool::Grow()
+{
+	std::vector<std::function<void()>> grown(Queue.empty() ? 64 : Queue.size() * 2);
+	for (size_t i = 0; i < queueCount; i++)
+		grown[i] = std::move(Queue[(queueHead + i) % Queue.size()]);
+
+	Queue.swap(grown);
+	queueHead = 0;
+}
+
+void WorkerPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutexQueue);
+	queueDrained.wait(lock, [this] { return queueCount == 0 && runningJobs == 0; });
+}
+
+void WorkerPool::Run()
+{
+	std::unique_lock<std::mutex> lock(mutexQueue);
+
+	while (true)
+	{
+		queueChanged.wait(lock, [this] { return stopping || queueCount > 0; });
+
+		if (queueCount == 0)
+			return; // stopping, and nothing left to do
+
+		std::function<void()> job = std::move(Queue[queueHead]);
+		Queue[queueHead] = nullptr;
+		queueHead = (queueHead + 1) % Queue.size();
+		queueCount--;
+		runningJobs++;
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		runningJobs--;
+		if (queueCount == 0 && runningJobs == 0)
+			queueDrained.notify_all();
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef ECAP_NBLOCK_WORKERPOOL_H
+#define ECAP_NBLOCK_WORKERPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads executing queued jobs in FIFO order
+class WorkerPool {
+public:
+	explicit WorkerPool(unsigned int workers);
+	~WorkerPool(); // finishes all queued jobs
+
+	void Submit(std::function<void()> job);
+	void Wait(); // blocks until the queue is empty and no job is running
+
+	unsigned int Size() const { return Workers.size(); }
+
+private:
+	std::mutex mutexQueue;
+	std::condition_variable queueChanged;
+	std::condition_variable queueDrained;
+	std::vector<std::function<void()>> Queue; // ring buffer of queueCount jobs from queueHead, grows but never shrinks
+	size_t queueHead;
+	size_t queueCount;
+	std::vector<std::thread> Workers;
+	unsigned int runningJobs;
+	bool stopping;
+
+	void Run();
+	void Grow();
+
+	/* prohibited and not implemented */
+	WorkerPool(const WorkerPool&);
+	WorkerPool &operator=(const WorkerPool&);
+};
+
+#endif
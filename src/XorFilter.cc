@@ -0,0 +1,161 @@
+#include "XorFilter.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const unsigned int maxAttempts = 64;
+
+static uint64_t SplitMix(uint64_t &state)
+{
+	uint64_t value = (state += 0x9e3779b97f4a7c15ull);
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+	return value ^ (value >> 31);
+}
+
+XorFilter::XorFilter():
+	header(nullptr),
+	fingerprints(nullptr)
+{
+}
+
+void XorFilter::Clear()
+{
+	header = nullptr;
+	fingerprints = nullptr;
+	Owned.clear();
+	Owned.shrink_to_fit();
+	attachedMemory.reset();
+}
+
+bool XorFilter::Build(std::vector<uint64_t> keys)
+{
+	Clear();
+
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	if (keys.empty() || keys.size() > 0xffffffff)
+		return false;
+
+	// 1.23 slots per key is what makes peeling succeed with high probability
+	const uint32_t blockLength = (32 + 1.23 * keys.size()) / 3;
+	const size_t capacity = 3 * (size_t)blockLength;
+
+	Owned.assign(sizeof(Header) + capacity, 0);
+	Header *building = (Header *)Owned.data();
+	uint8_t *buildingFingerprints = (uint8_t *)Owned.data() + sizeof(Header);
+	building->blockLength = blockLength;
+	building->keys = keys.size();
+
+	// Every slot tracks how many keys hash to it and the xor of their hashes, a slot with one key left names that key
+	std::vector<uint64_t> slotXor(capacity);
+	std::vector<uint32_t> slotCount(capacity);
+	std::vector<uint32_t> queue;
+	std::vector<std::pair<uint32_t, uint64_t>> peeled; // slot, hash of the key assigned to it
+	queue.reserve(capacity);
+	peeled.reserve(keys.size());
+
+	auto slots = [blockLength](uint64_t hash, uint32_t (&slot)[3]) {
+		slot[0] = Reduce((uint32_t)hash, blockLength);
+		slot[1] = blockLength + Reduce((uint32_t)Rotate(hash, 21), blockLength);
+		slot[2] = 2 * blockLength + Reduce((uint32_t)Rotate(hash, 42), blockLength);
+	};
+
+	uint64_t seedState = 0x6e426c6f636bull ^ keys.size();
+	for (unsigned int attempt = 0; attempt < maxAttempts; attempt++)
+	{
+		building->seed = SplitMix(seedState);
+		std::fill(slotXor.begin(), slotXor.end(), 0);
+		std::fill(slotCount.begin(), slotCount.end(), 0);
+		queue.clear();
+		peeled.clear();
+
+		uint32_t slot[3];
+		for (uint64_t key : keys)
+		{
+			const uint64_t hash = Mix(key + building->seed);
+			slots(hash, slot);
+			for (uint32_t index : slot)
+			{
+				slotXor[index] ^= hash;
+				slotCount[index]++;
+			}
+		}
+
+		for (size_t index = 0; index < capacity; index++)
+			if (slotCount[index] == 1)
+				queue.push_back(index);
+
+		// Peel keys off slots that only they hash to, until nothing is left (success) or everything is stuck in a cycle
+		while (!queue.empty())
+		{
+			const uint32_t index = queue.back();
+			queue.pop_back();
+			if (slotCount[index] != 1)
+				continue;
+
+			const uint64_t hash = slotXor[index];
+			peeled.push_back(std::make_pair(index, hash));
+
+			slots(hash, slot);
+			for (uint32_t other : slot)
+			{
+				slotXor[other] ^= hash;
+				if (--slotCount[other] == 1)
+					queue.push_back(other);
+			}
+		}
+
+		if (peeled.size() != keys.size())
+			continue;
+
+		// Assign in reverse peeling order: each key gets the one slot none of the keys assigned later depends on
+		memset(buildingFingerprints, 0, capacity);
+		for (auto entry = peeled.rbegin(); entry != peeled.rend(); ++entry)
+		{
+			const uint64_t hash = entry->second;
+			slots(hash, slot);
+			buildingFingerprints[entry->first] = (uint8_t)(hash ^ (hash >> 32))
+				^ buildingFingerprints[slot[0]] ^ buildingFingerprints[slot[1]] ^ buildingFingerprints[slot[2]];
+		}
+
+		header = building;
+		fingerprints = buildingFingerprints;
+		return true;
+	}
+
+	Clear();
+	return false;
+}
+
+bool XorFilter::Attach(const void *data, size_t bytes, std::shared_ptr<const void> backing)
+{
+	if (bytes < sizeof(Header) || (uintptr_t)data % alignof(Header) != 0)
+		return false;
+
+	const Header *attached = (const Header *)data;
+	if (attached->blockLength == 0 || bytes != sizeof(Header) + 3 * (size_t)attached->blockLength)
+		return false;
+
+	Clear();
+	header = attached;
+	fingerprints = (const uint8_t *)data + sizeof(Header);
+	attachedMemory = backing;
+
+	return true;
+}
+
+double XorFilter::MeasureFalsePositiveRate(unsigned int probes) const
+{
+	if (!header || probes == 0)
+		return 0;
+
+	// Random keys are as good as unlisted ones, the keys in the filter are hashes themselves
+	uint64_t state = 0x70726f6265ull;
+	unsigned int passed = 0;
+	for (unsigned int i = 0; i < probes; i++)
+		if (Contains(SplitMix(state)))
+			passed++;
+
+	return (double)passed / probes;
+}
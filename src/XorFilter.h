@@ -0,0 +1,74 @@
+#ifndef ECAP_NBLOCK_XORFILTER_H
+#define ECAP_NBLOCK_XORFILTER_H
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+// Static approximate set of 64 bit keys with 8 bit fingerprints (xor filter, Graf & Lemire 2019): about 9.9 bits per key
+// and a false positive rate of about 1 / 256. A lookup reads three bytes, one from each third of the fingerprint array.
+// Used by DomainTrie to turn away most hosts that are not listed without walking the trie.
+// Like DomainTrie, a built filter can be attached to memory owned by someone else, eg a memory mapped BlocklistImage.
+class XorFilter {
+public:
+	XorFilter();
+
+	// Replaces the filter with one holding keys, duplicates are allowed. Returns false if no filter could be built,
+	// the filter is empty then.
+	bool Build(std::vector<uint64_t> keys);
+	void Clear();
+
+	// Uses a previously built filter in place, backing keeps that memory alive. Returns false if data is inconsistent.
+	bool Attach(const void *data, size_t bytes, std::shared_ptr<const void> backing);
+	const void *Data() const { return header; }
+	size_t Bytes() const { return header ? sizeof(Header) + 3 * (size_t)header->blockLength : 0; }
+
+	bool Empty() const { return header == nullptr; }
+	size_t Keys() const { return header ? header->keys : 0; }
+	size_t MemoryUsage() const { return Owned.capacity(); }
+
+	// Share of random keys the filter lets through, out of probes tries
+	double MeasureFalsePositiveRate(unsigned int probes = 100000) const;
+
+	bool Contains(uint64_t key) const
+	{
+		const uint64_t hash = Mix(key + header->seed);
+		const uint32_t blockLength = header->blockLength;
+		const uint8_t fingerprint = hash ^ (hash >> 32);
+
+		return fingerprint == (fingerprints[Reduce((uint32_t)hash, blockLength)]
+			^ fingerprints[blockLength + Reduce((uint32_t)Rotate(hash, 21), blockLength)]
+			^ fingerprints[2 * blockLength + Reduce((uint32_t)Rotate(hash, 42), blockLength)]);
+	}
+
+private:
+	struct Header {
+		uint64_t seed;
+		uint32_t blockLength; // the fingerprint array holds three blocks of this length
+		uint32_t keys;
+	};
+
+	const Header *header;
+	const uint8_t *fingerprints;
+	std::vector<char> Owned; // Header followed by the fingerprints, when not attached
+	std::shared_ptr<const void> attachedMemory;
+
+	static uint64_t Mix(uint64_t key)
+	{
+		// murmur3 finalizer, a bijection: distinct keys never share a hash
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ull;
+		key ^= key >> 33;
+		return key;
+	}
+	static uint64_t Rotate(uint64_t value, unsigned int bits) { return (value << bits) | (value >> (64 - bits)); }
+	static uint32_t Reduce(uint32_t hash, uint32_t range) { return (uint32_t)(((uint64_t)hash * range) >> 32); }
+
+	/* prohibited and not implemented */
+	XorFilter(const XorFilter&);
+	XorFilter &operator=(const XorFilter&);
+};
+
+#endif
@@ -1,6 +1,22 @@
+#include "AreaView.h"
+#include "BlockLog.h"
+#include "BlockResponse.h"
+#include "BodyPipeline.h"
+#include "BypassList.h"
+#include "CdnStore.h"
+#include "ContentScanner.h"
 #include "Debugger.h"
+#include "DecisionCache.h"
+#include "ElementHiding.h"
+#include "ListLoader.h"
+#include "ListWatcher.h"
 #include "NetFilterDns.h"
 #include "NetFilterAdblock.h"
+#include "RecyclingPool.h"
+#include "RequestClassifier.h"
+#include "Stats.h"
+#include "StatsWriter.h"
+#include "VerdictQueue.h"
 
 #include <iostream>
 #include <string.h>
@@ -15,6 +31,7 @@
 #include <libecap/adapter/xaction.h>
 #include <libecap/host/xaction.h>
 #include <chrono> // for measuring execution time
+#include <sys/time.h>
 
 namespace Adapter { // not required, but adds clarity
 
@@ -43,8 +60,39 @@ class Service: public libecap::adapter::Service {
 
 		// Work
 		virtual MadeXactionPointer makeXaction(libecap::host::Xaction *hostx);
+
+#ifdef V100
+		// Async verdicts, see VerdictQueue
+		virtual bool makesAsyncXactions() const;
+		virtual void suspend(timeval &timeout);
+		virtual void resume();
+#endif
 		
 	private:
+		ListLoader::ListSet lists; // collected by setOne(), loaded by configure()
+		bool started; // between start() and stop() / retire(), configure() is a reconfigure then
+		ListWatcher watcher; // reloads the lists when they change on disk
+		bool watchLists;
+		unsigned int asyncWorkers; // async_workers, 0 keeps the verdicts on the main thread
+		std::string cacheShared; // cache_shared, shared memory segment for the verdict cache of all workers
+		bool cacheCanonical; // cache_canonical, leave query string tokens no filter looks at out of the Adblock cache keys
+		bool nativeMatcher; // matcher, match the Adblock filters with AdblockMatcher instead of AdBlockClient
+		std::string statsFile; // stats_file, Prometheus text format
+		unsigned int statsInterval; // stats_interval, seconds
+		StatsWriter statsWriter;
+		std::string blockLog; // block_log, file name or udp:<host>:<port>
+		unsigned int blockLogSample; // block_log_sample, log one in N blocked requests
+		unsigned int blockLogRate; // block_log_rate, events per second, 0 is unlimited
+		std::vector<std::string> bodyScanners; // body_scan, ContentScanners run over response bodies
+		std::vector<std::string> bodyTypes; // body_types, media types of the bodies they see
+		size_t bodyBuffer; // body_buffer, adapted bytes a response may hold before the virgin body is paused
+		bool cosmeticGeneric; // cosmetic_generic, the cosmetic scanner also hides what the generic filters name
+		bool blockResponse; // block_response, answer blocked images, scripts, stylesheets and XHRs with a response of our own
+		std::vector<std::string> bypassLists; // list_bypass, hosts and domains that are never filtered
+		std::string cdnStore; // cdn_store, CDN resources answered from a local copy, written by nblock_cdn_compile
+#ifdef V100
+		std::vector<std::shared_ptr<VerdictQueue::Job>> completedJobs; // resume() swaps it with the queue's, both keep their capacity
+#endif
 };
 
 // Calls Service::setOne() for each host-provided configuration option.
@@ -73,38 +121,134 @@ class Xaction: public libecap::adapter::Xaction {
 		// lifecycle
 		virtual void start();
 		virtual void stop();
+#ifdef V100
+		virtual void resume(); // the async verdict is ready
+#endif
 
-		// adapted body transmission control
-		virtual void abDiscard() { noBodySupport(); }
-		virtual void abMake() { noBodySupport(); }
-		virtual void abMakeMore() { noBodySupport(); }
-		virtual void abStopMaking() { noBodySupport(); }
+		// adapted body transmission control, only responses scanned by body_scan= have an adapted body
+		virtual void abDiscard();
+		virtual void abMake();
+		virtual void abMakeMore();
+		virtual void abStopMaking();
 
 		// adapted body content extraction and consumption
-		virtual libecap::Area abContent(libecap::size_type, libecap::size_type) { noBodySupport(); return libecap::Area(); }
-		virtual void abContentShift(libecap::size_type)  { noBodySupport(); }
+		virtual libecap::Area abContent(libecap::size_type offset, libecap::size_type size);
+		virtual void abContentShift(libecap::size_type size);
 
 		// virgin body state notification
-		virtual void noteVbContentDone(bool) { noBodySupport(); }
-		virtual void noteVbContentAvailable() { noBodySupport(); }
-
-	protected:
-		void noBodySupport() const;
+		virtual void noteVbContentDone(bool atEnd);
+		virtual void noteVbContentAvailable();
 
 	private:
+		typedef enum { opUndecided, opOn, opComplete, opNever } OperationState;
+
 		libecap::host::Xaction *hostx; // Host transaction rep
+		std::shared_ptr<VerdictQueue::Job> job; // async verdict in progress
+
+		std::unique_ptr<BodyPipeline> pipeline; // response body adaptation, see StartBodyAdaptation()
+		std::string_view staticBody; // the rest of the body of a block response or a CDN resource, see Respond()
+		CdnStore::Resource localResource; // cdn_store has the requested resource, see ServeLocal()
+		std::string adaptedBody; // encoded, not taken by the host yet
+		OperationState receivingVb;
+		OperationState sendingAb;
+		bool vbPaused; // adaptedBody is full, the rest of the virgin body waits in the host
+		bool abTruncated; // the virgin body could not be decoded, the adapted body ends early
+
+		void Block(FilterOption options);
+		void ServeLocal();
+		void Respond(const libecap::shared_ptr<libecap::Message> &response);
+		bool StartBodyAdaptation();
+		void PumpVirginBody(bool all);
+		void StopVirginBody();
 };
 
 } // namespace Adapter
 
 static const std::string CfgErrorPrefix = "nBlock configuration error: ";
+
+static void LogEvent(libecap::host::Xaction *x, BlockLog::Filter filter, std::string_view host, std::string_view uri, std::string_view rule) {
+	const libecap::Area client = x->option(libecap::metaClientIp);
+	BlockLog::getInstance().Log(filter, AreaView(client), host, uri, rule);
+}
+
+// Type of a blocked request, only worked out when block_response= needs it to pick the response
+static FilterOption BlockedType(const libecap::Header &header, std::string_view uri) {
+	if (!BlockResponse::getInstance().Enabled())
+		return FONoFilterOption;
+
+	static const libecap::Name headerAccept("Accept");
+	static const libecap::Name headerXRequest("X-Requested-With");
+	static const libecap::Name headerReferer("Referer");
+	const libecap::Area accept = header.value(headerAccept);
+	const libecap::Area xRequest = header.value(headerXRequest);
+	const libecap::Area contentType = header.value(libecap::headerContentType);
+	const libecap::Area referer = header.value(headerReferer);
+
+	return RequestClassifier::getInstance().Classify(uri, AreaView(accept), AreaView(xRequest), AreaView(contentType), AreaView(referer));
+}
+
+// Blocked requests go to the block log when there is one, or to cache.log as they always did.
+// findRule(rule) is only asked for the events the block log actually takes.
+template <class RuleFinder>
+static void LogBlocked(libecap::host::Xaction *x, BlockLog::Filter filter, std::string_view host, std::string_view uri, RuleFinder findRule) {
+	BlockLog &blockLog = BlockLog::getInstance();
+	if (!blockLog.Enabled())
+	{
+		if (filter == BlockLog::bfDns)
+			Debugger(ilNormal | flApplication) << "!! NetFilterDns Blocked request to host: " << host;
+		else
+			Debugger(ilNormal | flApplication) << "!! NetFilterAdblock Blocked request: " << uri;
+		return;
+	}
+
+	if (!blockLog.Admit())
+		return;
+
+	thread_local std::string rule;
+	rule.clear();
+	findRule(rule);
+	LogEvent(x, filter, host, uri, rule);
+}
+
+// Comma separated option values, eg body_types=text/html,application/xhtml+xml
+static std::vector<std::string> SplitList(const std::string &value) {
+	std::vector<std::string> items;
+	size_t itemStart = 0;
+	while (itemStart <= value.size())
+	{
+		size_t itemEnd = value.find(',', itemStart);
+		if (itemEnd == std::string::npos)
+			itemEnd = value.size();
+		if (itemEnd > itemStart)
+			items.push_back(value.substr(itemStart, itemEnd - itemStart));
+		itemStart = itemEnd + 1;
+	}
+	return items;
+}
+
+// Options of the response service, see Service::configure()
+static bool IsResponseOption(const libecap::Name &name) {
+	return name == "body_scan" || name == "body_types" || name == "body_buffer" || name == "cosmetic_generic";
+}
+
+// Matches "prefix" itself and any "prefix.<suffix>" option name
+static bool IsListOption(const libecap::Name &name, const std::string &prefix) {
+	const std::string &image = name.image();
+	return image.compare(0, prefix.size(), prefix) == 0 && (image.size() == prefix.size() || image[prefix.size()] == '.');
+}
 	
 std::string Adapter::Service::uri() const {
 	return "ecap://nBlock/ecap/services/?mode=" + mode;
 }
 
 Adapter::Service::Service(const std::string &aMode):
-	mode(aMode)
+	mode(aMode),
+	started(false),
+	watchLists(true),
+	asyncWorkers(0),
+	statsInterval(10),
+	blockLogSample(1),
+	blockLogRate(0)
 {
 }
 
@@ -114,14 +258,115 @@ std::string Adapter::Service::tag() const {
 
 void Adapter::Service::describe(std::ostream &os) const {
 	os << "nblock " << mode << " adapter: " << PACKAGE_NAME << " v" << PACKAGE_VERSION;
+
+	DecisionCache::Counters counters = DecisionCache::getInstance().GetCounters();
+	os << ", cache: " << counters.entries << " entries, " << counters.hits << " hits, " << counters.misses << " misses, " << counters.evictions << " evictions";
+
+	if (mode == "CLIENT_REQUEST_MODE")
+	{
+		os << ", ";
+		Stats::getInstance().WriteSummary(os);
+	}
 }
 
 void Adapter::Service::configure(const libecap::Options &cfg) {
+	Debugger::Flush();
+
+	lists.clear();
+	watchLists = true;
+	asyncWorkers = 0;
+	cacheShared.clear();
+	cacheCanonical = true;
+	nativeMatcher = false;
+	statsFile.clear();
+	statsInterval = 10;
+	blockLog.clear();
+	blockLogSample = 1;
+	blockLogRate = 0;
+	bodyScanners.clear();
+	bodyTypes.assign(1, "text/html");
+	bodyBuffer = 256 * 1024;
+	cosmeticGeneric = true;
+	blockResponse = true;
+	cdnStore.clear();
+	bypassLists.clear();
+
 	Cfgtor cfgtor(*this);
 	cfg.visitEachOption(cfgtor);
 
+	// A reload of the watcher thread would publish the old lists over the ones loaded below, or load them into the
+	// matcher switched below. Stop() waits for a reload in progress, the watcher is started again further down.
+	watcher.Stop();
+
+	// The lists are loaded into whichever matcher is configured
+	if (mode == "CLIENT_REQUEST_MODE")
+		NetFilterAdblock::getInstance().SetNativeMatcher(nativeMatcher);
+
+	// All lists are known now, parse them concurrently and merge them per list type
+	std::string error;
+	if (!lists.empty() && !ListLoader::Load(lists, error))
+	{
+		throw libecap::TextException(CfgErrorPrefix + "[nBlock] " + error);
+	}
+
+	// The worker pool is shared by all transactions, only the request service owns it
+	if (mode == "CLIENT_REQUEST_MODE")
+	{
+		VerdictQueue::getInstance().SetWorkers(asyncWorkers);
+		if (asyncWorkers > 0)
+			Debugger(ilNormal | flApplication) << "[nBlock] Evaluating verdicts on " << asyncWorkers << " worker threads";
+
+		if (!DecisionCache::getInstance().SetShared(cacheShared, error))
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Unable to share the cache: " + error);
+		}
+		if (!cacheShared.empty())
+			Debugger(ilNormal | flApplication) << "[nBlock] Cache shared with the other workers in " << cacheShared;
+		NetFilterAdblock::getInstance().SetCanonicalKeys(cacheCanonical);
+		BlockResponse::getInstance().SetEnabled(blockResponse);
+
+		if (!BypassList::getInstance().Load(bypassLists, error))
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Unable to load the bypass list: " + error);
+		}
+		if (!bypassLists.empty())
+			Debugger(ilNormal | flApplication) << "[nBlock] Bypassing " << BypassList::getInstance().Entries() << " hosts and domains";
+
+		if (!CdnStore::getInstance().Load(cdnStore, error))
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Unable to load the CDN store: " + error);
+		}
+		if (!cdnStore.empty())
+			Debugger(ilNormal | flApplication) << "[nBlock] Answering CDN requests from " << cdnStore;
+
+		// Blocked requests are only seen by the request service as well
+		if (!BlockLog::getInstance().Start(blockLog, blockLogSample, blockLogRate, error))
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Unable to open the block log: " + error);
+		}
+	}
+
+	// Response bodies are only seen by the response service
+	if (mode == "SERVER_RESPONSE_MODE")
+	{
+		ContentScanners::getInstance().Configure(bodyScanners, bodyTypes, bodyBuffer);
+		ElementHiding::getInstance().SetGeneric(cosmeticGeneric);
+		if (!bodyScanners.empty())
+			Debugger(ilNormal | flApplication) << "[nBlock] Scanning response bodies with " << bodyScanners.size() << " scanners";
+	}
+
+	// Reconfiguring a running service, make sure the watcher and the stats writer follow the new options, also when
+	// list_watch or stats_file were off before
+	if (started)
+	{
+		if (watchLists && !lists.empty())
+			watcher.Start(lists);
+
+		statsWriter.Start(statsFile, statsInterval); // stops the writer when stats_file is gone
+	}
+
 	// check for post-configuration errors and inconsistencies
-	if (NetFilterDns::getInstance().localCacheSize == 0 || NetFilterAdblock::getInstance().localCacheSize == 0)
+	if (DecisionCache::getInstance().Capacity() == 0)
 	{
 		throw libecap::TextException(CfgErrorPrefix + "cache value can not be 0");
 	}
@@ -132,7 +377,8 @@ void Adapter::Service::reconfigure(const libecap::Options &cfg) {
 }
 
 void Adapter::Service::setOne(const libecap::Name &name, const libecap::Area &valArea) {
-	if (this->mode != "CLIENT_REQUEST_MODE")
+	// The response service only takes the options for the response bodies
+	if (this->mode != "CLIENT_REQUEST_MODE" && !IsResponseOption(name))
 		return;
 	
 	const std::string value = valArea.toString();
@@ -141,8 +387,7 @@ void Adapter::Service::setOne(const libecap::Name &name, const libecap::Area &va
 	{
 		try
 		{
-			NetFilterDns::getInstance().localCacheSize = std::stoi(value);
-			NetFilterAdblock::getInstance().localCacheSize = std::stoi(value);
+			DecisionCache::getInstance().SetCapacity(std::stoi(value));
 			Debugger(ilNormal | flApplication) << "[nBlock] Cache: " << std::to_string(std::stoi(value)) << " entries";
 		}
 		catch (...)
@@ -150,18 +395,200 @@ void Adapter::Service::setOne(const libecap::Name &name, const libecap::Area &va
 			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'cache': " + value);
 		}
 	}
-	/* can use start_with for future loading of multiple lists */
-	else if (name == "list_hostnames")
+	else if (name == "cache_shared")
+	{
+		// shm_open() wants a single leading slash
+		if (!value.empty() && (value[0] != '/' || value.find('/', 1) != std::string::npos || value.size() < 2))
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'cache_shared', expected a name like /nblock: " + value);
+		}
+		cacheShared = value;
+	}
+	else if (name == "cache_canonical")
+	{
+		if (value != "on" && value != "off")
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'cache_canonical': " + value);
+		}
+		cacheCanonical = (value == "on");
+	}
+	else if (name == "block_response")
+	{
+		if (value != "on" && value != "off")
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'block_response': " + value);
+		}
+		blockResponse = (value == "on");
+	}
+	else if (name == "cdn_store")
+	{
+		cdnStore = value;
+	}
+	else if (name == "matcher")
+	{
+		if (value != "adblock" && value != "native")
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'matcher': " + value);
+		}
+		nativeMatcher = (value == "native");
+	}
+	else if (name == "ext_script" || name == "ext_image" || name == "ext_stylesheet")
+	{
+		FilterOption option = FOScript;
+		if (name == "ext_image")
+			option = FOImage;
+		else if (name == "ext_stylesheet")
+			option = FOStylesheet;
+
+		if (!RequestClassifier::getInstance().AddExtensions(option, value))
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for '" + name.image() + "': " + value);
+		}
+	}
+	// Any number of lists per type can be given, eg: list_hostnames=a.txt list_hostnames.2=b.txt list_hostnames.custom=c.txt
+	else if (IsListOption(name, "list_hostnames"))
+	{
+		lists.hostnames.push_back(value);
+	}
+	else if (IsListOption(name, "list_domains"))
+	{
+		lists.domains.push_back(value);
+	}
+	else if (IsListOption(name, "list_adblockplus"))
+	{
+		lists.adblock.push_back(value);
+	}
+	else if (IsListOption(name, "list_bypass"))
+	{
+		bypassLists.push_back(value);
+	}
+	else if (name == "list_compiled")
+	{
+		// Binary image written by nblock_compile, holds any of the lists above
+		lists.compiled = value;
+	}
+	else if (name == "list_watch")
+	{
+		if (value != "on" && value != "off")
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'list_watch': " + value);
+		}
+		watchLists = (value == "on");
+	}
+	else if (name == "list_optimize")
+	{
+		if (value != "on" && value != "off")
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'list_optimize': " + value);
+		}
+		lists.optimize = (value == "on");
+	}
+	else if (name == "stats_file")
+	{
+		statsFile = value;
+	}
+	else if (name == "stats_interval")
+	{
+		try
+		{
+			int seconds = std::stoi(value);
+			if (seconds <= 0)
+				throw std::out_of_range(value);
+			statsInterval = seconds;
+		}
+		catch (...)
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'stats_interval': " + value);
+		}
+	}
+	else if (name == "block_log")
+	{
+		blockLog = value;
+	}
+	else if (name == "block_log_sample")
+	{
+		try
+		{
+			int every = std::stoi(value);
+			if (every <= 0)
+				throw std::out_of_range(value);
+			blockLogSample = every;
+		}
+		catch (...)
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'block_log_sample': " + value);
+		}
+	}
+	else if (name == "block_log_rate")
+	{
+		try
+		{
+			int perSecond = std::stoi(value);
+			if (perSecond < 0)
+				throw std::out_of_range(value);
+			blockLogRate = perSecond;
+		}
+		catch (...)
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'block_log_rate': " + value);
+		}
+	}
+	else if (name == "body_scan")
+	{
+		bodyScanners = SplitList(value);
+		for (const std::string &scanner : bodyScanners)
+		{
+			if (!ContentScanners::getInstance().Known(scanner))
+				throw libecap::TextException(CfgErrorPrefix + "[nBlock] Unknown scanner in 'body_scan': " + scanner);
+		}
+	}
+	else if (name == "body_types")
+	{
+		bodyTypes = SplitList(value);
+		if (bodyTypes.empty())
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'body_types': " + value);
+		}
+	}
+	else if (name == "body_buffer")
 	{
-		NetFilterDns::getInstance().LoadHostnames(value);
+		try
+		{
+			int bytes = std::stoi(value);
+			if (bytes < 4096)
+				throw std::out_of_range(value);
+			bodyBuffer = bytes;
+		}
+		catch (...)
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'body_buffer': " + value);
+		}
 	}
-	else if (name == "list_domains")
+	else if (name == "cosmetic_generic")
 	{
-		NetFilterDns::getInstance().LoadDomains(value);
+		if (value != "on" && value != "off")
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'cosmetic_generic': " + value);
+		}
+		cosmeticGeneric = (value == "on");
 	}
-	else if (name == "list_adblockplus")
+	else if (name == "async_workers")
 	{
-		NetFilterAdblock::getInstance().LoadAdblockList(value);
+#ifdef V100
+		try
+		{
+			int workers = std::stoi(value);
+			if (workers < 0 || workers > 256)
+				throw std::out_of_range(value);
+			asyncWorkers = workers;
+		}
+		catch (...)
+		{
+			throw libecap::TextException(CfgErrorPrefix + "[nBlock] Invalid value for 'async_workers': " + value);
+		}
+#else
+		throw libecap::TextException(CfgErrorPrefix + "[nBlock] 'async_workers' requires libecap 1.0 or later");
+#endif
 	}
 	else if (name.assignedHostId())
 		; // skip host-standard options we do not know or care about
@@ -173,34 +600,108 @@ void Adapter::Service::setOne(const libecap::Name &name, const libecap::Area &va
 
 void Adapter::Service::start() {
 	libecap::adapter::Service::start();
+	started = true;
 	
-	// custom code
+	// Pick up list updates without a Squid reconfigure, the lists are only configured on the request service
+	if (watchLists && !lists.empty())
+		watcher.Start(lists);
+
+	statsWriter.Start(statsFile, statsInterval);
 }
 
 void Adapter::Service::stop() {
-	// custom code would go here, but this service does not have one
+	started = false;
+	watcher.Stop();
+	if (mode == "CLIENT_REQUEST_MODE")
+		BlockLog::getInstance().Stop();
+	statsWriter.Stop();
+	Debugger::Flush();
 	libecap::adapter::Service::stop();
 }
 
 void Adapter::Service::retire() {
-	// custom code would go here, but this service does not have one
+	started = false;
+	watcher.Stop();
+	if (mode == "CLIENT_REQUEST_MODE")
+		BlockLog::getInstance().Stop();
+	statsWriter.Stop();
+	Debugger::Flush();
 	libecap::adapter::Service::stop();
 }
 
 bool Adapter::Service::wantsUrl(const char *url) const {
-	return true; // minimal adapter is applied to all messages
+	// list_bypass: no transaction at all for these hosts, when the host tells us the whole url (Squid passes the path
+	// alone, see Xaction::start())
+	if (mode == "CLIENT_REQUEST_MODE" && BypassList::getInstance().Bypassed(url))
+	{
+		Stats::getInstance().Count(Stats::scBypassed);
+		return false;
+	}
+
+	return true;
 }
 
 Adapter::Service::MadeXactionPointer
 Adapter::Service::makeXaction(libecap::host::Xaction *hostx) {
+#ifdef V100
+	// One recycled block for the transaction and its reference count, libecap v1 pointers are std::shared_ptr
+	return std::allocate_shared<Adapter::Xaction>(PoolAllocator<Adapter::Xaction>(), hostx);
+#else
 	return Adapter::Service::MadeXactionPointer(new Adapter::Xaction(hostx));
+#endif
+}
+
+#ifdef V100
+bool Adapter::Service::makesAsyncXactions() const {
+	// Also when only background threads run: resume() hands their log messages to the host, see Debugger. After a
+	// reconfigure to async_workers=0 the verdicts still queued must be handed back as well.
+	return asyncWorkers > 0 || (watchLists && !lists.empty()) || !statsFile.empty() || !blockLog.empty() ||
+		(mode == "CLIENT_REQUEST_MODE" && !VerdictQueue::getInstance().Idle());
+}
+
+void Adapter::Service::suspend(timeval &timeout) {
+	// Squid is about to wait for I/O, do not let finished verdicts wait for the full timeout
+	static const long asyncPollUsec = 1000;
+
+	if (mode == "CLIENT_REQUEST_MODE" && !VerdictQueue::getInstance().Idle() &&
+		(timeout.tv_sec > 0 || timeout.tv_usec > asyncPollUsec))
+	{
+		timeout.tv_sec = 0;
+		timeout.tv_usec = asyncPollUsec;
+	}
+}
+
+void Adapter::Service::resume() {
+	Debugger::Flush();
+
+	// Main thread: hand the finished verdicts back, the host calls Xaction::resume() for each of them. Also with
+	// async_workers=0, the jobs of a pool that was configured away finish into the queue as well.
+	if (mode != "CLIENT_REQUEST_MODE")
+		return;
+	VerdictQueue::getInstance().TakeCompleted(completedJobs);
+
+	for (const std::shared_ptr<VerdictQueue::Job> &completedJob : completedJobs)
+	{
+		if (completedJob->hostx) // the transaction may have been stopped in the meantime
+			completedJob->hostx->resume();
+	}
+	completedJobs.clear(); // keeps the capacity for the next call
 }
+#endif
 
 
-Adapter::Xaction::Xaction(libecap::host::Xaction *x): hostx(x) {
+Adapter::Xaction::Xaction(libecap::host::Xaction *x):
+	hostx(x),
+	receivingVb(opUndecided),
+	sendingAb(opUndecided),
+	vbPaused(false),
+	abTruncated(false) {
 }
 
 Adapter::Xaction::~Xaction() {
+	if (job)
+		job->hostx = 0;
+
 	if (libecap::host::Xaction *x = hostx) {
 		hostx = 0;
 		x->adaptationAborted();
@@ -221,21 +722,80 @@ void Adapter::Xaction::start() {
 	typedef const libecap::RequestLine *CLRLP;
 	if (CLRLP requestLine = dynamic_cast<CLRLP>(&hostx->virgin().firstLine()))
 	{
+		Stats &stats = Stats::getInstance();
+		const uint64_t requestStart = Stats::Now();
+
 		// Use the dns based blocklist to see if the requested Host should be blocked.
 		// This filter is extremely fast, using local caching for recurrinng requests.
+		// The filters work on views of the host's buffers, the Areas below keep those alive
 		static const libecap::Name headerHost("Host");
-		std::string requestHost = hostx->virgin().header().value(headerHost).toString();
+		const libecap::Area hostArea = hostx->virgin().header().value(headerHost);
+		const libecap::Area uriArea = requestLine->uri();
+		const std::string_view requestHost = AreaView(hostArea);
+		const std::string_view requestUri = AreaView(uriArea);
+
+		// list_bypass: the hosts Service::wantsUrl() could not turn away, nothing else is looked at
+		BypassList &bypass = BypassList::getInstance();
+		if (bypass.Enabled() && bypass.Bypassed(requestHost))
+		{
+			stats.Count(Stats::scBypassed);
+			libecap::host::Xaction *x = hostx;
+			hostx = 0;
+			x->useVirgin();
+			return;
+		}
+		stats.Count(Stats::scRequests);
+
+		// cdn_store: answered from the local copy further down, unless the request is blocked
+		CdnStore &cdnStore = CdnStore::getInstance();
+		if (cdnStore.Enabled() && requestLine->method() == libecap::methodGet)
+			cdnStore.Lookup(requestUri, requestHost, localResource);
+
+#ifdef V100
+		// async_workers: copy what the filters need and let a worker decide, resume() applies the verdict
+		if (VerdictQueue::getInstance().Workers() > 0)
+		{
+			static const libecap::Name headerAccept("Accept");
+			static const libecap::Name headerXRequest("X-Requested-With");
+			static const libecap::Name headerContentType("Content-Type");
+			static const libecap::Name headerReferer("Referer");
+			const libecap::Header &header = hostx->virgin().header();
+
+			const libecap::Area accept = header.value(headerAccept);
+			const libecap::Area xRequest = header.value(headerXRequest);
+			const libecap::Area contentType = header.value(headerContentType);
+			const libecap::Area referer = header.value(headerReferer);
+
+			job = VerdictQueue::NewJob();
+			job->host = job->arena.Copy(requestHost);
+			job->uri = job->arena.Copy(requestUri);
+			job->accept = job->arena.Copy(AreaView(accept));
+			job->xRequest = job->arena.Copy(AreaView(xRequest));
+			job->contentType = job->arena.Copy(AreaView(contentType));
+			job->referer = job->arena.Copy(AreaView(referer));
+			job->started = requestStart;
+			job->hostx = hostx;
+
+			VerdictQueue::getInstance().Submit(job);
+			return;
+		}
+#endif
 		
-		if (NetFilterDns::getInstance().IsBlackListed(requestHost))
+		const uint64_t dnsStart = Stats::Now();
+		const bool blockedHost = NetFilterDns::getInstance().IsBlackListed(requestHost);
+		stats.Record(Stats::stDns, dnsStart);
+
+		if (blockedHost)
 		{
-			hostx->blockVirgin(); // block access!
-			Debugger(ilNormal | flApplication) << "!! NetFilterDns Blocked request to host: " << requestHost;
+			stats.Count(Stats::scBlockedDns);
+			stats.Record(Stats::stRequest, requestStart);
+			LogBlocked(hostx, BlockLog::bfDns, requestHost, requestUri,
+				[&](std::string &rule) { return NetFilterDns::getInstance().MatchedEntry(requestHost, rule); });
+			Block(BlockedType(hostx->virgin().header(), requestUri)); // block access!
 
 			return;
 		} 
 		
-		std::string requestUri = requestLine->uri().toString();
-		
 		// Ignore initial https connections (those should be covered by the dns filters)
 		// Example: Requested URI: cdns.gigya.com:443
 		if (requestUri.compare(0, 4, "http") == 0) // Moving this check into the IsBlackListed() function will corrupt the requestUri string for some strange reason...
@@ -245,15 +805,28 @@ void Adapter::Xaction::start() {
 			// TODO: our local interface also caches recurring entries, for a decent speed upgrade since the adblock parser is still relatively slow
 			if (NetFilterAdblock::getInstance().IsBlackListed(requestUri, hostx->virgin().header()))
 			{
-				hostx->blockVirgin(); // block access!
-				Debugger(ilNormal | flApplication) << "!! NetFilterAdblock Blocked request: " << requestUri;
+				stats.Count(Stats::scBlockedAdblock);
+				stats.Record(Stats::stRequest, requestStart);
+				LogBlocked(hostx, BlockLog::bfAdblock, requestHost, requestUri,
+					[&](std::string &rule) { return NetFilterAdblock::getInstance().MatchedRule(requestUri, hostx->virgin().header(), rule); });
+				Block(BlockedType(hostx->virgin().header(), requestUri)); // block access!
 
 				return;
 			}
 		}
 		
-		//auto startTime = std::chrono::high_resolution_clock::now();
-		//Debugger(ilNormal | flApplication) << "Execution Time AdblockFilter: " << (std::chrono::high_resolution_clock::now() - startTime).count() << "us";
+		stats.Record(Stats::stRequest, requestStart);
+
+		if (localResource.image)
+		{
+			ServeLocal();
+			return;
+		}
+	}
+	// Responses: the body goes through the body_scan= scanners when they want to see it, everything else passes untouched
+	else if (StartBodyAdaptation())
+	{
+		return;
 	}
 	
 	// Make this adapter non-callable
@@ -264,14 +837,365 @@ void Adapter::Xaction::start() {
 	x->useVirgin();
 }
 
+#ifdef V100
+void Adapter::Xaction::resume() {
+	Must(hostx && job);
+	job->hostx = 0;
+
+	// Includes the time the job waited for a worker and for the main loop
+	Stats::getInstance().Record(Stats::stRequest, job->started);
+
+	switch (job->verdict)
+	{
+		case VerdictQueue::vtBlockHost:
+		case VerdictQueue::vtBlockRequest:
+		{
+			// The worker already admitted the event to the block log and looked up the rule
+			const BlockLog::Filter filter = (job->verdict == VerdictQueue::vtBlockHost) ? BlockLog::bfDns : BlockLog::bfAdblock;
+			if (job->logEvent)
+				LogEvent(hostx, filter, job->host, job->uri, job->rule);
+			else if (!BlockLog::getInstance().Enabled())
+				LogBlocked(hostx, filter, job->host, job->uri, [](std::string &) { return false; });
+
+			FilterOption options = FONoFilterOption;
+			if (BlockResponse::getInstance().Enabled())
+				options = RequestClassifier::getInstance().Classify(job->uri, job->accept, job->xRequest, job->contentType, job->referer);
+			Block(options); // block access!
+			break;
+		}
+		default:
+		{
+			if (localResource.image)
+			{
+				ServeLocal();
+				break;
+			}
+
+			// Make this adapter non-callable
+			libecap::host::Xaction *x = hostx;
+			hostx = 0;
+			x->useVirgin();
+			break;
+		}
+	}
+}
+#endif
+
 void Adapter::Xaction::stop() {
+	if (job)
+		job->hostx = 0;
 	hostx = 0;
 	// the caller will delete
 }
 
-void Adapter::Xaction::noBodySupport() const {
-	Must(!"must not be called: nblock reqmod adapter offers no body support");
-	// not reached
+// Squid's error page, or a response of our own picked by the request type (block_response=)
+void Adapter::Xaction::Block(FilterOption options) {
+	BlockResponse &responses = BlockResponse::getInstance();
+	const BlockResponse::Kind kind = responses.Choose(options);
+
+	if (kind == BlockResponse::brErrorPage)
+	{
+		libecap::host::Xaction *x = hostx;
+		hostx = 0;
+		x->blockVirgin();
+		return;
+	}
+
+	static const Stats::Counter counters[BlockResponse::kindCount] = {
+		Stats::counterCount, Stats::scRespondedImage, Stats::scRespondedScript, Stats::scRespondedStylesheet, Stats::scRespondedNoContent
+	};
+	Stats::getInstance().Count(counters[kind]);
+
+	Respond(responses.Create(kind, staticBody));
+}
+
+// Answers the request with the copy of the CDN resource in cdn_store=, nothing about the request leaves Squid
+void Adapter::Xaction::ServeLocal() {
+	static const libecap::Name headerCacheControl("Cache-Control");
+	static const libecap::Name headerAllowOrigin("Access-Control-Allow-Origin");
+
+	Stats &stats = Stats::getInstance();
+	stats.Count(Stats::scCdnHits);
+	stats.Count(Stats::scCdnBytes, localResource.body.size());
+
+	libecap::shared_ptr<libecap::Message> response = libecap::MyHost().newResponse();
+	libecap::StatusLine &statusLine = dynamic_cast<libecap::StatusLine&>(response->firstLine());
+	statusLine.version(libecap::Version(1, 1));
+	statusLine.protocol(libecap::protocolHttp);
+	statusLine.statusCode(200);
+	statusLine.reasonPhrase(libecap::Area::FromTempString("OK"));
+
+	// What the CDNs send: the URLs name a fixed version, and scripts and fonts are loaded cross origin
+	libecap::Header &header = response->header();
+	header.add(libecap::headerContentType, libecap::Area::FromTempBuffer(localResource.contentType.data(), localResource.contentType.size()));
+	header.add(libecap::headerContentLength, libecap::Area::FromTempString(std::to_string(localResource.body.size())));
+	header.add(headerCacheControl, libecap::Area::FromTempString("public, max-age=31536000"));
+	header.add(headerAllowOrigin, libecap::Area::FromTempString("*"));
+
+	staticBody = localResource.body;
+	if (!staticBody.empty())
+		response->addBody();
+
+	Respond(response);
+}
+
+// Sends a response of our own instead of forwarding the request, its body (if any) is staticBody
+void Adapter::Xaction::Respond(const libecap::shared_ptr<libecap::Message> &response) {
+	// The request body (a POST from a script) is of no use any more
+	if (hostx->virgin().body())
+		hostx->vbDiscard();
+
+	if (staticBody.empty())
+	{
+		libecap::host::Xaction *x = hostx;
+		hostx = 0;
+		x->useAdapted(response);
+		return;
+	}
+
+	// The host asks for the body through abMake() and abContent()
+	hostx->useAdapted(response);
+}
+
+bool Adapter::Xaction::StartBodyAdaptation() {
+	ContentScanners &scanners = ContentScanners::getInstance();
+	const libecap::Message &virgin = hostx->virgin();
+	if (!scanners.Enabled() || !virgin.body())
+		return false;
+
+	// Only complete bodies, a range of one (206, or 200 with Content-Range) cannot be decoded or rewritten on its own
+	static const libecap::Name headerContentRange("Content-Range");
+	typedef const libecap::StatusLine *CLSLP;
+	CLSLP statusLine = dynamic_cast<CLSLP>(&virgin.firstLine());
+	if (!statusLine || statusLine->statusCode() != 200 || virgin.header().hasAny(headerContentRange))
+	{
+		Stats::getInstance().Count(Stats::scBodiesPassed);
+		return false;
+	}
+
+	// list_bypass: the responses of these hosts are not looked at either
+	BypassList &bypass = BypassList::getInstance();
+	if (bypass.Enabled())
+	{
+		static const libecap::Name headerHost("Host");
+		const libecap::Area hostArea = hostx->cause().header().value(headerHost);
+		if (bypass.Bypassed(AreaView(hostArea)))
+		{
+			Stats::getInstance().Count(Stats::scBodiesPassed);
+			return false;
+		}
+	}
+
+	static const libecap::Name headerContentEncoding("Content-Encoding");
+	const libecap::Area contentType = virgin.header().value(libecap::headerContentType);
+	const libecap::Area contentEncoding = virgin.header().value(headerContentEncoding);
+	const BodyPipeline::Encoding encoding = BodyPipeline::ParseEncoding(AreaView(contentEncoding));
+
+	// The scanners are told which page they are looking at
+	libecap::Area uri;
+	typedef const libecap::RequestLine *CLRLP;
+	if (CLRLP requestLine = dynamic_cast<CLRLP>(&hostx->cause().firstLine()))
+		uri = requestLine->uri();
+
+	std::vector<std::unique_ptr<ContentScanner>> created;
+	if (encoding != BodyPipeline::enUnsupported && scanners.Eligible(AreaView(contentType)))
+		created = scanners.Create(ContentScanner::Context{AreaView(uri), AreaView(contentType)});
+
+	if (created.empty())
+	{
+		Stats::getInstance().Count(Stats::scBodiesPassed);
+		return false;
+	}
+
+	Stats::getInstance().Count(Stats::scBodiesScanned);
+	pipeline.reset(new BodyPipeline(encoding, std::move(created)));
+
+	// The adapted body has a length of its own, the host sends it chunked
+	libecap::shared_ptr<libecap::Message> adapted = virgin.clone();
+	adapted->header().removeAny(libecap::headerContentLength);
+
+	receivingVb = opOn;
+	hostx->vbMake();
+	hostx->useAdapted(adapted);
+	return true;
+}
+
+// Moves virgin body content through the pipeline while adaptedBody has room for it, or all of it
+void Adapter::Xaction::PumpVirginBody(bool all) {
+	const size_t maxPending = ContentScanners::getInstance().MaxPending();
+	Stats &stats = Stats::getInstance();
+
+	while (hostx && (all || adaptedBody.size() < maxPending))
+	{
+		const libecap::Area virginContent = hostx->vbContent(0, libecap::nsize);
+		if (virginContent.size == 0)
+			break;
+
+		const size_t adaptedBefore = adaptedBody.size();
+		const bool decoded = pipeline->Write(virginContent.start, virginContent.size, adaptedBody);
+		hostx->vbContentShift(virginContent.size);
+		stats.Count(Stats::scBodyBytesIn, virginContent.size);
+		stats.Count(Stats::scBodyBytesOut, adaptedBody.size() - adaptedBefore);
+
+		if (!decoded)
+		{
+			// Whatever was adapted so far is sent, the client sees a truncated body
+			Debugger(ilNormal | flApplication) << "[nBlock] Cannot decode the response body, truncating it";
+			stats.Count(Stats::scBodyErrors);
+			StopVirginBody();
+			abTruncated = true; // abMake() tells the host if it has not asked for the body yet
+			if (sendingAb == opOn)
+			{
+				hostx->noteAbContentAvailable();
+				hostx->noteAbContentDone(false);
+				sendingAb = opComplete;
+			}
+			return;
+		}
+	}
+
+	// The host keeps the rest of the virgin body until the client has taken some of the adapted one, see abContentShift()
+	if (!all && adaptedBody.size() >= maxPending && !vbPaused && receivingVb == opOn)
+	{
+		vbPaused = true;
+#ifdef V100
+		hostx->vbPause();
+#endif
+	}
+
+	if (sendingAb == opOn && !adaptedBody.empty())
+		hostx->noteAbContentAvailable();
+}
+
+void Adapter::Xaction::StopVirginBody() {
+	if (receivingVb == opOn)
+	{
+		hostx->vbStopMaking(); // we will not call vbContent() any more
+		receivingVb = opComplete;
+	}
+	else
+	{
+		// we already got the entire body or refused it earlier
+		Must(receivingVb != opUndecided);
+	}
+}
+
+void Adapter::Xaction::abDiscard() {
+	Must((pipeline || !staticBody.empty()) && sendingAb == opUndecided); // have not started yet
+	sendingAb = opNever;
+	adaptedBody.clear();
+	staticBody = std::string_view();
+	if (pipeline)
+		StopVirginBody();
+}
+
+void Adapter::Xaction::abMake() {
+	Must((pipeline || !staticBody.empty()) && sendingAb == opUndecided); // have not yet started or decided not to send
+	sendingAb = opOn;
+
+	// A static body is there in full right away
+	if (!pipeline)
+	{
+		hostx->noteAbContentAvailable();
+		hostx->noteAbContentDone(true);
+		sendingAb = opComplete;
+		return;
+	}
+
+	if (!adaptedBody.empty())
+		hostx->noteAbContentAvailable();
+
+	// The whole virgin body may have been adapted already, or cut short where it could not be decoded
+	if (receivingVb == opComplete)
+	{
+		hostx->noteAbContentDone(!abTruncated);
+		sendingAb = opComplete;
+	}
+}
+
+void Adapter::Xaction::abMakeMore() {
+	// The virgin body may have been stopped already, see PumpVirginBody()
+	if (receivingVb != opOn)
+		return;
+
+	hostx->vbMakeMore();
+}
+
+void Adapter::Xaction::abStopMaking() {
+	sendingAb = opComplete;
+	if (pipeline)
+		StopVirginBody();
+}
+
+libecap::Area Adapter::Xaction::abContent(libecap::size_type offset, libecap::size_type size) {
+	Must(sendingAb == opOn || sendingAb == opComplete);
+
+	// Points into the static body or the CDN store, the host copies what it keeps
+	if (!pipeline)
+		return offset >= staticBody.size() ? libecap::Area() : libecap::Area(staticBody.data() + offset, std::min<size_t>(size, staticBody.size() - offset));
+
+	if (offset >= adaptedBody.size())
+		return libecap::Area();
+
+	return libecap::Area::FromTempBuffer(adaptedBody.data() + offset, std::min<size_t>(size, adaptedBody.size() - offset));
+}
+
+void Adapter::Xaction::abContentShift(libecap::size_type size) {
+	Must(sendingAb == opOn || sendingAb == opComplete);
+	if (!pipeline)
+	{
+		staticBody.remove_prefix(std::min<size_t>(size, staticBody.size()));
+		return;
+	}
+
+	adaptedBody.erase(0, size);
+
+	// Room again, take on more of the virgin body
+	if (vbPaused && adaptedBody.size() < ContentScanners::getInstance().MaxPending() / 2)
+	{
+		vbPaused = false;
+#ifdef V100
+		hostx->vbResume();
+#endif
+		PumpVirginBody(false);
+	}
+}
+
+void Adapter::Xaction::noteVbContentDone(bool atEnd) {
+	Must(pipeline && receivingVb == opOn);
+
+	// The rest of the body is adapted at once, it is no more than the host buffered
+	PumpVirginBody(true);
+	if (receivingVb != opOn)
+		return; // could not be decoded
+
+	receivingVb = opComplete;
+	vbPaused = false;
+
+	abTruncated = !atEnd;
+
+	const size_t adaptedBefore = adaptedBody.size();
+	if (!pipeline->Finish(adaptedBody))
+	{
+		Stats::getInstance().Count(Stats::scBodyErrors);
+		abTruncated = true;
+	}
+	Stats::getInstance().Count(Stats::scBodyBytesOut, adaptedBody.size() - adaptedBefore);
+
+	if (sendingAb == opOn)
+	{
+		hostx->noteAbContentAvailable();
+		hostx->noteAbContentDone(!abTruncated);
+		sendingAb = opComplete;
+	}
+}
+
+void Adapter::Xaction::noteVbContentAvailable() {
+	Must(pipeline && receivingVb == opOn);
+
+	// While paused the host may still announce content, it stays with the host until there is room
+	if (!vbPaused)
+		PumpVirginBody(false);
 }
 
 // create the adapter and register with libecap to reach the host application
@@ -0,0 +1,57 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<bool> enabled(false);
+std::atomic<uint64_t> allocations(0);
+
+void *Allocate(std::size_t size)
+{
+	if (enabled.load(std::memory_order_relaxed))
+		allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void *memory = malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void *AllocateNoThrow(std::size_t size) noexcept
+{
+	try
+	{
+		return Allocate(size);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return nullptr;
+	}
+}
+
+} // namespace
+
+void AllocationCounter::Enable(bool enable)
+{
+	enabled.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t AllocationCounter::Allocations()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size) { return Allocate(size); }
+void *operator new[](std::size_t size) { return Allocate(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return AllocateNoThrow(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return AllocateNoThrow(size); }
+
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete[](void *memory) noexcept { free(memory); }
+void operator delete(void *memory, std::size_t) noexcept { free(memory); }
+void operator delete[](void *memory, std::size_t) noexcept { free(memory); }
+void operator delete(void *memory, const std::nothrow_t &) noexcept { free(memory); }
+void operator delete[](void *memory, const std::nothrow_t &) noexcept { free(memory); }
@@ -0,0 +1,14 @@
+#ifndef ECAP_NBLOCK_ALLOCATIONCOUNTER_H
+#define ECAP_NBLOCK_ALLOCATIONCOUNTER_H
+
+#include <stdint.h>
+
+// Counts the heap allocations of the whole process, the adapter included, while enabled. Linking AllocationCounter.cc
+// into a tool replaces the global operator new and delete of that tool.
+class AllocationCounter {
+public:
+	static void Enable(bool enable);
+	static uint64_t Allocations(); // operator new calls while enabled, from any thread
+};
+
+#endif
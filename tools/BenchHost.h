@@ -0,0 +1,328 @@
+#ifndef ECAP_NBLOCK_BENCHHOST_H
+#define ECAP_NBLOCK_BENCHHOST_H
+
+// In-process fake libecap host shared by the tools that drive the adapter without Squid (nblock_bench,
+// nblock_alloc_check), and the request log format they replay.
+
+#include <libecap/adapter/service.h>
+#include <libecap/adapter/xaction.h>
+#include <libecap/common/area.h>
+#include <libecap/common/errors.h>
+#include <libecap/common/header.h>
+#include <libecap/common/message.h>
+#include <libecap/common/name.h>
+#include <libecap/common/named_values.h>
+#include <libecap/host/host.h>
+#include <libecap/host/xaction.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <strings.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Request {
+	std::string uri;
+	std::string path; // what Squid passes to wantsUrl(): the uri without scheme and authority
+	std::string host;
+	std::string accept;
+	std::string referer;
+	std::string xRequest;
+};
+
+// Fake host side of libecap: messages and transactions backed by the replayed request
+
+class BenchHeader: public libecap::Header {
+public:
+	void Set(const char *name, const std::string &value)
+	{
+		if (!value.empty() && fieldCount < maxFields)
+			fields[fieldCount++] = std::make_pair(name, &value);
+	}
+
+	virtual bool hasAny(const libecap::Name &name) const { return Find(name) != nullptr; }
+	virtual Value value(const libecap::Name &name) const
+	{
+		// Like a zero copy host, the value points into the request log
+		const std::string *found = Find(name);
+		return found ? libecap::Area(found->data(), found->size()) : libecap::Area();
+	}
+	virtual void add(const libecap::Name &, const Value &) {}
+	virtual void removeAny(const libecap::Name &) {}
+	virtual void visitEach(libecap::NamedValueVisitor &) const {}
+	virtual libecap::Area image() const { return libecap::Area(); }
+	virtual void parse(const libecap::Area &) {}
+
+private:
+	// No allocation per request, nblock_bench counts the allocations of the whole process
+	static const size_t maxFields = 8;
+	std::pair<const char *, const std::string *> fields[maxFields];
+	size_t fieldCount = 0;
+
+	const std::string *Find(const libecap::Name &name) const
+	{
+		for (size_t i = 0; i < fieldCount; i++)
+		{
+			if (strcasecmp(fields[i].first, name.image().c_str()) == 0)
+				return fields[i].second;
+		}
+		return nullptr;
+	}
+};
+
+class BenchRequestLine: public libecap::RequestLine {
+public:
+	explicit BenchRequestLine(const std::string &aUri): requestUri(aUri) {}
+
+	virtual libecap::Version version() const { return libecap::Version(1, 1); }
+	virtual void version(const libecap::Version &) {}
+	virtual libecap::Name protocol() const { return libecap::Name("HTTP"); }
+	virtual void protocol(const libecap::Name &) {}
+	virtual void uri(const libecap::Area &) {}
+	virtual libecap::Area uri() const { return libecap::Area(requestUri.data(), requestUri.size()); }
+	virtual void method(const libecap::Name &) {}
+	virtual libecap::Name method() const { return libecap::Name("GET"); }
+
+private:
+	const std::string &requestUri;
+};
+
+class BenchMessage: public libecap::Message {
+public:
+	explicit BenchMessage(const Request &request): requestLine(request.uri)
+	{
+		fields.Set("Host", request.host);
+		fields.Set("Accept", request.accept);
+		fields.Set("Referer", request.referer);
+		fields.Set("X-Requested-With", request.xRequest);
+	}
+
+	virtual libecap::shared_ptr<libecap::Message> clone() const { throw libecap::TextException("nblock_bench: clone() is not supported"); }
+	virtual libecap::FirstLine &firstLine() { return requestLine; }
+	virtual const libecap::FirstLine &firstLine() const { return requestLine; }
+	virtual libecap::Header &header() { return fields; }
+	virtual const libecap::Header &header() const { return fields; }
+	virtual void addBody() {}
+	virtual libecap::Body *body() { return nullptr; }
+	virtual const libecap::Body *body() const { return nullptr; }
+	virtual void addTrailer() {}
+	virtual libecap::Header *trailer() { return nullptr; }
+	virtual const libecap::Header *trailer() const { return nullptr; }
+
+private:
+	BenchRequestLine requestLine;
+	BenchHeader fields;
+};
+
+// Block responses (block_response=) and CDN store answers (cdn_store=) are built from newResponse(), nothing reads them back
+class BenchStatusLine: public libecap::StatusLine {
+public:
+	virtual libecap::Version version() const { return libecap::Version(1, 1); }
+	virtual void version(const libecap::Version &) {}
+	virtual libecap::Name protocol() const { return libecap::Name("HTTP"); }
+	virtual void protocol(const libecap::Name &) {}
+	virtual void statusCode(int code) { statusCodeValue = code; }
+	virtual int statusCode() const { return statusCodeValue; }
+	virtual void reasonPhrase(const libecap::Area &) {}
+	virtual libecap::Area reasonPhrase() const { return libecap::Area(); }
+
+private:
+	int statusCodeValue = 200;
+};
+
+class BenchResponse: public libecap::Message {
+public:
+	virtual libecap::shared_ptr<libecap::Message> clone() const { return libecap::shared_ptr<libecap::Message>(new BenchResponse(*this)); }
+	virtual libecap::FirstLine &firstLine() { return statusLine; }
+	virtual const libecap::FirstLine &firstLine() const { return statusLine; }
+	virtual libecap::Header &header() { return fields; }
+	virtual const libecap::Header &header() const { return fields; }
+	virtual void addBody() {}
+	virtual libecap::Body *body() { return nullptr; }
+	virtual const libecap::Body *body() const { return nullptr; }
+	virtual void addTrailer() {}
+	virtual libecap::Header *trailer() { return nullptr; }
+	virtual const libecap::Header *trailer() const { return nullptr; }
+
+private:
+	BenchStatusLine statusLine;
+	BenchHeader fields;
+};
+
+class BenchXaction: public libecap::host::Xaction {
+public:
+	enum Outcome { oPending, oAllowed, oBlocked, oAdapted, oAborted };
+
+	BenchXaction(const Request &request, std::vector<BenchXaction *> *aResumed):
+		virginMessage(request),
+		resumed(aResumed),
+		outcome(oPending)
+	{
+	}
+
+	libecap::adapter::Service::MadeXactionPointer adapter;
+	Clock::time_point started;
+	Clock::time_point finished;
+
+	Outcome Result() const { return outcome; }
+
+	// Options
+	virtual const libecap::Area option(const libecap::Name &) const { return libecap::Area(); }
+	virtual void visitEachOption(libecap::NamedValueVisitor &) const {}
+
+	// Transaction
+	virtual libecap::Message &virgin() { return virginMessage; }
+	virtual const libecap::Message &cause() { throw libecap::TextException("nblock_bench: requests have no cause"); }
+	virtual libecap::Message &adapted() { throw libecap::TextException("nblock_bench: no adapted message"); }
+	virtual void useVirgin() { Finish(oAllowed); }
+	virtual void useAdapted(const libecap::shared_ptr<libecap::Message> &) { Finish(oAdapted); }
+	virtual void blockVirgin() { Finish(oBlocked); }
+	virtual void adaptationDelayed(const libecap::Delay &) {}
+	virtual void adaptationAborted() { if (outcome == oPending) Finish(oAborted); }
+
+	// Squid schedules the adapter's resume() as an async call, the main loop below does the same
+	virtual void resume() { resumed->push_back(this); }
+
+	// Bodies, requests in the log have none
+	virtual void vbDiscard() {}
+	virtual void vbMake() {}
+	virtual void vbStopMaking() {}
+	virtual void vbMakeMore() {}
+	virtual void vbPause() {}
+	virtual void vbResume() {}
+	virtual libecap::Area vbContent(libecap::size_type, libecap::size_type) { return libecap::Area(); }
+	virtual void vbContentShift(libecap::size_type) {}
+	virtual void noteAbContentDone(bool) {}
+	virtual void noteAbContentAvailable() {}
+
+private:
+	BenchMessage virginMessage;
+	std::vector<BenchXaction *> *resumed;
+	Outcome outcome;
+
+	void Finish(Outcome result)
+	{
+		outcome = result;
+		finished = Clock::now();
+	}
+};
+
+class BenchHost: public libecap::host::Host {
+public:
+	bool verbose = false;
+	std::vector<libecap::shared_ptr<libecap::adapter::Service>> services;
+
+	virtual std::string uri() const { return "ecap://nBlock/bench"; }
+	virtual void describe(std::ostream &os) const { os << "nblock_bench fake host"; }
+
+	virtual void noteVersionedService(const char *, const libecap::weak_ptr<libecap::adapter::Service> &service)
+	{
+		services.push_back(service.lock());
+	}
+
+	virtual std::ostream *openDebug(libecap::LogVerbosity)
+	{
+		return verbose ? new std::ostringstream() : nullptr;
+	}
+
+	virtual void closeDebug(std::ostream *debug)
+	{
+		std::lock_guard<std::mutex> lock(mutexLog);
+		std::cerr << static_cast<std::ostringstream *>(debug)->str() << std::endl;
+		delete debug;
+	}
+
+	virtual libecap::shared_ptr<libecap::Message> newRequest() const { throw libecap::TextException("nblock_bench: newRequest() is not supported"); }
+	virtual libecap::shared_ptr<libecap::Message> newResponse() const { return libecap::shared_ptr<libecap::Message>(new BenchResponse()); }
+
+private:
+	std::mutex mutexLog;
+};
+
+// "name=value name=value ..." as the adapter options of squid.conf
+class BenchOptions: public libecap::Options {
+public:
+	explicit BenchOptions(const std::string &line)
+	{
+		std::istringstream words(line);
+		for (std::string word; words >> word;)
+		{
+			size_t equals = word.find('=');
+			if (equals != std::string::npos)
+				values.push_back(std::make_pair(word.substr(0, equals), word.substr(equals + 1)));
+		}
+	}
+
+	virtual const libecap::Area option(const libecap::Name &name) const
+	{
+		for (const auto &value : values)
+		{
+			if (value.first == name.image())
+				return libecap::Area::FromTempString(value.second);
+		}
+		return libecap::Area();
+	}
+
+	virtual void visitEachOption(libecap::NamedValueVisitor &visitor) const
+	{
+		for (const auto &value : values)
+			visitor.visit(libecap::Name(value.first), libecap::Area::FromTempString(value.second));
+	}
+
+private:
+	std::vector<std::pair<std::string, std::string>> values;
+};
+
+// "<uri>\t<host>\t<accept>\t<referer>\t<x-requested-with>" per line, see nblock_bench
+inline std::vector<Request> LoadRequests(const char *fileName)
+{
+	std::vector<Request> requests;
+	std::ifstream logFile(fileName);
+
+	for (std::string line; std::getline(logFile, line);)
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::vector<std::string> columns;
+		std::istringstream fields(line);
+		for (std::string column; std::getline(fields, column, '\t');)
+			columns.push_back(column);
+		columns.resize(5);
+
+		Request request;
+		request.uri = columns[0];
+		request.host = columns[1];
+		request.accept = columns[2];
+		request.referer = columns[3];
+		request.xRequest = columns[4];
+
+		if (request.host.empty())
+		{
+			size_t hostStart = request.uri.find("://");
+			hostStart = (hostStart == std::string::npos) ? 0 : hostStart + 3;
+			request.host = request.uri.substr(hostStart, request.uri.find('/', hostStart) - hostStart);
+		}
+
+		const size_t schemeEnd = request.uri.find("://");
+		if (schemeEnd != std::string::npos)
+		{
+			const size_t pathStart = request.uri.find('/', schemeEnd + 3);
+			request.path = (pathStart == std::string::npos) ? "/" : request.uri.substr(pathStart);
+		}
+		else if (request.uri.compare(0, 1, "/") == 0)
+			request.path = request.uri; // the authority of a CONNECT has no path
+
+		requests.push_back(request);
+	}
+
+	return requests;
+}
+
+#endif
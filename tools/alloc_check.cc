@@ -0,0 +1,122 @@
+// Checks that a request answered from the verdict cache makes no heap allocation in Xaction::start().
+//
+// Usage: nblock_alloc_check <request log> [--show N] --config "<options>"
+//
+// The log and the options are the ones nblock_bench takes. The log is replayed twice to fill the caches and the pools,
+// then once more with every allocation counted while the adapter runs start(). Requests looked up in the cache without
+// a miss must not allocate, the first --show N (default 10) that do are printed. Requests answered with a response of
+// the host (block_response=, cdn_store=) are left out, building that response allocates on the host side: check with
+// block_response=off to cover the blocked requests as well.
+// The verdicts are evaluated synchronously, async_workers= is ignored.
+
+#include "AllocationCounter.h"
+#include "BenchHost.h"
+#include "DecisionCache.h"
+
+#include <libecap/common/registry.h>
+
+int main(int argc, char **argv)
+{
+	std::string options;
+	unsigned long show = 10;
+	for (int i = 2; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--config") == 0)
+			options = argv[i + 1];
+		else if (strcmp(argv[i], "--show") == 0)
+			show = std::stoul(argv[i + 1]);
+	}
+
+	if (argc < 4 || options.empty())
+	{
+		std::cerr << "usage: " << argv[0] << " <request log> [--show N] --config \"<options>\"" << std::endl;
+		return 1;
+	}
+
+	const std::vector<Request> requests = LoadRequests(argv[1]);
+	if (requests.empty())
+	{
+		std::cerr << "nblock_alloc_check: no requests in " << argv[1] << std::endl;
+		return 1;
+	}
+
+	libecap::shared_ptr<BenchHost> host(new BenchHost());
+	libecap::RegisterHost(host);
+
+	libecap::shared_ptr<libecap::adapter::Service> service;
+	for (const auto &candidate : host->services)
+	{
+		if (candidate && candidate->uri().find("CLIENT_REQUEST_MODE") != std::string::npos)
+			service = candidate;
+	}
+
+	if (!service)
+	{
+		std::cerr << "nblock_alloc_check: the adapter registered no request service" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		service->configure(BenchOptions("list_watch=off " + options + " async_workers=0"));
+		service->start();
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << "nblock_alloc_check: " << e.what() << std::endl;
+		return 1;
+	}
+
+	uint64_t checked = 0, allocating = 0, answered = 0, allocations = 0;
+	for (unsigned int pass = 0; pass < 3; pass++)
+	{
+		const bool counting = (pass == 2);
+		for (const Request &request : requests)
+		{
+			if (!service->wantsUrl(request.path.c_str()))
+				continue;
+
+			BenchXaction xaction(request, nullptr);
+			xaction.adapter = service->makeXaction(&xaction);
+
+			const DecisionCache::Counters before = DecisionCache::getInstance().GetCounters();
+			const uint64_t allocationsBefore = AllocationCounter::Allocations();
+			AllocationCounter::Enable(counting);
+			xaction.adapter->start();
+			AllocationCounter::Enable(false);
+			const uint64_t requestAllocations = AllocationCounter::Allocations() - allocationsBefore;
+			const DecisionCache::Counters after = DecisionCache::getInstance().GetCounters();
+
+			xaction.adapter.reset();
+			if (!counting || after.misses != before.misses || after.hits == before.hits)
+				continue;
+
+			if (xaction.Result() == BenchXaction::oAdapted)
+			{
+				answered++;
+				continue;
+			}
+
+			checked++;
+			if (requestAllocations == 0)
+				continue;
+
+			allocations += requestAllocations;
+			if (allocating++ < show)
+				std::cout << requestAllocations << " allocations: " << request.uri << std::endl;
+		}
+	}
+
+	service->stop();
+
+	std::cout << requests.size() << " requests, " << checked << " cache hits checked, " << answered << " answered with a response of the host (not checked), "
+		<< allocating << " allocating (" << allocations << " allocations)" << std::endl;
+
+	if (checked == 0)
+	{
+		std::cerr << "nblock_alloc_check: no cache hit to check, is cache= too small for the log?" << std::endl;
+		return 1;
+	}
+
+	return allocating == 0 ? 0 : 2;
+}
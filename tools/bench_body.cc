@@ -0,0 +1,220 @@
+// Microbenchmark for the response body pipeline (body_scan=): throughput and memory per transaction on a large page.
+//
+// Usage: nblock_bench_body <page> [iterations] [chunk size] [adblock list [page uri]]
+//
+// The page is encoded the way a server would send it, then streamed through a BodyPipeline with the copy scanner in
+// pieces of chunk size bytes (as the host hands them over), once per Content-Encoding. The adapted body is decoded again
+// and compared with the page. With an Adblock list the cosmetic scanner runs instead, with the element hiding filters of
+// that list, and the adapted body is compared with what the scanner makes of the page in one piece.
+
+#include "BodyPipeline.h"
+#include "ContentScanner.h"
+#include "ElementHiding.h"
+#include "ListReader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#endif
+
+static bool ZlibCode(bool compress, int windowBits, const std::string &input, std::string &output)
+{
+	z_stream stream = z_stream();
+	if ((compress ? deflateInit2(&stream, 6, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) : inflateInit2(&stream, windowBits)) != Z_OK)
+		return false;
+
+	stream.next_in = (Bytef *)input.data();
+	stream.avail_in = input.size();
+	output.clear();
+
+	int result;
+	do
+	{
+		char buffer[64 * 1024];
+		stream.next_out = (Bytef *)buffer;
+		stream.avail_out = sizeof(buffer);
+		result = compress ? deflate(&stream, Z_FINISH) : inflate(&stream, Z_NO_FLUSH);
+		output.append(buffer, sizeof(buffer) - stream.avail_out);
+	}
+	while (result == Z_OK);
+
+	compress ? deflateEnd(&stream) : inflateEnd(&stream);
+	return result == Z_STREAM_END;
+}
+
+static bool Encode(BodyPipeline::Encoding encoding, const std::string &page, std::string &encoded)
+{
+	switch (encoding)
+	{
+		case BodyPipeline::enIdentity:
+			encoded = page;
+			return true;
+		case BodyPipeline::enGzip:
+			return ZlibCode(true, 16 + MAX_WBITS, page, encoded);
+		case BodyPipeline::enDeflate:
+			return ZlibCode(true, MAX_WBITS, page, encoded);
+#ifdef HAVE_BROTLI
+		case BodyPipeline::enBrotli:
+		{
+			size_t size = BrotliEncoderMaxCompressedSize(page.size());
+			encoded.resize(size);
+			if (!BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, page.size(), (const uint8_t *)page.data(), &size, (uint8_t *)&encoded[0]))
+				return false;
+			encoded.resize(size);
+			return true;
+		}
+#endif
+		default:
+			return false;
+	}
+}
+
+static bool Decode(BodyPipeline::Encoding encoding, const std::string &encoded, std::string &page)
+{
+	switch (encoding)
+	{
+		case BodyPipeline::enIdentity:
+			page = encoded;
+			return true;
+		case BodyPipeline::enGzip:
+			return ZlibCode(false, 16 + MAX_WBITS, encoded, page);
+		case BodyPipeline::enDeflate:
+			return ZlibCode(false, MAX_WBITS, encoded, page);
+#ifdef HAVE_BROTLI
+		case BodyPipeline::enBrotli:
+		{
+			BrotliDecoderState *state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+			const uint8_t *nextIn = (const uint8_t *)encoded.data();
+			size_t availIn = encoded.size();
+			BrotliDecoderResult result;
+			page.clear();
+			do
+			{
+				uint8_t buffer[64 * 1024];
+				uint8_t *nextOut = buffer;
+				size_t availOut = sizeof(buffer);
+				result = BrotliDecoderDecompressStream(state, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+				page.append((const char *)buffer, sizeof(buffer) - availOut);
+			}
+			while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+			BrotliDecoderDestroyInstance(state);
+			return result == BROTLI_DECODER_RESULT_SUCCESS;
+		}
+#endif
+		default:
+			return false;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: " << argv[0] << " <page> [iterations] [chunk size] [adblock list [page uri]]" << std::endl;
+		return 1;
+	}
+
+	std::ifstream pageFile(argv[1], std::ios::binary);
+	const std::string page((std::istreambuf_iterator<char>(pageFile)), std::istreambuf_iterator<char>());
+	const int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+	const size_t chunkSize = argc > 3 ? std::stoul(argv[3]) : 16 * 1024;
+	if (page.empty() || iterations < 1 || chunkSize < 1)
+	{
+		std::cerr << "empty page or bad arguments" << std::endl;
+		return 1;
+	}
+
+	const std::string uri = argc > 5 ? argv[5] : "http://bench.invalid/";
+	const ContentScanner::Context context = {uri, "text/html"};
+	std::string expected = page;
+
+	if (argc > 4)
+	{
+		std::string rules, elementRules;
+		if (!ListReader::ReadAdblockRules(argv[4], rules, &elementRules))
+		{
+			std::cerr << "cannot read " << argv[4] << std::endl;
+			return 1;
+		}
+
+		const ElementHiding::Counts counts = ElementHiding::getInstance().Load(elementRules);
+		std::cout << "element hiding: " << counts.rules << " filters, " << counts.domains << " domains, " << counts.bytes / 1024 << " KiB of stylesheets" << std::endl;
+
+		std::unique_ptr<ContentScanner> scanner = ElementHiding::getInstance().CreateScanner(context);
+		if (!scanner)
+		{
+			std::cerr << "nothing to hide on " << uri << std::endl;
+			return 1;
+		}
+		expected.clear();
+		scanner->Scan(page.data(), page.size(), expected);
+		scanner->Finish(expected);
+	}
+	ContentScanners::getInstance().Configure({argc > 4 ? "cosmetic" : "copy"}, {"text/html"}, 256 * 1024);
+
+	struct { const char *name; BodyPipeline::Encoding encoding; } const encodings[] = {
+		{"identity", BodyPipeline::enIdentity},
+		{"gzip", BodyPipeline::enGzip},
+		{"deflate", BodyPipeline::enDeflate},
+#ifdef HAVE_BROTLI
+		{"br", BodyPipeline::enBrotli},
+#endif
+	};
+
+	std::cout << "page: " << page.size() / 1024 << " KiB in " << chunkSize << " byte chunks, " << iterations << " iterations" << std::endl;
+	std::cout << "encoding       in KiB    out KiB      MB/s   memory KiB   pending KiB   intact" << std::endl;
+
+	for (const auto &encoding : encodings)
+	{
+		std::string encoded;
+		if (!Encode(encoding.encoding, page, encoded))
+		{
+			std::cerr << encoding.name << ": cannot encode the page" << std::endl;
+			return 1;
+		}
+
+		std::string adapted;
+		size_t peakMemory = 0, peakPending = 0;
+		bool intact = true;
+
+		auto startTime = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			BodyPipeline pipeline(encoding.encoding, ContentScanners::getInstance().Create(context));
+
+			// The host takes the adapted body after every chunk, so only what one chunk produces is pending at once
+			std::string pending;
+			adapted.clear();
+			for (size_t offset = 0; offset < encoded.size() && intact; offset += chunkSize)
+			{
+				pending.clear();
+				intact = pipeline.Write(encoded.data() + offset, std::min(chunkSize, encoded.size() - offset), pending);
+				peakPending = std::max(peakPending, pending.size());
+				peakMemory = std::max(peakMemory, pipeline.MemoryUsage());
+				adapted += pending;
+			}
+
+			pending.clear();
+			intact = intact && pipeline.Finish(pending);
+			adapted += pending;
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		std::string decoded;
+		intact = intact && Decode(encoding.encoding, adapted, decoded) && decoded == expected;
+
+		printf("%-10s %10zu %10zu %9.1f %12zu %13zu   %s\n", encoding.name, encoded.size() / 1024, adapted.size() / 1024,
+			(double)page.size() * iterations / seconds / 1e6, peakMemory / 1024, peakPending / 1024, intact ? "yes" : "NO");
+	}
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+// Microbenchmark comparing the table driven RequestClassifier against the former std::regex based detection.
+//
+// Usage: nblock_bench_classifier <url corpus> [iterations]
+//
+// The corpus holds one request per line: "<uri>[\t<accept>[\t<referer>]]", a plain Squid access.log url column works fine.
+
+#include "RequestClassifier.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+
+struct CorpusEntry {
+	std::string uri;
+	std::string accept;
+	std::string referer;
+};
+
+// The detection as it was implemented in NetFilterAdblock::IsBlackListed before RequestClassifier
+static FilterOption ClassifyRegex(const std::string &requestedUri, const std::string &requestAccept, const std::string &requestReferer)
+{
+	FilterOption options = FONoFilterOption;
+
+	if (std::regex_search(requestedUri, std::regex("\\.(js|json)")))
+		options = (FilterOption)(options | FOScript);
+	else if (std::regex_search(requestedUri, std::regex("\\.(jpeg|jpg|gif|png|bmp|svg)")))
+		options = (FilterOption)(options | FOImage);
+	else if (std::regex_search(requestedUri, std::regex("\\.(css)")) || std::regex_search(requestAccept, std::regex("text/css")))
+		options = (FilterOption)(options | FOStylesheet);
+
+	if (requestReferer == "" && std::regex_search(requestAccept, std::regex("text/html")))
+		options = (FilterOption)(options | FODocument);
+
+	return options;
+}
+
+static std::vector<CorpusEntry> LoadCorpus(const char *fileName)
+{
+	std::vector<CorpusEntry> corpus;
+	std::ifstream corpusFile(fileName);
+
+	for (std::string line; std::getline(corpusFile, line);)
+	{
+		if (line.empty())
+			continue;
+
+		CorpusEntry entry;
+		size_t tab = line.find('\t');
+		entry.uri = line.substr(0, tab);
+		if (tab != std::string::npos)
+		{
+			size_t tab2 = line.find('\t', tab + 1);
+			entry.accept = line.substr(tab + 1, tab2 == std::string::npos ? std::string::npos : tab2 - tab - 1);
+			if (tab2 != std::string::npos)
+				entry.referer = line.substr(tab2 + 1);
+		}
+		corpus.push_back(entry);
+	}
+
+	return corpus;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: " << argv[0] << " <url corpus> [iterations]" << std::endl;
+		return 1;
+	}
+
+	const std::vector<CorpusEntry> corpus = LoadCorpus(argv[1]);
+	const int iterations = argc > 2 ? std::stoi(argv[2]) : 10;
+	if (corpus.empty())
+	{
+		std::cerr << "empty corpus: " << argv[1] << std::endl;
+		return 1;
+	}
+
+	const RequestClassifier &classifier = RequestClassifier::getInstance();
+	unsigned long checksum = 0;
+
+	auto startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		for (const CorpusEntry &entry : corpus)
+			checksum += classifier.Classify(entry.uri, entry.accept, "", "", entry.referer);
+	}
+	double classifierNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+
+	startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		for (const CorpusEntry &entry : corpus)
+			checksum += ClassifyRegex(entry.uri, entry.accept, entry.referer);
+	}
+	double regexNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+
+	// The regex version matched extensions anywhere in the uri (host and query included), report where both disagree
+	unsigned long differences = 0;
+	for (const CorpusEntry &entry : corpus)
+	{
+		if (classifier.Classify(entry.uri, entry.accept, "", "", entry.referer) != ClassifyRegex(entry.uri, entry.accept, entry.referer))
+			differences++;
+	}
+
+	const double requests = (double)corpus.size() * iterations;
+	std::cout << "requests:   " << corpus.size() << " x " << iterations << std::endl;
+	std::cout << "classifier: " << classifierNs / requests << " ns/request" << std::endl;
+	std::cout << "regex:      " << regexNs / requests << " ns/request" << std::endl;
+	std::cout << "speedup:    " << regexNs / classifierNs << "x" << std::endl;
+	std::cout << "differing:  " << differences << " of " << corpus.size() << " (checksum " << checksum << ")" << std::endl;
+
+	return 0;
+}
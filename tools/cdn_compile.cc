@@ -0,0 +1,147 @@
+// Builds the CDN store that the adapter maps with cdn_store=<file> from local copies of CDN resources.
+//
+// Usage: nblock_cdn_compile -o <store> <manifest>...
+//
+// Every line of a manifest names a file, relative to the manifest, followed by the URLs it is served under on the CDNs,
+// separated by whitespace. Lines starting with # are comments:
+//
+//   jquery/3.7.1/jquery.min.js  https://code.jquery.com/jquery-3.7.1.min.js  https://ajax.googleapis.com/ajax/libs/jquery/3.7.1/jquery.min.js
+//
+// The files must be byte for byte what the CDNs serve, pages that load them with Subresource Integrity reject anything
+// else. The content type is taken from the file extension.
+
+#include "BlocklistImage.h"
+#include "CdnStore.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int Usage(const char *program)
+{
+	std::cerr << "usage: " << program << " -o <store> <manifest>..." << std::endl;
+	return 1;
+}
+
+static std::string ContentType(const std::string &fileName)
+{
+	static const struct { const char *extension; const char *type; } types[] = {
+		{".js", "application/javascript; charset=utf-8"},
+		{".mjs", "application/javascript; charset=utf-8"},
+		{".css", "text/css; charset=utf-8"},
+		{".json", "application/json; charset=utf-8"},
+		{".map", "application/json; charset=utf-8"},
+		{".svg", "image/svg+xml"},
+		{".woff2", "font/woff2"},
+		{".woff", "font/woff"},
+		{".ttf", "font/ttf"},
+		{".otf", "font/otf"},
+		{".eot", "application/vnd.ms-fontobject"},
+	};
+
+	for (const auto &type : types)
+	{
+		const size_t length = strlen(type.extension);
+		if (fileName.size() > length && fileName.compare(fileName.size() - length, length, type.extension) == 0)
+			return type.type;
+	}
+	return "application/octet-stream";
+}
+
+static bool ReadManifest(const std::string &manifest, CdnStore::Builder &builder)
+{
+	std::ifstream manifestFile(manifest);
+	if (!manifestFile)
+	{
+		std::cerr << "cannot read " << manifest << std::endl;
+		return false;
+	}
+
+	const size_t slash = manifest.rfind('/');
+	const std::string directory = (slash == std::string::npos) ? std::string() : manifest.substr(0, slash + 1);
+
+	size_t lineNumber = 0, files = 0;
+	for (std::string line; std::getline(manifestFile, line);)
+	{
+		lineNumber++;
+		std::istringstream fields(line);
+		std::string fileName;
+		if (!(fields >> fileName) || fileName[0] == '#')
+			continue;
+
+		const std::string path = (fileName[0] == '/') ? fileName : directory + fileName;
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			std::cerr << manifest << ":" << lineNumber << ": cannot read " << path << std::endl;
+			return false;
+		}
+		const std::string body((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		const std::string contentType = ContentType(fileName);
+
+		size_t urls = 0;
+		for (std::string url; fields >> url; urls++)
+		{
+			std::string error;
+			if (!builder.Add(url, body, contentType, error))
+			{
+				std::cerr << manifest << ":" << lineNumber << ": " << error << std::endl;
+				return false;
+			}
+		}
+
+		if (urls == 0)
+		{
+			std::cerr << manifest << ":" << lineNumber << ": no URL for " << fileName << std::endl;
+			return false;
+		}
+		files++;
+	}
+
+	std::cout << manifest << ": " << files << " files" << std::endl;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	std::string output;
+	std::vector<std::string> manifests;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if (argv[i][0] != '-')
+			manifests.push_back(argv[i]);
+		else
+			return Usage(argv[0]);
+	}
+
+	if (output.empty() || manifests.empty())
+		return Usage(argv[0]);
+
+	CdnStore::Builder builder;
+	for (const std::string &manifest : manifests)
+	{
+		if (!ReadManifest(manifest, builder))
+			return 1;
+	}
+
+	BlocklistImage::Writer writer;
+	builder.Write(writer);
+
+	std::string error;
+	if (!writer.Write(output, error))
+	{
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	std::cout << output << ": " << builder.Urls() << " URLs, " << builder.Resources() << " resources, " << builder.BodyBytes() / 1024 << " KiB stored, "
+		<< builder.SharedBytes() / 1024 << " KiB of duplicates left out" << std::endl;
+	return 0;
+}
@@ -0,0 +1,165 @@
+// Differential test of the native Adblock matcher (matcher=native) against AdBlockClient, run before switching over.
+//
+// Usage: nblock_matcher_diff <request log> <adblock list>... [--show N]
+//
+// The request log is the one nblock_bench replays: "<uri>\t<host>\t<accept>\t<referer>\t<x-requested-with>", trailing
+// columns are optional. Every request is classified the way the adapter does it and matched by both engines, uncached.
+// The first --show N (default 20) requests they disagree on are printed with the filter each engine matched, followed by
+// the totals and the time per request of each engine.
+
+#include "AdblockMatcher.h"
+#include "HostName.h"
+#include "ListReader.h"
+#include "RequestClassifier.h"
+#include "RuleOptimizer.h"
+#include "ad_block_client.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Request {
+	std::string uri;
+	std::string accept;
+	std::string referer;
+	std::string xRequest;
+	FilterOption options;
+	std::string referringHost;
+};
+
+static std::string ClientRule(AdBlockClient &client, const Request &request)
+{
+	Filter *matchingFilter = nullptr;
+	Filter *matchingExceptionFilter = nullptr;
+	if (!client.findMatchingFilters(request.uri.c_str(), request.options, request.referringHost.c_str(), &matchingFilter, &matchingExceptionFilter) || !matchingFilter || !matchingFilter->data)
+		return "?";
+
+	std::string rule(matchingFilter->data, matchingFilter->dataLen >= 0 ? matchingFilter->dataLen : strlen(matchingFilter->data));
+	if (matchingExceptionFilter && matchingExceptionFilter->data)
+		rule += " (exception " + std::string(matchingExceptionFilter->data, matchingExceptionFilter->dataLen >= 0 ? matchingExceptionFilter->dataLen : strlen(matchingExceptionFilter->data)) + ")";
+	return rule;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> lists;
+	unsigned long show = 20;
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--show") == 0 && i + 1 < argc)
+			show = std::stoul(argv[++i]);
+		else
+			lists.push_back(argv[i]);
+	}
+
+	if (argc < 3 || lists.empty())
+	{
+		std::cerr << "usage: " << argv[0] << " <request log> <adblock list>... [--show N]" << std::endl;
+		return 1;
+	}
+
+	// The same filters the adapter loads from text lists without list_optimize
+	std::string rules;
+	for (const std::string &fileName : lists)
+	{
+		if (!ListReader::ReadAdblockRules(fileName, rules))
+		{
+			std::cerr << "cannot read " << fileName << std::endl;
+			return 1;
+		}
+	}
+	RuleOptimizer::Result result;
+	rules = RuleOptimizer::Deduplicate(rules, result);
+
+	std::vector<Request> requests;
+	std::ifstream logFile(argv[1]);
+	for (std::string line; std::getline(logFile, line);)
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::vector<std::string> columns;
+		std::istringstream fields(line);
+		for (std::string column; std::getline(fields, column, '\t');)
+			columns.push_back(column);
+		columns.resize(5);
+
+		Request request;
+		request.uri = columns[0];
+		request.accept = columns[2];
+		request.referer = columns[3];
+		request.xRequest = columns[4];
+		request.options = RequestClassifier::getInstance().Classify(request.uri, request.accept, request.xRequest, std::string_view(), request.referer);
+		request.referringHost = std::string(ReferringHost(request.referer));
+		requests.push_back(request);
+	}
+
+	if (requests.empty())
+	{
+		std::cerr << "no requests in " << argv[1] << std::endl;
+		return 1;
+	}
+
+	auto startTime = Clock::now();
+	AdBlockClient client;
+	client.parse(rules.c_str());
+	const double clientBuild = std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+
+	startTime = Clock::now();
+	AdblockMatcher matcher;
+	matcher.Build(rules);
+	const double matcherBuild = std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+
+	std::cout << "AdBlockClient: " << client.numFilters << " filters, built in " << (long)clientBuild << " ms" << std::endl;
+	std::cout << "native: " << matcher.Filters() << " filters (" << matcher.ExceptionFilters() << " exceptions, " << matcher.RegexFilters() << " regex, "
+		<< matcher.UnkeyedFilters() << " unkeyed, " << matcher.IgnoredFilters() << " unsupported), " << matcher.States() << " states, "
+		<< matcher.MemoryUsage() / 1024 << " KiB, built in " << (long)matcherBuild << " ms" << std::endl;
+
+	std::vector<char> clientVerdicts(requests.size()), matcherVerdicts(requests.size());
+
+	startTime = Clock::now();
+	for (size_t i = 0; i < requests.size(); i++)
+		clientVerdicts[i] = client.matches(requests[i].uri.c_str(), requests[i].options, requests[i].referringHost.c_str());
+	const double clientTime = std::chrono::duration<double, std::nano>(Clock::now() - startTime).count();
+
+	startTime = Clock::now();
+	for (size_t i = 0; i < requests.size(); i++)
+		matcherVerdicts[i] = matcher.Matches(requests[i].uri, requests[i].options, requests[i].referringHost);
+	const double matcherTime = std::chrono::duration<double, std::nano>(Clock::now() - startTime).count();
+
+	size_t blocked = 0, onlyClient = 0, onlyMatcher = 0, unreferred = 0, unreferredDisagreed = 0;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		unreferred += requests[i].referringHost.empty();
+		blocked += clientVerdicts[i] && matcherVerdicts[i];
+		if (clientVerdicts[i] == matcherVerdicts[i])
+			continue;
+
+		unreferredDisagreed += requests[i].referringHost.empty();
+		(clientVerdicts[i] ? onlyClient : onlyMatcher)++;
+		if (onlyClient + onlyMatcher > show)
+			continue;
+
+		const Request &request = requests[i];
+		std::string matcherRule;
+		matcher.Matches(request.uri, request.options, request.referringHost, &matcherRule);
+		std::cout << (clientVerdicts[i] ? "AdBlockClient only: " : "native only: ") << request.uri << " (type " << request.options << ", from "
+			<< (request.referringHost.empty() ? "-" : request.referringHost) << ")" << std::endl;
+		std::cout << "  AdBlockClient: " << (clientVerdicts[i] ? ClientRule(client, request) : "-") << std::endl;
+		std::cout << "  native: " << (matcherVerdicts[i] ? matcherRule : "-") << std::endl;
+	}
+
+	const size_t agreed = requests.size() - onlyClient - onlyMatcher;
+	std::cout << requests.size() << " requests, " << agreed << " agreed (" << agreed * 100.0 / requests.size() << "%, " << blocked << " blocked by both), "
+		<< onlyClient << " blocked by AdBlockClient only, " << onlyMatcher << " blocked by native only" << std::endl;
+	std::cout << unreferred << " requests without a referring host (third party to both engines), " << unreferredDisagreed << " of them disagreed" << std::endl;
+	std::cout << "AdBlockClient: " << (long)(clientTime / requests.size()) << " ns/request, native: " << (long)(matcherTime / requests.size()) << " ns/request" << std::endl;
+
+	return (onlyClient + onlyMatcher) == 0 ? 0 : 2;
+}
@@ -0,0 +1,337 @@
+// Replays a recorded request log through the nBlock request service against an in-process fake libecap host, so the
+// adapter can be measured without Squid.
+//
+// Usage: nblock_bench <request log> [--threads N] [--inflight N] [--repeat N] [--warmup] [--verbose]
+//                     [--common "<options>"] --config "<options>" [--config "<options>"]...
+//
+// The log holds one request per line: "<uri>\t<host>\t<accept>\t<referer>\t<x-requested-with>", trailing columns are
+// optional and an empty host is taken from the uri. Lines starting with # are skipped.
+// Options are the adapter options of squid.conf, eg --config "list_domains=domains.txt cache=10000 async_workers=4",
+// cache= is required just like it is there.
+// --common is prepended to every configuration. Every configuration runs in its own process, so none of them starts
+// with the caches or lists of another one.
+//
+// Without async_workers the log is replayed by --threads threads calling Xaction::start() concurrently. With
+// async_workers one thread plays Squid's main loop: it keeps --inflight transactions going, and drives
+// Service::suspend() / resume() and the resumed transactions the way Squid does.
+// new/req counts the operator new calls of the measured passes per request, in the whole process: besides the adapter,
+// the fake host allocates the response of a request answered with one (block_response=, cdn_store=) and, in async mode,
+// a transaction and its list entry per request.
+
+#include "AllocationCounter.h"
+#include "BenchHost.h"
+#include "DecisionCache.h"
+
+#include <libecap/common/registry.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <list>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+struct BenchSettings {
+	unsigned int threads = 1;
+	unsigned int inflight = 64;
+	unsigned int repeat = 1;
+	bool warmup = false;
+	bool verbose = false;
+};
+
+// Replay
+
+struct RunResult {
+	std::vector<uint64_t> latencies; // ns per request
+	uint64_t blocked = 0;
+	uint64_t unfinished = 0;
+};
+
+static void Collect(BenchXaction &xaction, RunResult &result)
+{
+	if (xaction.Result() == BenchXaction::oPending)
+	{
+		result.unfinished++;
+		return;
+	}
+
+	// A request is answered with an adapted message when it is blocked (block_response=), or from cdn_store= which is
+	// counted the same way: either way it never reaches the server
+	if (xaction.Result() == BenchXaction::oBlocked || xaction.Result() == BenchXaction::oAdapted)
+		result.blocked++;
+	result.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(xaction.finished - xaction.started).count());
+}
+
+// Every thread calls start() directly, the verdict is known once it returns
+static void ReplaySync(libecap::adapter::Service &service, const std::vector<Request> &requests, unsigned int passes, unsigned int threads, RunResult &result)
+{
+	std::vector<RunResult> threadResults(threads);
+	std::vector<std::thread> workers;
+	const size_t total = requests.size() * passes;
+
+	auto replay = [&](unsigned int t)
+	{
+		RunResult &threadResult = threadResults[t];
+		threadResult.latencies.reserve(total / threads + 1);
+
+		for (size_t i = t; i < total; i += threads)
+		{
+			const Request &request = requests[i % requests.size()];
+			BenchXaction xaction(request, nullptr);
+			xaction.started = Clock::now();
+
+			// wantsUrl() gets the path, like Squid passes it: list_bypass= hosts are bypassed by Xaction::start()
+			if (service.wantsUrl(request.path.c_str()))
+			{
+				xaction.adapter = service.makeXaction(&xaction);
+				xaction.adapter->start();
+			}
+			else
+				xaction.useVirgin();
+
+			Collect(xaction, threadResult);
+			xaction.adapter.reset();
+		}
+	};
+
+	// A single thread replays on the calling one: Squid calls start() on its main thread, where Debugger logs directly
+	if (threads == 1)
+		replay(0);
+
+	for (unsigned int t = 0; threads > 1 && t < threads; t++)
+	{
+		workers.push_back(std::thread(replay, t));
+	}
+
+	for (std::thread &worker : workers)
+		worker.join();
+
+	for (RunResult &threadResult : threadResults)
+	{
+		result.latencies.insert(result.latencies.end(), threadResult.latencies.begin(), threadResult.latencies.end());
+		result.blocked += threadResult.blocked;
+		result.unfinished += threadResult.unfinished;
+	}
+}
+
+// One thread plays Squid's main loop with a window of transactions waiting for their verdicts
+static void ReplayAsync(libecap::adapter::Service &service, const std::vector<Request> &requests, unsigned int passes, unsigned int inflight, RunResult &result)
+{
+	const size_t total = requests.size() * passes;
+	std::list<std::unique_ptr<BenchXaction>> running;
+	std::vector<BenchXaction *> resumed;
+	size_t next = 0;
+
+	result.latencies.reserve(total);
+
+	while (next < total || !running.empty())
+	{
+		while (next < total && running.size() < inflight)
+		{
+			const Request &request = requests[next++ % requests.size()];
+			std::unique_ptr<BenchXaction> xaction(new BenchXaction(request, &resumed));
+			xaction->started = Clock::now();
+
+			if (service.wantsUrl(request.path.c_str()))
+			{
+				xaction->adapter = service.makeXaction(xaction.get());
+				xaction->adapter->start();
+			}
+			else
+				xaction->useVirgin();
+			running.push_back(std::move(xaction));
+		}
+
+		// Squid would wait for I/O here for at most the suspend() timeout, the loop stays busy instead
+		timeval timeout = {1, 0};
+		service.suspend(timeout);
+		service.resume();
+
+		for (BenchXaction *xaction : resumed)
+			xaction->adapter->resume();
+		resumed.clear();
+
+		for (auto xaction = running.begin(); xaction != running.end();)
+		{
+			if ((*xaction)->Result() == BenchXaction::oPending)
+			{
+				++xaction;
+				continue;
+			}
+
+			Collect(**xaction, result);
+			(*xaction)->adapter.reset();
+			xaction = running.erase(xaction);
+		}
+
+		if (!running.empty() && resumed.empty())
+			std::this_thread::yield();
+	}
+}
+
+static double Percentile(const std::vector<uint64_t> &sorted, double fraction)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()))] / 1000.0;
+}
+
+static int RunConfiguration(BenchHost &host, const std::string &options, const std::vector<Request> &requests, const BenchSettings &settings)
+{
+	libecap::shared_ptr<libecap::adapter::Service> service;
+	for (const auto &candidate : host.services)
+	{
+		if (candidate && candidate->uri().find("CLIENT_REQUEST_MODE") != std::string::npos)
+			service = candidate;
+	}
+
+	if (!service)
+	{
+		std::cerr << "nblock_bench: the adapter registered no request service" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		// Background reloads only add noise, a configuration can still turn them back on
+		service->configure(BenchOptions("list_watch=off " + options));
+		service->start();
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << "nblock_bench: " << e.what() << std::endl;
+		return 1;
+	}
+
+	const bool async = service->makesAsyncXactions();
+	RunResult warmupResult, result;
+
+	if (settings.warmup)
+	{
+		if (async)
+			ReplayAsync(*service, requests, 1, settings.inflight, warmupResult);
+		else
+			ReplaySync(*service, requests, 1, settings.threads, warmupResult);
+	}
+
+	const DecisionCache::Counters before = DecisionCache::getInstance().GetCounters();
+	const uint64_t allocationsBefore = AllocationCounter::Allocations();
+	AllocationCounter::Enable(true);
+	auto startTime = Clock::now();
+
+	if (async)
+		ReplayAsync(*service, requests, settings.repeat, settings.inflight, result);
+	else
+		ReplaySync(*service, requests, settings.repeat, settings.threads, result);
+
+	const double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+	AllocationCounter::Enable(false);
+	const uint64_t allocations = AllocationCounter::Allocations() - allocationsBefore;
+	const DecisionCache::Counters after = DecisionCache::getInstance().GetCounters();
+	service->stop();
+
+	const uint64_t hits = after.hits - before.hits;
+	const uint64_t lookups = hits + after.misses - before.misses;
+	std::sort(result.latencies.begin(), result.latencies.end());
+
+	std::cout << std::fixed << std::setprecision(2) << std::setw(6) << (async ? "async" : "sync")
+		<< std::setw(10) << result.latencies.size()
+		<< std::setw(12) << (uint64_t)(result.latencies.size() / seconds)
+		<< std::setw(10) << Percentile(result.latencies, 0.50)
+		<< std::setw(10) << Percentile(result.latencies, 0.99)
+		<< std::setw(10) << Percentile(result.latencies, 0.999)
+		<< std::setw(10) << result.blocked
+		<< std::setw(9) << std::setprecision(1) << std::fixed << (lookups ? 100.0 * hits / lookups : 0.0) << "%"
+		<< std::setw(10) << std::setprecision(2) << (result.latencies.empty() ? 0.0 : (double)allocations / result.latencies.size())
+		<< "  " << options << std::endl;
+
+	if (result.unfinished)
+		std::cerr << "nblock_bench: " << result.unfinished << " transactions did not finish" << std::endl;
+
+	return result.unfinished ? 1 : 0;
+}
+
+static int Usage(const char *program)
+{
+	std::cerr << "usage: " << program << " <request log> [--threads N] [--inflight N] [--repeat N] [--warmup] [--verbose]" << std::endl
+		<< "       [--common \"<options>\"] --config \"<options>\" [--config \"<options>\"]..." << std::endl;
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		return Usage(argv[0]);
+
+	BenchSettings settings;
+	std::string common;
+	std::vector<std::string> configurations;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--warmup") == 0)
+			settings.warmup = true;
+		else if (strcmp(argv[i], "--verbose") == 0)
+			settings.verbose = true;
+		else if (i + 1 >= argc)
+			return Usage(argv[0]);
+		else if (strcmp(argv[i], "--threads") == 0)
+			settings.threads = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--inflight") == 0)
+			settings.inflight = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--repeat") == 0)
+			settings.repeat = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--common") == 0)
+			common = argv[++i];
+		else if (strcmp(argv[i], "--config") == 0)
+			configurations.push_back(argv[++i]);
+		else
+			return Usage(argv[0]);
+	}
+
+	if (configurations.empty())
+		configurations.push_back("");
+
+	std::vector<Request> requests = LoadRequests(argv[1]);
+	if (requests.empty())
+	{
+		std::cerr << "nblock_bench: no requests in " << argv[1] << std::endl;
+		return 1;
+	}
+
+	libecap::shared_ptr<BenchHost> host(new BenchHost());
+	host->verbose = settings.verbose;
+	libecap::RegisterHost(host);
+
+	std::cout << requests.size() << " requests x " << settings.repeat << (settings.warmup ? " (after a warmup pass)" : "")
+		<< ", " << settings.threads << " threads (sync), " << settings.inflight << " in flight (async), latencies in us" << std::endl;
+	std::cout << std::setw(6) << "mode" << std::setw(10) << "requests" << std::setw(12) << "req/s" << std::setw(10) << "p50"
+		<< std::setw(10) << "p99" << std::setw(10) << "p999" << std::setw(10) << "blocked" << std::setw(10) << "cache" << std::setw(10) << "new/req" << "  options" << std::endl;
+
+	int status = 0;
+	for (const std::string &configuration : configurations)
+	{
+		// Each configuration gets a fresh adapter: the lists, caches and worker pools are process wide singletons
+		std::cout.flush();
+		pid_t child = fork();
+		if (child < 0)
+		{
+			perror("fork");
+			return 1;
+		}
+
+		if (child == 0)
+		{
+			const int result = RunConfiguration(*host, common.empty() ? configuration : common + " " + configuration, requests, settings);
+			std::cout.flush();
+			_exit(result);
+		}
+
+		int childStatus = 0;
+		waitpid(child, &childStatus, 0);
+		if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0)
+			status = 1;
+	}
+
+	return status;
+}
@@ -0,0 +1,157 @@
+// Compiles the text blocklists into one binary image that the adapter maps with list_compiled=<file>.
+//
+// Usage: nblock_compile -o <image> [--hostnames <file>]... [--domains <file>]... [--adblockplus <file>]...
+
+#include "AdblockHostIndex.h"
+#include "BlocklistImage.h"
+#include "DomainTrie.h"
+#include "ListReader.h"
+#include "RuleOptimizer.h"
+#include "UriCanonicalizer.h"
+#include "ad_block_client.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int Usage(const char *program)
+{
+	std::cerr << "usage: " << program << " -o <image> [--hostnames <file>]... [--domains <file>]... [--adblockplus <file>]..." << std::endl;
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	std::string output;
+	std::vector<std::string> hostnameFiles, domainFiles, adblockFiles;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+			return Usage(argv[0]);
+
+		if (strcmp(argv[i], "-o") == 0)
+			output = argv[++i];
+		else if (strcmp(argv[i], "--hostnames") == 0)
+			hostnameFiles.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--domains") == 0)
+			domainFiles.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--adblockplus") == 0)
+			adblockFiles.push_back(argv[++i]);
+		else
+			return Usage(argv[0]);
+	}
+
+	if (output.empty() || (hostnameFiles.empty() && domainFiles.empty() && adblockFiles.empty()))
+		return Usage(argv[0]);
+
+	auto startTime = std::chrono::steady_clock::now();
+	BlocklistImage::Writer writer;
+	DomainTrie blockList;
+
+	if (!hostnameFiles.empty() || !domainFiles.empty())
+	{
+
+		for (const std::string &fileName : hostnameFiles)
+		{
+			std::vector<std::string> hostnames;
+			if (!ListReader::ReadHostnames(fileName, hostnames))
+			{
+				std::cerr << "cannot read " << fileName << std::endl;
+				return 1;
+			}
+			for (const std::string &hostname : hostnames)
+				blockList.Insert(hostname, DomainTrie::tfHostname);
+			std::cout << fileName << ": " << hostnames.size() << " hostnames" << std::endl;
+		}
+
+		for (const std::string &fileName : domainFiles)
+		{
+			std::vector<std::string> domains;
+			if (!ListReader::ReadDomains(fileName, domains))
+			{
+				std::cerr << "cannot read " << fileName << std::endl;
+				return 1;
+			}
+			for (const std::string &domain : domains)
+				blockList.Insert(domain, DomainTrie::tfDomain);
+			std::cout << fileName << ": " << domains.size() << " domains" << std::endl;
+		}
+
+		blockList.Build();
+		writer.Add(BlocklistImage::stTrieNodes, blockList.NodeData(), blockList.NodeBytes(), blockList.Entries());
+		writer.Add(BlocklistImage::stTrieLabels, blockList.LabelData(), blockList.LabelBytes(), 0);
+		std::cout << "hostname / domain index: " << blockList.Entries() << " entries, " << blockList.MemoryUsage() / 1024 << " KiB" << std::endl;
+
+		const XorFilter &prefilter = blockList.Prefilter();
+		if (!prefilter.Empty())
+		{
+			writer.Add(BlocklistImage::stTrieFilter, prefilter.Data(), prefilter.Bytes(), prefilter.Keys());
+			std::cout << "hostname / domain prefilter: " << prefilter.Keys() << " entries, " << prefilter.Bytes() / 1024 << " KiB, "
+				<< prefilter.MeasureFalsePositiveRate() * 100 << "% false positives" << std::endl;
+		}
+	}
+
+	if (!adblockFiles.empty())
+	{
+		std::string rules, elementRules;
+		for (const std::string &fileName : adblockFiles)
+		{
+			if (!ListReader::ReadAdblockRules(fileName, rules, &elementRules))
+			{
+				std::cerr << "cannot read " << fileName << std::endl;
+				return 1;
+			}
+		}
+
+		// Same pass the adapter runs on text lists (list_optimize), against the hostname / domain index of this image
+		RuleOptimizer::Result result;
+		rules = RuleOptimizer::Optimize(rules, &blockList, result);
+		std::cout << "adblock optimizer: " << result.inputRules << " -> " << result.outputRules << " filters (" << result.duplicates << " duplicate, "
+			<< result.dnsCovered << " covered by the DNS lists, " << result.subsumed << " covered by a broader filter)" << std::endl;
+
+		AdBlockClient client;
+		client.parse(rules.c_str());
+
+		int size = 0;
+		char *serialized = client.serialize(&size);
+		writer.Add(BlocklistImage::stAdblock, serialized, size, client.numFilters);
+		delete[] serialized;
+		std::cout << "adblock filters: " << client.numFilters << ", " << size / 1024 << " KiB" << std::endl;
+
+		// matcher=native builds its automaton from the text when the image is loaded
+		writer.Add(BlocklistImage::stAdblockRules, rules.data(), rules.size(), client.numFilters);
+
+		UriCanonicalizer canonicalizer;
+		canonicalizer.Build(rules);
+		const std::string tokens = canonicalizer.Serialize();
+		writer.Add(BlocklistImage::stUriTokens, tokens.data(), tokens.size(), canonicalizer.FilterTokens());
+		if (canonicalizer.Enabled())
+			std::cout << "adblock cache keys: " << canonicalizer.FilterTokens() << " filter tokens" << std::endl;
+		else
+			std::cout << "adblock cache keys: full uri, " << canonicalizer.RegexFilters() << " regex filters" << std::endl;
+
+		AdblockHostIndex hosts;
+		hosts.Build(rules);
+		writer.Add(BlocklistImage::stAdblockHosts, hosts.Rules().data(), hosts.Rules().size(), hosts.HostFilters());
+		std::cout << "adblock host filters: " << hosts.HostFilters() << (hosts.Enabled() ? "" : " (unused, exception filters apply to any host)") << std::endl;
+
+		// Element hiding filters are stored as text, the stylesheets are worked out when the image is loaded
+		const size_t elementFilters = std::count(elementRules.begin(), elementRules.end(), '\n');
+		writer.Add(BlocklistImage::stElementHiding, elementRules.data(), elementRules.size(), elementFilters);
+		std::cout << "element hiding filters: " << elementFilters << ", " << elementRules.size() / 1024 << " KiB" << std::endl;
+	}
+
+	std::string error;
+	if (!writer.Write(output, error))
+	{
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	std::cout << "wrote " << output << " in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count() << " ms" << std::endl;
+	return 0;
+}